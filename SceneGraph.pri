@@ -19,5 +19,5 @@
 
 QT += opengl
 INCLUDEPATH += ../SceneGraph/src
-HEADERS += ../SceneGraph/src/scenegraph.h ../SceneGraph/src/rasterizer.h
-SOURCES += ../SceneGraph/src/scenegraph.cpp ../SceneGraph/src/rasterizer.cpp
+HEADERS += ../SceneGraph/src/scenegraph.h ../SceneGraph/src/rasterizer.h ../SceneGraph/src/renderlist.h ../SceneGraph/src/renderqueue.h ../SceneGraph/src/meshoptimizer.h ../SceneGraph/src/staticbatch.h ../SceneGraph/src/simd.h ../SceneGraph/src/threadpool.h ../SceneGraph/src/parallelupdate.h ../SceneGraph/src/transformsystem.h ../SceneGraph/src/scenearena.h ../SceneGraph/src/texturestreamer.h ../SceneGraph/src/textureatlas.h ../SceneGraph/src/ktxloader.h ../SceneGraph/src/meshfile.h ../SceneGraph/src/programcache.h ../SceneGraph/src/shaderpermutations.h ../SceneGraph/src/resourcemanager.h
+SOURCES += ../SceneGraph/src/scenegraph.cpp ../SceneGraph/src/rasterizer.cpp ../SceneGraph/src/renderlist.cpp ../SceneGraph/src/renderqueue.cpp ../SceneGraph/src/meshoptimizer.cpp ../SceneGraph/src/staticbatch.cpp ../SceneGraph/src/simd.cpp ../SceneGraph/src/simd_sse2.cpp ../SceneGraph/src/simd_avx.cpp ../SceneGraph/src/simd_neon.cpp ../SceneGraph/src/threadpool.cpp ../SceneGraph/src/parallelupdate.cpp ../SceneGraph/src/transformsystem.cpp ../SceneGraph/src/scenearena.cpp ../SceneGraph/src/texturestreamer.cpp ../SceneGraph/src/textureatlas.cpp ../SceneGraph/src/ktxloader.cpp ../SceneGraph/src/meshfile.cpp ../SceneGraph/src/programcache.cpp ../SceneGraph/src/shaderpermutations.cpp ../SceneGraph/src/resourcemanager.cpp
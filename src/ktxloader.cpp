@@ -0,0 +1,224 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "ktxloader.h"
+
+using namespace SceneGraph;
+
+static const uchar ktx1_identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const uchar ktx2_identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+static quint32 read_uint32(const uchar *data, bool swap)
+{
+    quint32 value;
+    memcpy(&value, data, sizeof(value));
+    return swap ? qbswap(value) : value;
+}
+
+Texture2D *KtxLoader::load(const QString &file_name, GLuint unit, Node *parent)
+{
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "KtxLoader: could not open the file\n");
+        return 0;
+    }
+    uchar *data = file.map(0, file.size());
+    if (!data) {
+        fprintf(stderr, "KtxLoader: could not map the file\n");
+        return 0;
+    }
+    // GL has its own copy once the upload calls return
+    Texture2D *texture = load(data, file.size(), unit, parent);
+    file.unmap(data);
+    return texture;
+}
+
+Texture2D *KtxLoader::load(const uchar *data, size_t size, GLuint unit, Node *parent)
+{
+    Description description;
+    description.generate_mipmaps = false;
+    bool parsed = false;
+    if (size >= sizeof(ktx1_identifier) && memcmp(data, ktx1_identifier, sizeof(ktx1_identifier)) == 0)
+        parsed = parseKtx1(data, size, &description);
+    else if (size >= sizeof(ktx2_identifier) && memcmp(data, ktx2_identifier, sizeof(ktx2_identifier)) == 0)
+        parsed = parseKtx2(data, size, &description);
+    else
+        fprintf(stderr, "KtxLoader: not a KTX file\n");
+    if (!parsed)
+        return 0;
+
+    Texture2D *texture = new Texture2D(&description.levels[0], description.levels.size(), description.internal_format,
+                                       description.format, description.type, unit, parent);
+    if (!texture->m_id) {
+        delete texture;
+        return 0;
+    }
+    if (description.generate_mipmaps && description.type != 0)
+        texture->generateMipmaps();
+    return texture;
+}
+
+bool KtxLoader::parseKtx1(const uchar *data, size_t size, Description *description)
+{
+    enum { HeaderSize = 64 };
+    if (size < HeaderSize) {
+        fprintf(stderr, "KtxLoader: truncated header\n");
+        return false;
+    }
+    const bool swap = read_uint32(data + 12, false) == 0x01020304;
+    const quint32 type = read_uint32(data + 16, swap);
+    const quint32 type_size = read_uint32(data + 20, swap);
+    const quint32 format = read_uint32(data + 24, swap);
+    const quint32 internal_format = read_uint32(data + 28, swap);
+    const quint32 width = read_uint32(data + 36, swap);
+    const quint32 height = read_uint32(data + 40, swap);
+    const quint32 depth = read_uint32(data + 44, swap);
+    const quint32 array_elements = read_uint32(data + 48, swap);
+    const quint32 faces = read_uint32(data + 52, swap);
+    const quint32 levels = read_uint32(data + 56, swap);
+    const quint32 key_value_size = read_uint32(data + 60, swap);
+
+    if (width == 0 || height == 0 || depth != 0 || array_elements != 0 || faces != 1) {
+        fprintf(stderr, "KtxLoader: only 2D textures are supported\n");
+        return false;
+    }
+    // the texels would need swapping, which means a copy
+    if (swap && type_size > 1) {
+        fprintf(stderr, "KtxLoader: the file has the wrong endianness\n");
+        return false;
+    }
+
+    description->internal_format = internal_format;
+    description->format = format;
+    description->type = type;
+    description->generate_mipmaps = levels == 0;
+    size_t offset = HeaderSize + size_t(key_value_size);
+    for (quint32 i = 0; i < qMax(levels, 1u); ++i) {
+        if (offset + 4 > size) {
+            fprintf(stderr, "KtxLoader: truncated mip level\n");
+            return false;
+        }
+        const quint32 image_size = read_uint32(data + offset, swap);
+        offset += 4;
+        if (offset + image_size > size) {
+            fprintf(stderr, "KtxLoader: truncated mip level\n");
+            return false;
+        }
+        Texture2D::Level level;
+        level.width = qMax(width >> i, 1u);
+        level.height = qMax(height >> i, 1u);
+        level.bits = data + offset;
+        level.size = image_size;
+        level.alignment = 4; // KTX 1 pads every row
+        description->levels.push_back(level);
+        offset += (image_size + 3) & ~3u;
+    }
+    return true;
+}
+
+bool KtxLoader::parseKtx2(const uchar *data, size_t size, Description *description)
+{
+    enum { HeaderSize = 80, LevelIndexSize = 24 };
+    if (size < HeaderSize) {
+        fprintf(stderr, "KtxLoader: truncated header\n");
+        return false;
+    }
+    const quint32 vk_format = qFromLittleEndian<quint32>(data + 12);
+    const quint32 width = qFromLittleEndian<quint32>(data + 20);
+    const quint32 height = qFromLittleEndian<quint32>(data + 24);
+    const quint32 depth = qFromLittleEndian<quint32>(data + 28);
+    const quint32 layers = qFromLittleEndian<quint32>(data + 32);
+    const quint32 faces = qFromLittleEndian<quint32>(data + 36);
+    const quint32 levels = qFromLittleEndian<quint32>(data + 40);
+    const quint32 supercompression = qFromLittleEndian<quint32>(data + 44);
+
+    if (width == 0 || height == 0 || depth != 0 || layers != 0 || faces != 1) {
+        fprintf(stderr, "KtxLoader: only 2D textures are supported\n");
+        return false;
+    }
+    if (supercompression != 0) {
+        fprintf(stderr, "KtxLoader: supercompressed files are not supported\n");
+        return false;
+    }
+    if (!translateVkFormat(vk_format, description)) {
+        fprintf(stderr, "KtxLoader: format %u is not supported\n", vk_format);
+        return false;
+    }
+
+    description->generate_mipmaps = levels == 0;
+    const quint32 level_count = qMax(levels, 1u);
+    if (HeaderSize + size_t(level_count) * LevelIndexSize > size) {
+        fprintf(stderr, "KtxLoader: truncated level index\n");
+        return false;
+    }
+    // the index starts at the base level, even though the data is stored smallest first
+    for (quint32 i = 0; i < level_count; ++i) {
+        const uchar *entry = data + HeaderSize + i * LevelIndexSize;
+        const quint64 offset = qFromLittleEndian<quint64>(entry);
+        const quint64 length = qFromLittleEndian<quint64>(entry + 8);
+        if (offset > size || length > size - offset) {
+            fprintf(stderr, "KtxLoader: truncated mip level\n");
+            return false;
+        }
+        Texture2D::Level level;
+        level.width = qMax(width >> i, 1u);
+        level.height = qMax(height >> i, 1u);
+        level.bits = data + offset;
+        level.size = length;
+        level.alignment = 1; // KTX 2 packs the rows tightly
+        description->levels.push_back(level);
+    }
+    return true;
+}
+
+bool KtxLoader::translateVkFormat(quint32 vk_format, Description *description)
+{
+    // sRGB formats are read as linear, there is no sRGB decode for uncompressed textures
+    description->format = GL_RGBA;
+    description->type = 0;
+    switch (vk_format) {
+    case 4: // VK_FORMAT_R5G6B5_UNORM_PACK16
+        description->format = GL_RGB;
+        description->type = GL_UNSIGNED_SHORT_5_6_5;
+        break;
+    case 23: // VK_FORMAT_R8G8B8_UNORM
+    case 29: // VK_FORMAT_R8G8B8_SRGB
+        description->format = GL_RGB;
+        description->type = GL_UNSIGNED_BYTE;
+        break;
+    case 37: // VK_FORMAT_R8G8B8A8_UNORM
+    case 43: // VK_FORMAT_R8G8B8A8_SRGB
+        description->type = GL_UNSIGNED_BYTE;
+        break;
+    case 131: description->internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+    case 133: description->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+    case 135: description->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; break;
+    case 137: description->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+    case 147: description->internal_format = GL_COMPRESSED_RGB8_ETC2; break;
+    case 148: description->internal_format = GL_COMPRESSED_SRGB8_ETC2; break;
+    case 149: description->internal_format = GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2; break;
+    case 150: description->internal_format = GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2; break;
+    case 151: description->internal_format = GL_COMPRESSED_RGBA8_ETC2_EAC; break;
+    case 152: description->internal_format = GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC; break;
+    case 153: description->internal_format = GL_COMPRESSED_R11_EAC; break;
+    case 154: description->internal_format = GL_COMPRESSED_SIGNED_R11_EAC; break;
+    case 155: description->internal_format = GL_COMPRESSED_RG11_EAC; break;
+    case 156: description->internal_format = GL_COMPRESSED_SIGNED_RG11_EAC; break;
+    default:
+        // VK_FORMAT_ASTC_4x4_UNORM_BLOCK to VK_FORMAT_ASTC_12x12_SRGB_BLOCK, unorm and sRGB alternate
+        if (vk_format >= 157 && vk_format <= 184) {
+            const quint32 block = (vk_format - 157) / 2;
+            const bool srgb = (vk_format - 157) % 2;
+            description->internal_format = (srgb ? GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR : GL_COMPRESSED_RGBA_ASTC_4x4_KHR) + block;
+            break;
+        }
+        return false;
+    }
+    if (description->type != 0)
+        description->internal_format = description->format;
+    return true;
+}
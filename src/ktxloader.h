@@ -0,0 +1,50 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef KTXLOADER_H
+#define KTXLOADER_H
+
+#include <vector>
+
+#include <QtCore>
+
+#include "scenegraph.h"
+
+namespace SceneGraph {
+
+    // Creates a Texture2D from a KTX 1.1 or KTX 2.0 file. The file is mapped
+    // into memory and every mip level is handed to GL straight from the
+    // mapping. A file without mip levels gets them generated. Only plain 2D
+    // textures are read: no arrays, cube maps or 3D textures, and no KTX 2.0
+    // supercompression. Compressed formats the context does not have are
+    // rejected, see Rasterizer::hasCompressedFormat().
+    class KtxLoader
+    {
+    public:
+        // 0 on failure, with the reason on stderr
+        static Texture2D *load(const QString &file, GLuint unit = 0, Node *parent = 0);
+
+        // the same from memory that stays valid during the call
+        static Texture2D *load(const uchar *data, size_t size, GLuint unit = 0, Node *parent = 0);
+
+    private:
+        struct Description {
+            GLenum internal_format;
+            GLenum format;
+            GLenum type; // 0 for compressed formats
+            bool generate_mipmaps;
+            std::vector<Texture2D::Level> levels;
+        };
+
+        static bool parseKtx1(const uchar *data, size_t size, Description *description);
+        static bool parseKtx2(const uchar *data, size_t size, Description *description);
+        static bool translateVkFormat(quint32 vk_format, Description *description);
+    };
+
+}; // SceneGraph
+
+#endif//KTXLOADER_H
@@ -63,44 +63,38 @@ static inline void multiply_quaternions(const float *a, const float *b, float *r
 
 static inline void quaternion_rotate_vector(const float *quaternion, const float *vector, float *result)
 {
-    float vector_quaternion[] = { 0.0, vector[0], vector[1], vector[2], vector[3] };
-    float conjugated_quaternion[] = { quaternion[0], -quaternion[1], -quaternion[2], -quaternion[3] };
-
-    multiply_quaternions(quaternion, vector_quaternion, vector_quaternion);
-    multiply_quaternions(vector_quaternion, conjugated_quaternion, vector_quaternion);
-
-    result[0] = vector_quaternion[1];
-    result[1] = vector_quaternion[2];
-    result[2] = vector_quaternion[3];
+    // q * v * q' expanded, so it also holds for quaternions that are not unit length
+    const float w = quaternion[0];
+    const float *u = quaternion + 1;
+    const float uv = dot_vectors(u, vector);
+    const float uu = dot_vectors(u, u);
+    const float cross[] = {
+        u[1]*vector[2] - u[2]*vector[1],
+        u[2]*vector[0] - u[0]*vector[2],
+        u[0]*vector[1] - u[1]*vector[0] };
+    for (int i = 0; i < 3; ++i)
+        result[i] = (w*w - uu)*vector[i] + 2*uv*u[i] + 2*w*cross[i];
 }
 
 static inline void quaternion_rotation_matrix(const float *quaternion, float *matrix)
 {
-    float x_axis[] = { 1.0, 0.0, 0.0 };
-    float y_axis[] = { 0.0, 1.0, 0.0 };
-    float z_axis[] = { 0.0, 0.0, 1.0 };
-
-    float x_rotated[3];
-    float y_rotated[3];
-    float z_rotated[3];
+    const float w = quaternion[0], x = quaternion[1], y = quaternion[2], z = quaternion[3];
+    const float ww = w*w, xx = x*x, yy = y*y, zz = z*z;
+    const float xy = x*y, xz = x*z, yz = y*z, wx = w*x, wy = w*y, wz = w*z;
 
-    quaternion_rotate_vector(quaternion, x_axis, x_rotated);
-    quaternion_rotate_vector(quaternion, y_axis, y_rotated);
-    quaternion_rotate_vector(quaternion, z_axis, z_rotated);
-
-    matrix[0] = dot_vectors(x_axis, x_rotated);
-    matrix[1] = dot_vectors(y_axis, x_rotated);
-    matrix[2] = dot_vectors(z_axis, x_rotated);
+    matrix[0] = ww + xx - yy - zz;
+    matrix[1] = 2*(xy + wz);
+    matrix[2] = 2*(xz - wy);
     matrix[3] = 0;
 
-    matrix[4] = dot_vectors(x_axis, y_rotated);
-    matrix[5] = dot_vectors(y_axis, y_rotated);
-    matrix[6] = dot_vectors(z_axis, y_rotated);
+    matrix[4] = 2*(xy - wz);
+    matrix[5] = ww - xx + yy - zz;
+    matrix[6] = 2*(yz + wx);
     matrix[7] = 0;
 
-    matrix[8] = dot_vectors(x_axis, z_rotated);
-    matrix[9] = dot_vectors(y_axis, z_rotated);
-    matrix[10] = dot_vectors(z_axis, z_rotated);
+    matrix[8] = 2*(xz + wy);
+    matrix[9] = 2*(yz - wx);
+    matrix[10] = ww - xx - yy + zz;
     matrix[11] = 0;
 
     matrix[12] = 0;
@@ -109,4 +103,102 @@ static inline void quaternion_rotation_matrix(const float *quaternion, float *ma
     matrix[15] = 1;
 }
 
+static inline void slerp_quaternions(const float *a, const float *b, float t, float *r)
+{
+    float cosine = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+    float sign = 1;
+    if (cosine < 0) {
+        // take the shorter way around
+        cosine = -cosine;
+        sign = -1;
+    }
+    float wa = 1 - t;
+    float wb = t;
+    if (cosine < 0.9995f) {
+        const float angle = acosf(cosine);
+        const float inverse_sine = 1 / sinf(angle);
+        wa = sinf((1 - t) * angle) * inverse_sine;
+        wb = sinf(t * angle) * inverse_sine;
+    }
+    wb *= sign;
+    for (int i = 0; i < 4; ++i)
+        r[i] = wa*a[i] + wb*b[i];
+}
+
+static inline void multiply_matrices_batch(const float *a, const float *b, float *r, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i)
+        multiply_matrices(a, b + i*16, r + i*16);
+}
+
+static inline void transform_points(const float *m, const float *points, float *result, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i) {
+        const float *p = points + i*3;
+        float *r = result + i*3;
+        const float x = p[0], y = p[1], z = p[2];
+        for (int j = 0; j < 3; ++j)
+            r[j] = m[j]*x + m[j+4]*y + m[j+8]*z + m[j+12];
+    }
+}
+
+static inline void transform_vectors(const float *m, const float *vectors, float *result, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i) {
+        const float *v = vectors + i*3;
+        float *r = result + i*3;
+        const float x = v[0], y = v[1], z = v[2];
+        for (int j = 0; j < 3; ++j)
+            r[j] = m[j]*x + m[j+4]*y + m[j+8]*z;
+    }
+}
+
+static inline bool invert_matrix(const float *m, float *r)
+{
+    float inverse[16];
+    inverse[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+    inverse[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+    inverse[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+    inverse[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+    inverse[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+    inverse[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+    inverse[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+    inverse[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+    inverse[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+    inverse[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+    inverse[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+    inverse[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+    inverse[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+    inverse[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+    inverse[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+    inverse[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+
+    const float determinant = m[0]*inverse[0] + m[1]*inverse[4] + m[2]*inverse[8] + m[3]*inverse[12];
+    if (determinant == 0)
+        return false;
+    for (int i = 0; i < 16; ++i)
+        r[i] = inverse[i] / determinant;
+    return true;
+}
+
+static inline unsigned short float_to_half(float value)
+{
+    union { float f; unsigned int u; } bits;
+    bits.f = value;
+    unsigned int sign = (bits.u >> 16) & 0x8000;
+    int exponent = int((bits.u >> 23) & 0xff) - 127 + 15;
+    unsigned int mantissa = bits.u & 0x7fffff;
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return sign; // too small, flush to zero
+        mantissa |= 0x800000;
+        unsigned int shift = 14 - exponent;
+        return sign | ((mantissa + (1 << (shift - 1))) >> shift);
+    }
+    if (exponent >= 31)
+        return sign | 0x7c00; // too large, clamp to infinity
+    // round to nearest, a carry into the exponent is still correct
+    return sign | ((exponent << 10) + ((mantissa + 0x1000) >> 13));
+}
+
 #endif // MATHEMATICS_H
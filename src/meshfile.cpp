@@ -0,0 +1,227 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "meshfile.h"
+
+#include <algorithm>
+
+using namespace SceneGraph;
+
+static const char mesh_identifier[8] = { '\xAB', 'S', 'G', 'M', ' ', '1', '\r', '\n' };
+
+enum { BlobAlignment = 16 };
+
+// read and written with memcpy, every field is 4 bytes
+struct FileHeader {
+    char identifier[8];
+    quint32 mode;
+    quint32 index_type;
+    quint32 vertex_count;
+    quint32 index_count;
+    quint32 stride;
+    quint32 attributes[VertexFormat::SemanticCount][4]; // size, type, normalized, offset
+    quint32 bounds_type;
+    float minimum[3];
+    float maximum[3];
+    float center[3];
+    float radius;
+    quint32 vertices_offset;
+    quint32 vertices_size;
+    quint32 indices_offset;
+    quint32 indices_size;
+};
+
+static quint32 align_blob(quint32 offset)
+{
+    return (offset + BlobAlignment - 1) & ~quint32(BlobAlignment - 1);
+}
+
+static bool valid_index_type(GLenum type)
+{
+    return type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_SHORT || type == GL_UNSIGNED_INT;
+}
+
+Mesh *MeshFile::load(const QString &file_name, Node *parent)
+{
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "MeshFile: could not open the file\n");
+        return 0;
+    }
+    uchar *data = file.map(0, file.size());
+    if (!data) {
+        fprintf(stderr, "MeshFile: could not map the file\n");
+        return 0;
+    }
+    // the pages go straight from the mapping into the buffers
+    Mesh *mesh = load(data, file.size(), parent);
+    file.unmap(data);
+    return mesh;
+}
+
+Mesh *MeshFile::load(const uchar *data, size_t size, Node *parent)
+{
+    Contents contents;
+    if (!read(data, size, &contents))
+        return 0;
+
+    Mesh *mesh = new Mesh(static_cast<Mesh*>(0), parent);
+    mesh->m_mode = contents.mode;
+    mesh->m_format = contents.format;
+    mesh->m_index_type = contents.index_type;
+    mesh->m_elementCount = contents.indices_size / VertexFormat::typeSize(contents.index_type);
+    mesh->m_mesh_bounds = contents.bounds;
+    mesh->m_byte_size = contents.vertices_size + contents.indices_size;
+    if (mesh->m_index_type == GL_UNSIGNED_INT && !Rasterizer::hasElementIndexUint())
+        fprintf(stderr, "32 bit indices are not supported by this context\n");
+    mesh->invalidate();
+    mesh->upload(contents.vertices, contents.vertices_size, contents.indices, contents.indices_size);
+    return mesh;
+}
+
+bool MeshFile::read(const uchar *data, size_t size, Contents *contents)
+{
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    fprintf(stderr, "MeshFile: big-endian hosts are not supported\n");
+    return false;
+#endif
+    FileHeader header;
+    if (size < sizeof(header) || memcmp(data, mesh_identifier, sizeof(mesh_identifier)) != 0) {
+        fprintf(stderr, "MeshFile: not a mesh file\n");
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.mode > GL_TRIANGLE_FAN || !valid_index_type(header.index_type)) {
+        fprintf(stderr, "MeshFile: invalid draw mode or index type\n");
+        return false;
+    }
+
+    // the attributes are added in the order they are laid out, which gives back the same offsets
+    int order[VertexFormat::SemanticCount];
+    int attribute_count = 0;
+    for (int semantic = 0; semantic < VertexFormat::SemanticCount; ++semantic) {
+        if (header.attributes[semantic][0] > 0)
+            order[attribute_count++] = semantic;
+    }
+    for (int i = 1; i < attribute_count; ++i) {
+        for (int j = i; j > 0 && header.attributes[order[j]][3] < header.attributes[order[j - 1]][3]; --j)
+            std::swap(order[j], order[j - 1]);
+    }
+    VertexFormat format;
+    for (int i = 0; i < attribute_count; ++i) {
+        const quint32 *attribute = header.attributes[order[i]];
+        if (attribute[0] > 4) {
+            fprintf(stderr, "MeshFile: invalid vertex format\n");
+            return false;
+        }
+        format.add(VertexFormat::Semantic(order[i]), attribute[0], attribute[1], attribute[2] != 0);
+        if (format.offset(VertexFormat::Semantic(order[i])) != attribute[3]) {
+            fprintf(stderr, "MeshFile: invalid vertex format\n");
+            return false;
+        }
+    }
+    if (!format.has(VertexFormat::Position) || GLuint(format.stride()) != header.stride) {
+        fprintf(stderr, "MeshFile: invalid vertex format\n");
+        return false;
+    }
+
+    if (quint64(header.vertex_count) * header.stride != header.vertices_size
+            || quint64(header.index_count) * VertexFormat::typeSize(header.index_type) != header.indices_size
+            || header.vertices_offset < sizeof(header) || header.indices_offset < sizeof(header)
+            || header.vertices_offset > size || header.vertices_size > size - header.vertices_offset
+            || header.indices_offset > size || header.indices_size > size - header.indices_offset) {
+        fprintf(stderr, "MeshFile: truncated or inconsistent file\n");
+        return false;
+    }
+
+    // a stray index would read outside the vertex buffer on the GPU
+    const uchar *indices = data + header.indices_offset;
+    unsigned int largest = 0;
+    for (quint32 i = 0; i < header.index_count; ++i) {
+        unsigned int index;
+        switch (header.index_type) {
+        case GL_UNSIGNED_BYTE: index = indices[i]; break;
+        case GL_UNSIGNED_SHORT: index = qFromLittleEndian<quint16>(indices + i * 2); break;
+        default: index = qFromLittleEndian<quint32>(indices + i * 4); break;
+        }
+        largest = qMax(largest, index);
+    }
+    if (header.index_count > 0 && largest >= header.vertex_count) {
+        fprintf(stderr, "MeshFile: index out of range\n");
+        return false;
+    }
+
+    contents->mode = header.mode;
+    contents->format = format;
+    contents->vertices = data + header.vertices_offset;
+    contents->vertices_size = header.vertices_size;
+    contents->indices = indices;
+    contents->indices_size = header.indices_size;
+    contents->index_type = header.index_type;
+    contents->bounds = Bounds();
+    contents->bounds.type = header.bounds_type <= quint32(Bounds::Infinite) ? Bounds::Type(header.bounds_type) : Bounds::Infinite;
+    memcpy(contents->bounds.minimum, header.minimum, sizeof(header.minimum));
+    memcpy(contents->bounds.maximum, header.maximum, sizeof(header.maximum));
+    memcpy(contents->bounds.center, header.center, sizeof(header.center));
+    contents->bounds.radius = header.radius;
+    return true;
+}
+
+bool MeshFile::save(const QString &file_name, GLenum mode, const VertexFormat &format,
+                    const void *vertices, unsigned int vertices_size,
+                    const void *indices, unsigned int indices_size,
+                    GLenum index_type)
+{
+    const unsigned int stride = format.stride();
+    if (!format.has(VertexFormat::Position) || !valid_index_type(index_type)) {
+        fprintf(stderr, "MeshFile: invalid vertex format or index type\n");
+        return false;
+    }
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.identifier, mesh_identifier, sizeof(mesh_identifier));
+    header.mode = mode;
+    header.index_type = index_type;
+    header.vertex_count = vertices_size / stride;
+    header.index_count = indices_size / VertexFormat::typeSize(index_type);
+    header.stride = stride;
+    for (int semantic = 0; semantic < VertexFormat::SemanticCount; ++semantic) {
+        VertexFormat::Semantic s = VertexFormat::Semantic(semantic);
+        if (!format.has(s))
+            continue;
+        header.attributes[semantic][0] = format.size(s);
+        header.attributes[semantic][1] = format.type(s);
+        header.attributes[semantic][2] = format.normalized(s);
+        header.attributes[semantic][3] = format.offset(s);
+    }
+    const Bounds bounds = Mesh::vertexBounds(format, vertices, header.vertex_count);
+    header.bounds_type = bounds.type;
+    memcpy(header.minimum, bounds.minimum, sizeof(header.minimum));
+    memcpy(header.maximum, bounds.maximum, sizeof(header.maximum));
+    memcpy(header.center, bounds.center, sizeof(header.center));
+    header.radius = bounds.radius;
+    header.vertices_size = header.vertex_count * stride;
+    header.indices_size = header.index_count * VertexFormat::typeSize(index_type);
+    header.vertices_offset = align_blob(sizeof(header));
+    header.indices_offset = align_blob(header.vertices_offset + header.vertices_size);
+
+    QFile file(file_name);
+    if (!file.open(QIODevice::WriteOnly)) {
+        fprintf(stderr, "MeshFile: could not open the file for writing\n");
+        return false;
+    }
+    const char padding[BlobAlignment] = { 0 };
+    bool written = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == qint64(sizeof(header))
+            && file.write(padding, header.vertices_offset - sizeof(header)) >= 0
+            && file.write(static_cast<const char*>(vertices), header.vertices_size) == qint64(header.vertices_size)
+            && file.write(padding, header.indices_offset - header.vertices_offset - header.vertices_size) >= 0
+            && file.write(static_cast<const char*>(indices), header.indices_size) == qint64(header.indices_size);
+    if (!written)
+        fprintf(stderr, "MeshFile: could not write the file\n");
+    return written;
+}
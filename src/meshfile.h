@@ -0,0 +1,59 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+#include <QtCore>
+
+#include "scenegraph.h"
+
+namespace SceneGraph {
+
+    // A binary container for one Mesh, laid out so that loading it is little
+    // more than mapping the file and handing two ranges to glBufferData:
+    //
+    //   header      identifier, draw mode, vertex format, counts, bounds
+    //   vertices    interleaved, ready for GL_ARRAY_BUFFER
+    //   indices     ready for GL_ELEMENT_ARRAY_BUFFER
+    //
+    // Both blobs start on a 16 byte boundary. The bounds are stored, so the
+    // vertices are never read on the CPU. Everything is little-endian. Files
+    // are written by save() or by the meshconverter tool, which imports OBJ
+    // and runs the optimizations of Mesh::Options offline.
+    class MeshFile
+    {
+    public:
+        struct Contents {
+            GLenum mode;
+            VertexFormat format;
+            const void *vertices;
+            unsigned int vertices_size;
+            const void *indices;
+            unsigned int indices_size;
+            GLenum index_type;
+            Bounds bounds;
+        };
+
+        // 0 on failure, with the reason on stderr
+        static Mesh *load(const QString &file, Node *parent = 0);
+
+        // the same from memory that stays valid during the call
+        static Mesh *load(const uchar *data, size_t size, Node *parent = 0);
+
+        // checks the container and points contents into data, no GL involved
+        static bool read(const uchar *data, size_t size, Contents *contents);
+
+        static bool save(const QString &file, GLenum mode, const VertexFormat &format,
+                         const void *vertices, unsigned int vertices_size,
+                         const void *indices, unsigned int indices_size,
+                         GLenum index_type = GL_UNSIGNED_INT);
+    };
+
+}; // SceneGraph
+
+#endif//MESHFILE_H
@@ -0,0 +1,275 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "meshoptimizer.h"
+#include "mathematics.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace SceneGraph;
+
+static const unsigned int no_vertex = ~0u;
+
+struct Cluster
+{
+    unsigned int begin;
+    unsigned int end;
+    float sort_key;
+
+    bool operator<(const Cluster &other) const { return sort_key > other.sort_key; }
+};
+
+void MeshOptimizer::optimizeVertexCache(unsigned int *indices, unsigned int index_count,
+                                        unsigned int vertex_count, unsigned int cache_size,
+                                        std::vector<unsigned int> *clusters)
+{
+    const unsigned int triangle_count = index_count / 3;
+    if (triangle_count == 0 || vertex_count == 0)
+        return;
+
+    // the triangles using each vertex, and how many of them are not emitted yet
+    std::vector<unsigned int> live(vertex_count, 0);
+    for (unsigned int i = 0; i < triangle_count * 3; ++i)
+        ++live[indices[i]];
+    std::vector<unsigned int> offsets(vertex_count + 1, 0);
+    for (unsigned int v = 0; v < vertex_count; ++v)
+        offsets[v + 1] = offsets[v] + live[v];
+    std::vector<unsigned int> adjacency(triangle_count * 3);
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (unsigned int t = 0; t < triangle_count; ++t) {
+        for (int k = 0; k < 3; ++k)
+            adjacency[fill[indices[t * 3 + k]]++] = t;
+    }
+
+    std::vector<unsigned int> stamps(vertex_count, 0);
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<unsigned int> dead_ends;
+    std::vector<unsigned int> candidates;
+    std::vector<unsigned int> result;
+    result.reserve(triangle_count * 3);
+    unsigned int time = cache_size + 1;
+    unsigned int cursor = 0;
+
+    while (cursor < vertex_count && live[cursor] == 0)
+        ++cursor;
+    unsigned int fanning = cursor < vertex_count ? cursor : no_vertex;
+    if (clusters)
+        clusters->push_back(0);
+
+    while (fanning != no_vertex) {
+        // emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; ++a) {
+            const unsigned int t = adjacency[a];
+            if (emitted[t])
+                continue;
+            for (int k = 0; k < 3; ++k) {
+                const unsigned int v = indices[t * 3 + k];
+                result.push_back(v);
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - stamps[v] > cache_size)
+                    stamps[v] = time++;
+            }
+            emitted[t] = true;
+        }
+
+        // continue with the oldest vertex that will still be in the cache
+        // after its remaining triangles are emitted
+        unsigned int next = no_vertex;
+        int best = -1;
+        for (size_t c = 0; c < candidates.size(); ++c) {
+            const unsigned int v = candidates[c];
+            if (live[v] == 0)
+                continue;
+            int priority = 0;
+            if (time - stamps[v] + 2 * live[v] <= cache_size)
+                priority = time - stamps[v];
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+
+        // dead end; go back to a recently used vertex, or the next one in order
+        if (next == no_vertex) {
+            while (!dead_ends.empty() && next == no_vertex) {
+                const unsigned int v = dead_ends.back();
+                dead_ends.pop_back();
+                if (live[v] > 0)
+                    next = v;
+            }
+            while (next == no_vertex && cursor < vertex_count) {
+                if (live[cursor] > 0)
+                    next = cursor;
+                else
+                    ++cursor;
+            }
+            if (next != no_vertex && clusters)
+                clusters->push_back(result.size() / 3);
+        }
+        fanning = next;
+    }
+
+    memcpy(indices, &result[0], result.size() * sizeof(unsigned int));
+}
+
+void MeshOptimizer::optimizeOverdraw(unsigned int *indices, unsigned int index_count,
+                                     const float *positions, unsigned int position_stride,
+                                     unsigned int vertex_count,
+                                     const std::vector<unsigned int> &clusters,
+                                     unsigned int cache_size, float threshold)
+{
+    const unsigned int triangle_count = index_count / 3;
+    if (triangle_count == 0 || vertex_count == 0)
+        return;
+
+    // split the clusters wherever the part so far is already as cheap as the
+    // whole mesh; every cluster is measured starting from a cold cache
+    const float limit = acmr(indices, triangle_count * 3, cache_size) * threshold;
+    std::vector<unsigned int> stamps(vertex_count, 0);
+    std::vector<Cluster> sorted;
+    unsigned int time = cache_size + 1;
+    unsigned int misses = 0;
+    size_t hard = 0;
+    for (unsigned int t = 0; t < triangle_count; ++t) {
+        bool boundary = t == 0;
+        for (; hard < clusters.size() && clusters[hard] <= t; ++hard)
+            boundary = boundary || clusters[hard] == t;
+        if (!sorted.empty() && t > sorted.back().begin && float(misses) <= limit * (t - sorted.back().begin))
+            boundary = true;
+        if (boundary) {
+            if (!sorted.empty())
+                sorted.back().end = t;
+            Cluster cluster = { t, triangle_count, 0 };
+            sorted.push_back(cluster);
+            time += cache_size + 1;
+            misses = 0;
+        }
+        for (int k = 0; k < 3; ++k) {
+            const unsigned int v = indices[t * 3 + k];
+            if (time - stamps[v] > cache_size) {
+                stamps[v] = time++;
+                ++misses;
+            }
+        }
+    }
+
+    // area weighted centroid and normal of every cluster
+    std::vector<float> centroids(sorted.size() * 3, 0);
+    std::vector<float> normals(sorted.size() * 3, 0);
+    float mesh_centroid[3] = { 0, 0, 0 };
+    float mesh_area = 0;
+    for (size_t c = 0; c < sorted.size(); ++c) {
+        float *centroid = &centroids[c * 3];
+        float *normal = &normals[c * 3];
+        float cluster_area = 0;
+        for (unsigned int t = sorted[c].begin; t < sorted[c].end; ++t) {
+            const float *p0 = positions + indices[t * 3 + 0] * position_stride;
+            const float *p1 = positions + indices[t * 3 + 1] * position_stride;
+            const float *p2 = positions + indices[t * 3 + 2] * position_stride;
+            const float ab[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            const float ac[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            const float n[3] = { ab[1] * ac[2] - ab[2] * ac[1],
+                                 ab[2] * ac[0] - ab[0] * ac[2],
+                                 ab[0] * ac[1] - ab[1] * ac[0] };
+            const float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int j = 0; j < 3; ++j) {
+                centroid[j] += (p0[j] + p1[j] + p2[j]) / 3 * area;
+                normal[j] += n[j];
+            }
+            cluster_area += area;
+        }
+        for (int j = 0; j < 3; ++j)
+            mesh_centroid[j] += centroid[j];
+        mesh_area += cluster_area;
+        if (cluster_area > 0) {
+            for (int j = 0; j < 3; ++j)
+                centroid[j] /= cluster_area;
+        }
+    }
+    if (mesh_area > 0) {
+        for (int j = 0; j < 3; ++j)
+            mesh_centroid[j] /= mesh_area;
+    }
+
+    // clusters facing away from the center are likely to occlude the others
+    for (size_t c = 0; c < sorted.size(); ++c) {
+        const float *centroid = &centroids[c * 3];
+        const float *normal = &normals[c * 3];
+        const float length = sqrtf(dot_vectors(normal, normal));
+        const float offset[3] = { centroid[0] - mesh_centroid[0],
+                                  centroid[1] - mesh_centroid[1],
+                                  centroid[2] - mesh_centroid[2] };
+        sorted[c].sort_key = length > 0 ? dot_vectors(offset, normal) / length : 0;
+    }
+    std::stable_sort(sorted.begin(), sorted.end());
+
+    std::vector<unsigned int> result;
+    result.reserve(triangle_count * 3);
+    for (size_t c = 0; c < sorted.size(); ++c)
+        result.insert(result.end(), indices + sorted[c].begin * 3, indices + sorted[c].end * 3);
+    memcpy(indices, &result[0], result.size() * sizeof(unsigned int));
+}
+
+unsigned int MeshOptimizer::optimizeVertexFetch(void *vertices, unsigned int vertex_count, unsigned int stride,
+                                                unsigned int *indices, unsigned int index_count)
+{
+    std::vector<unsigned int> remap(vertex_count, no_vertex);
+    unsigned int next = 0;
+    for (unsigned int i = 0; i < index_count; ++i) {
+        unsigned int &index = indices[i];
+        if (remap[index] == no_vertex)
+            remap[index] = next++;
+        index = remap[index];
+    }
+
+    char *destination = static_cast<char*>(vertices);
+    const std::vector<char> source(destination, destination + vertex_count * stride);
+    for (unsigned int v = 0; v < vertex_count; ++v) {
+        if (remap[v] != no_vertex)
+            memcpy(destination + remap[v] * stride, &source[v * stride], stride);
+    }
+    return next;
+}
+
+float MeshOptimizer::acmr(const unsigned int *indices, unsigned int index_count, unsigned int cache_size)
+{
+    const unsigned int triangle_count = index_count / 3;
+    if (triangle_count == 0)
+        return 0;
+    return float(cacheMisses(indices, triangle_count * 3, cache_size)) / triangle_count;
+}
+
+float MeshOptimizer::atvr(const unsigned int *indices, unsigned int index_count, unsigned int vertex_count,
+                          unsigned int cache_size)
+{
+    if (vertex_count == 0)
+        return 0;
+    return float(cacheMisses(indices, index_count / 3 * 3, cache_size)) / vertex_count;
+}
+
+unsigned int MeshOptimizer::cacheMisses(const unsigned int *indices, unsigned int index_count,
+                                        unsigned int cache_size)
+{
+    // a fifo cache, like most post-transform caches
+    unsigned int vertex_count = 0;
+    for (unsigned int i = 0; i < index_count; ++i)
+        vertex_count = std::max(vertex_count, indices[i] + 1);
+    std::vector<unsigned int> stamps(vertex_count, 0);
+    unsigned int time = cache_size + 1;
+    unsigned int misses = 0;
+    for (unsigned int i = 0; i < index_count; ++i) {
+        const unsigned int v = indices[i];
+        if (time - stamps[v] > cache_size) {
+            stamps[v] = time++;
+            ++misses;
+        }
+    }
+    return misses;
+}
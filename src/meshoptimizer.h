@@ -0,0 +1,62 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <vector>
+
+namespace SceneGraph {
+
+    // CPU side passes over indexed triangle lists, run once at import time.
+    // The passes are meant to be run in order: vertex cache, overdraw, then
+    // vertex fetch. None of them need a GL context, and all of them expect
+    // every index to be smaller than the vertex count.
+    class MeshOptimizer
+    {
+    public:
+        enum { DefaultCacheSize = 16 };
+
+        // reorders the triangles for the post-transform vertex cache (Tipsify);
+        // the first triangle of every cluster that starts on a dead end is
+        // appended to clusters, if given
+        static void optimizeVertexCache(unsigned int *indices, unsigned int index_count,
+                                        unsigned int vertex_count,
+                                        unsigned int cache_size = DefaultCacheSize,
+                                        std::vector<unsigned int> *clusters = 0);
+
+        // splits the clusters further where the cache is still warm and sorts
+        // them so that the outward facing ones are drawn first; the position
+        // stride is in floats
+        static void optimizeOverdraw(unsigned int *indices, unsigned int index_count,
+                                     const float *positions, unsigned int position_stride,
+                                     unsigned int vertex_count,
+                                     const std::vector<unsigned int> &clusters,
+                                     unsigned int cache_size = DefaultCacheSize,
+                                     float threshold = 1.05f);
+
+        // renumbers the vertices in the order they are first used and moves
+        // them accordingly; unused vertices are dropped and the new vertex
+        // count is returned
+        static unsigned int optimizeVertexFetch(void *vertices, unsigned int vertex_count, unsigned int stride,
+                                                unsigned int *indices, unsigned int index_count);
+
+        // average cache miss ratio, transformed vertices per triangle
+        static float acmr(const unsigned int *indices, unsigned int index_count,
+                          unsigned int cache_size = DefaultCacheSize);
+        // average transform to vertex ratio, transformed vertices per vertex
+        static float atvr(const unsigned int *indices, unsigned int index_count, unsigned int vertex_count,
+                          unsigned int cache_size = DefaultCacheSize);
+
+    private:
+        static unsigned int cacheMisses(const unsigned int *indices, unsigned int index_count,
+                                        unsigned int cache_size);
+    };
+
+}; // SceneGraph
+
+#endif//MESHOPTIMIZER_H
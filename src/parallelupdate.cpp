@@ -0,0 +1,177 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "parallelupdate.h"
+#include "transformsystem.h"
+
+using namespace SceneGraph;
+
+static QAtomicInt frames(0);
+
+ParallelUpdate *ParallelUpdate::s_running = 0;
+
+ParallelUpdate::ParallelUpdate(unsigned int threads)
+    : m_pool(threads),
+      m_frame(0)
+{
+    const unsigned int workers = m_pool.workerCount();
+    for (unsigned int i = 0; i < workers; ++i)
+        m_states.push_back(new State);
+    m_jobs.resize(workers);
+    m_invalidated.resize(workers);
+    m_prepared.resize(workers);
+}
+
+ParallelUpdate::~ParallelUpdate()
+{
+    for (size_t i = 0; i < m_states.size(); ++i)
+        delete m_states[i];
+}
+
+unsigned int ParallelUpdate::threadCount() const
+{
+    return m_pool.workerCount();
+}
+
+unsigned int ParallelUpdate::preparedCount() const
+{
+    unsigned int count = 0;
+    for (size_t i = 0; i < m_prepared.size(); ++i)
+        count += m_prepared[i];
+    return count;
+}
+
+void ParallelUpdate::run(Node *root, State *state)
+{
+    if (!root || !state)
+        return;
+    if (s_running) {
+        fprintf(stderr, "ParallelUpdate: only one pass can run at a time\n");
+        return;
+    }
+
+    m_frame = frames.fetchAndAddRelaxed(1) + 1;
+    if (m_frame == 0)
+        m_frame = frames.fetchAndAddRelaxed(1) + 1;
+    for (size_t i = 0; i < m_states.size(); ++i) {
+        m_states[i]->setProjectionMatrix(state->projectionMatrix());
+        m_states[i]->setFrustumCulling(state->frustumCulling());
+        m_jobs[i].clear();
+        m_invalidated[i].clear();
+        m_prepared[i] = 0;
+    }
+
+    // the world matrices that only depend on other transforms, in one linear pass
+    TransformSystem::instance()->update();
+
+    Job *job = createJob(0, state, 0, false);
+    job->node = root;
+    job->count = 1;
+    s_running = this;
+    m_pool.push(job);
+    m_pool.run();
+    s_running = 0;
+
+    // the bounds of the ancestors are shared between jobs
+    for (size_t i = 0; i < m_invalidated.size(); ++i) {
+        for (size_t j = 0; j < m_invalidated[i].size(); ++j)
+            m_invalidated[i][j]->invalidate();
+    }
+    state->m_prepared_frame = m_frame;
+}
+
+bool ParallelUpdate::deferInvalidation(Node *node)
+{
+    ParallelUpdate *update = s_running;
+    if (!update)
+        return false;
+    const int worker = update->m_pool.currentWorker();
+    if (worker < 0)
+        return false;
+    update->m_invalidated[worker].push_back(node);
+    return true;
+}
+
+ParallelUpdate::Job *ParallelUpdate::createJob(unsigned int worker, State *state, unsigned int depth, bool inside)
+{
+    // a deque keeps the jobs in place while more are added
+    m_jobs[worker].push_back(Job());
+    Job *job = &m_jobs[worker].back();
+    job->update = this;
+    job->node = 0;
+    job->first = 0;
+    job->count = 0;
+    memcpy(job->matrix, state->currentMatrix(), sizeof(job->matrix));
+    job->version = state->matrixVersion();
+    job->depth = depth;
+    job->inside = inside;
+    return job;
+}
+
+void ParallelUpdate::Job::run(ThreadPool *pool, unsigned int worker)
+{
+    State *state = update->m_states[worker];
+    state->loadMatrix(matrix, version);
+    if (node) {
+        update->visit(node, state, inside, depth, worker);
+        return;
+    }
+
+    // hand out the upper half of the range until the rest is small enough
+    while (count > RangeGrain) {
+        const unsigned int half = count / 2;
+        Node *middle = first;
+        for (unsigned int i = half; i < count; ++i)
+            middle = middle->m_next_sibling;
+        Job *job = update->createJob(worker, state, depth, inside);
+        job->first = middle;
+        job->count = half;
+        pool->push(job, worker);
+        count -= half;
+    }
+    Node *child = first;
+    for (unsigned int i = 0; i < count; ++i, child = child->m_next_sibling)
+        update->visit(child, state, inside, depth, worker);
+}
+
+void ParallelUpdate::visit(Node *node, State *state, bool inside, unsigned int depth, unsigned int worker)
+{
+    // State::execute() does the same for the nodes we leave out
+    if (!node->concurrentUpdate())
+        return;
+    const State::Visibility visibility = state->frustumCulling() && !inside ? state->classify(node->bounds())
+                                                                           : State::Inside;
+    node->m_prepared_frame = m_frame;
+    node->m_prepared_visibility = visibility;
+    ++m_prepared[worker];
+    // culled nodes are updated as well, State::execute() only skips drawing them
+    if (!node->enabled(state))
+        return;
+
+    Transformation *transformation = dynamic_cast<Transformation*>(node);
+    if (transformation)
+        state->pushMatrix();
+    node->update(state);
+    if (transformation)
+        transformation->execute(state); // fills the world matrix cache
+
+    if (node->visible(state) && node->m_first_child) {
+        const bool children_inside = visibility == State::Inside;
+        if (depth < SplitDepth && node->m_child_count > 1) {
+            Job *job = createJob(worker, state, depth + 1, children_inside);
+            job->first = node->m_first_child;
+            job->count = node->m_child_count;
+            m_pool.push(job, worker);
+        } else {
+            for (Node *child = node->m_first_child; child; child = child->m_next_sibling)
+                visit(child, state, children_inside, depth + 1, worker);
+        }
+    }
+
+    if (transformation)
+        state->popMatrix();
+}
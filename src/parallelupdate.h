@@ -0,0 +1,83 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef PARALLELUPDATE_H
+#define PARALLELUPDATE_H
+
+#include <deque>
+#include <vector>
+
+#include "scenegraph.h"
+#include "threadpool.h"
+
+namespace SceneGraph {
+
+    // Runs the CPU half of a frame on a ThreadPool, before State::execute()
+    // makes the GL calls on the context thread. The pass calls update(),
+    // computes the world matrices of Transformation nodes and does the
+    // frustum culling; culled subtrees are updated all the same. The tree
+    // is split into jobs by subtree, and every worker walks its part with
+    // a State of its own. The next execute() of the given state then takes
+    // the results instead of doing the work again.
+    //
+    // A node takes part if Node::concurrentUpdate() returns true, which the
+    // built-in node types do and subclasses have to opt in to. Its update(),
+    // enabled() and visible() may then run on any thread. They may only
+    // change the node itself and its own subtree, and must leave the tree
+    // structure alone. invalidate() calls made during the pass are
+    // collected and replayed on the calling thread at the end. A node that
+    // returns false is left, with everything below it, to State::execute().
+    //
+    // The results are only valid for the next State::execute() of the same
+    // state with the same root and matrix, and are dropped when it returns.
+    class ParallelUpdate
+    {
+    public:
+        ParallelUpdate(unsigned int threads = 0); // 0 picks QThread::idealThreadCount()
+        ~ParallelUpdate();
+
+        void run(Node *root, State *state);
+
+        unsigned int threadCount() const;
+        unsigned int preparedCount() const; // nodes handled by the last run
+
+        // called by Node::invalidate(); true if the call was queued for later
+        static bool deferInvalidation(Node *node);
+
+    private:
+        // children get jobs of their own down to this depth, in ranges of at most RangeGrain siblings
+        enum { SplitDepth = 4, RangeGrain = 8 };
+
+        struct Job : public ThreadPool::Job {
+            ParallelUpdate *update;
+            Node *node; // a single node, or else a range of siblings
+            Node *first;
+            unsigned int count;
+            float matrix[16];
+            unsigned int version;
+            unsigned int depth;
+            bool inside;
+
+            void run(ThreadPool *pool, unsigned int worker);
+        };
+
+        Job *createJob(unsigned int worker, State *state, unsigned int depth, bool inside);
+        void visit(Node *node, State *state, bool inside, unsigned int depth, unsigned int worker);
+
+        ThreadPool m_pool;
+        std::vector<State*> m_states;
+        std::vector<std::deque<Job> > m_jobs;
+        std::vector<std::vector<Node*> > m_invalidated;
+        std::vector<unsigned int> m_prepared;
+        unsigned int m_frame;
+
+        static ParallelUpdate *s_running;
+    };
+
+}; // SceneGraph
+
+#endif//PARALLELUPDATE_H
@@ -0,0 +1,378 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "programcache.h"
+#include "resourcemanager.h"
+#include "scenegraph.h"
+
+using namespace SceneGraph;
+
+static const char binary_identifier[8] = { '\xAB', 'S', 'G', 'P', ' ', '1', '\r', '\n' };
+
+// read and written with memcpy
+struct BinaryHeader {
+    char identifier[8];
+    quint64 driver;
+    quint64 key;
+    quint32 vertex_length;
+    quint32 fragment_length;
+    quint32 format;
+    quint32 length;
+};
+
+// FNV-1a, including the terminator so "ab" + "c" and "a" + "bc" differ
+static quint64 hash_string(quint64 hash, const char *string)
+{
+    if (string) {
+        for (; *string; ++string)
+            hash = (hash ^ uchar(*string)) * 0x100000001b3ull;
+    }
+    return (hash ^ 0xff) * 0x100000001b3ull;
+}
+
+static const quint64 hash_seed = 0xcbf29ce484222325ull;
+
+ProgramCache *ProgramCache::instance()
+{
+    static ProgramCache cache;
+    return &cache;
+}
+
+ProgramCache::ProgramCache()
+    : m_shared(0),
+      m_loaded(0),
+      m_compiled(0),
+      m_compile_time(0),
+      m_load_time(0)
+{
+}
+
+void ProgramCache::setDiskCacheDirectory(const QString &directory)
+{
+    m_directory = directory;
+    if (!m_directory.isEmpty() && !QDir().mkpath(m_directory))
+        fprintf(stderr, "ProgramCache: could not create the disk cache directory\n");
+}
+
+QString ProgramCache::diskCacheDirectory() const
+{
+    return m_directory;
+}
+
+GLuint ProgramCache::acquire(const char *vertex_source, const char *fragment_source)
+{
+    const GLuint program = submit(vertex_source, fragment_source);
+    std::map<quint64, Entry>::iterator found = m_entries.find(m_keys[program]);
+    if (found->second.status == Pending)
+        finish(found->first, &found->second);
+    if (found->second.status == Failed) {
+        release(program);
+        return 0;
+    }
+    return program;
+}
+
+GLuint ProgramCache::submit(const char *vertex_source, const char *fragment_source)
+{
+    // the bindings of the instance matrix depend on the context
+    quint64 key = hash_string(hash_string(hash_seed, vertex_source), fragment_source);
+    key = (key ^ (hasInstancing() ? 1 : 0)) * 0x100000001b3ull;
+
+    // a collision moves on to the next key
+    std::map<quint64, Entry>::iterator found;
+    while ((found = m_entries.find(key)) != m_entries.end()) {
+        Entry &entry = found->second;
+        if (entry.vertex_source == (vertex_source ? vertex_source : "")
+                && entry.fragment_source == (fragment_source ? fragment_source : "")) {
+            ++entry.references;
+            ++m_shared;
+            return entry.program;
+        }
+        ++key;
+    }
+
+    Entry entry;
+    entry.program = 0;
+    entry.references = 1;
+    entry.status = Pending;
+    entry.vertex_shader = 0;
+    entry.fragment_shader = 0;
+    entry.polls = 0;
+    entry.retrievable = false;
+    entry.vertex_source = vertex_source ? vertex_source : "";
+    entry.fragment_source = fragment_source ? fragment_source : "";
+
+    const bool disk = !m_directory.isEmpty() && hasProgramBinaries();
+    if (disk) {
+        QElapsedTimer timer;
+        timer.start();
+        entry.program = load(key, entry.vertex_source.size(), entry.fragment_source.size());
+        m_load_time += timer.nsecsElapsed();
+        if (entry.program) {
+            entry.status = Ready;
+            ++m_loaded;
+        }
+    }
+    if (!entry.program) {
+        QElapsedTimer timer;
+        timer.start();
+        compile(&entry, disk);
+        m_compile_time += timer.nsecsElapsed();
+        ++m_compiled;
+    }
+
+    m_keys[entry.program] = key;
+    return m_entries.insert(std::make_pair(key, entry)).first->second.program;
+}
+
+ProgramCache::Status ProgramCache::status(GLuint program)
+{
+    std::map<GLuint, quint64>::iterator key = m_keys.find(program);
+    if (key == m_keys.end())
+        return Failed;
+    Entry &entry = m_entries[key->second];
+    if (entry.status != Pending)
+        return entry.status;
+    if (hasParallelShaderCompile()) {
+        GLint completed = GL_FALSE;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+        if (!completed)
+            return Pending;
+    } else if (entry.polls++ == 0) {
+        return Pending;
+    }
+    finish(key->second, &entry);
+    return entry.status;
+}
+
+void ProgramCache::retain(GLuint program)
+{
+    std::map<GLuint, quint64>::iterator found = m_keys.find(program);
+    if (found != m_keys.end())
+        ++m_entries[found->second].references;
+}
+
+void ProgramCache::release(GLuint program)
+{
+    std::map<GLuint, quint64>::iterator found = m_keys.find(program);
+    if (found == m_keys.end())
+        return;
+    std::map<quint64, Entry>::iterator entry = m_entries.find(found->second);
+    if (--entry->second.references > 0)
+        return;
+    glDeleteShader(entry->second.vertex_shader);
+    glDeleteShader(entry->second.fragment_shader);
+    ResourceManager::instance()->release(ResourceManager::Program, program);
+    m_entries.erase(entry);
+    m_keys.erase(found);
+}
+
+std::vector<unsigned char> *ProgramCache::uniformValues(GLuint program)
+{
+    std::map<GLuint, quint64>::iterator found = m_keys.find(program);
+    return found == m_keys.end() ? 0 : &m_entries[found->second].uniform_values;
+}
+
+unsigned int ProgramCache::programCount() const
+{
+    return m_entries.size();
+}
+
+unsigned int ProgramCache::sharedCount() const
+{
+    return m_shared;
+}
+
+unsigned int ProgramCache::loadedCount() const
+{
+    return m_loaded;
+}
+
+unsigned int ProgramCache::compiledCount() const
+{
+    return m_compiled;
+}
+
+float ProgramCache::compileTime() const
+{
+    return m_compile_time / 1000000.0f;
+}
+
+float ProgramCache::loadTime() const
+{
+    return m_load_time / 1000000.0f;
+}
+
+void ProgramCache::resetMetrics()
+{
+    m_shared = 0;
+    m_loaded = 0;
+    m_compiled = 0;
+    m_compile_time = 0;
+    m_load_time = 0;
+}
+
+static void print_shader_log(GLuint shader, const char *kind)
+{
+    GLint compile_ok = GL_FALSE;
+    Rasterizer::glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_ok);
+    if (compile_ok)
+        return;
+    GLint logLen;
+    Rasterizer::glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLen);
+    if (logLen > 0) {
+        GLchar *log = (GLchar *)malloc(logLen);
+        Rasterizer::glGetShaderInfoLog(shader, logLen, &logLen, log);
+        fprintf(stderr, "%s shader info log: %s\n", kind, log);
+        free(log);
+    }
+}
+
+static void print_program_log(GLuint program, const char *kind)
+{
+    GLint logLen;
+    Rasterizer::glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLen);
+    if (logLen > 0) {
+        GLchar *log = (GLchar *)malloc(logLen);
+        Rasterizer::glGetProgramInfoLog(program, logLen, &logLen, log);
+        fprintf(stderr, "Shader program %s log: %s\n", kind, log);
+        free(log);
+    }
+}
+
+void ProgramCache::compile(Entry *entry, bool retrievable)
+{
+    // no status is read here, so a driver that compiles in the background is never waited on
+    const char *vertex_source = entry->vertex_source.c_str();
+    const char *fragment_source = entry->fragment_source.c_str();
+    entry->vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(entry->vertex_shader, 1, &vertex_source, 0);
+    glCompileShader(entry->vertex_shader);
+    entry->fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(entry->fragment_shader, 1, &fragment_source, 0);
+    glCompileShader(entry->fragment_shader);
+
+    entry->program = glCreateProgram();
+    ResourceManager::instance()->adopt(ResourceManager::Program, entry->program);
+    glAttachShader(entry->program, entry->vertex_shader);
+    glAttachShader(entry->program, entry->fragment_shader);
+    Shader::bindAttributeLocations(entry->program);
+    entry->retrievable = retrievable;
+    if (retrievable)
+        glProgramParameteri(entry->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(entry->program);
+}
+
+void ProgramCache::finish(quint64 key, Entry *entry)
+{
+    QElapsedTimer timer;
+    timer.start();
+    GLint link_ok = GL_FALSE;
+    glGetProgramiv(entry->program, GL_LINK_STATUS, &link_ok);
+    if (!link_ok) {
+        print_shader_log(entry->vertex_shader, "Vertex");
+        print_shader_log(entry->fragment_shader, "Fragment");
+        print_program_log(entry->program, "info");
+    }
+#ifndef QT_NO_DEBUG
+    if (link_ok) {
+        // against the current state, so a failure may only be a warning
+        GLint validate_ok = GL_FALSE;
+        glValidateProgram(entry->program);
+        glGetProgramiv(entry->program, GL_VALIDATE_STATUS, &validate_ok);
+        if (!validate_ok)
+            print_program_log(entry->program, "validation");
+    }
+#endif
+
+    glDeleteShader(entry->vertex_shader);
+    glDeleteShader(entry->fragment_shader);
+    entry->vertex_shader = 0;
+    entry->fragment_shader = 0;
+    // a failed program stays around until it is released, so its name is not reused meanwhile
+    entry->status = link_ok ? Ready : Failed;
+    if (link_ok)
+        Shader::bindUniformBlocks(entry->program);
+    if (link_ok && entry->retrievable)
+        store(key, entry->program, entry->vertex_source.size(), entry->fragment_source.size());
+    m_compile_time += timer.nsecsElapsed();
+}
+
+GLuint ProgramCache::load(quint64 key, quint32 vertex_length, quint32 fragment_length)
+{
+    QFile file(diskCacheFile(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    const qint64 size = file.size();
+    uchar *data = size >= qint64(sizeof(BinaryHeader)) ? file.map(0, size) : 0;
+    if (!data)
+        return 0;
+
+    BinaryHeader header;
+    memcpy(&header, data, sizeof(header));
+    GLuint program = 0;
+    if (memcmp(header.identifier, binary_identifier, sizeof(binary_identifier)) == 0
+            && header.driver == driverHash() && header.key == key
+            && header.vertex_length == vertex_length && header.fragment_length == fragment_length
+            && header.length <= size - sizeof(header)) {
+        GLint link_ok = GL_FALSE;
+        program = glCreateProgram();
+        glProgramBinary(program, header.format, data + sizeof(header), header.length);
+        glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+        // the driver may refuse binaries after an update that kept the version string
+        if (!link_ok) {
+            glDeleteProgram(program);
+            program = 0;
+        } else {
+            ResourceManager::instance()->adopt(ResourceManager::Program, program);
+            Shader::bindUniformBlocks(program);
+        }
+    }
+    file.unmap(data);
+    return program;
+}
+
+void ProgramCache::store(quint64 key, GLuint program, quint32 vertex_length, quint32 fragment_length)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.identifier, binary_identifier, sizeof(binary_identifier));
+    header.driver = driverHash();
+    header.key = key;
+    header.vertex_length = vertex_length;
+    header.fragment_length = fragment_length;
+    header.format = format;
+    header.length = length;
+
+    QFile file(diskCacheFile(key));
+    if (!file.open(QIODevice::WriteOnly)
+            || file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != qint64(sizeof(header))
+            || file.write(&binary[0], length) != length)
+        fprintf(stderr, "ProgramCache: could not write to the disk cache\n");
+}
+
+QString ProgramCache::diskCacheFile(quint64 key) const
+{
+    return m_directory + QLatin1Char('/') + QString::number(key, 16) + QLatin1String(".bin");
+}
+
+quint64 ProgramCache::driverHash()
+{
+    quint64 hash = hash_seed;
+    hash = hash_string(hash, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+    hash = hash_string(hash, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    hash = hash_string(hash, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+    return hash;
+}
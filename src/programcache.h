@@ -0,0 +1,108 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <QtCore>
+
+#include "rasterizer.h"
+
+namespace SceneGraph {
+
+    // Owns every linked program in the process. Shaders built from the same
+    // sources share one program, which is deleted when the last of them
+    // goes. The key is a hash of the sources, which already contain any
+    // defines, plus the attribute bindings the context needs.
+    //
+    // With a disk cache directory set and a context that has program
+    // binaries, every program linked from source is also written to disk,
+    // and later runs load it from there instead of compiling. A file is
+    // tagged with the vendor, renderer and version strings of the driver; a
+    // file from another driver, or one the driver refuses, is compiled from
+    // source again and replaced.
+    //
+    // submit() only issues the compile and link; status() looks at the
+    // result later and never waits on contexts with parallel shader compile
+    // (KHR_parallel_shader_compile). Elsewhere the first status() of a
+    // program reports it as pending, which gives the driver a frame before
+    // the second one reads the link status.
+    //
+    // compileTime() and loadTime() add up the time the calling thread spent
+    // on programs: a cold start only compiles, a warm one only loads.
+    class ProgramCache : protected Rasterizer
+    {
+        friend class Shader;
+    public:
+        enum Status { Failed, Pending, Ready };
+
+        static ProgramCache *instance();
+
+        // empty to keep programs in memory only, which is the default
+        void setDiskCacheDirectory(const QString &directory);
+        QString diskCacheDirectory() const;
+
+        // a reference to the program for the sources; 0 if it does not build
+        GLuint acquire(const char *vertex_source, const char *fragment_source);
+        // the same without waiting for the link, see status()
+        GLuint submit(const char *vertex_source, const char *fragment_source);
+        Status status(GLuint program);
+        void retain(GLuint program);
+        void release(GLuint program);
+
+        unsigned int programCount() const;
+
+        // metrics
+        unsigned int sharedCount() const;  // acquires served by a program that was already linked
+        unsigned int loadedCount() const;  // programs loaded from the disk cache
+        unsigned int compiledCount() const; // programs compiled from source
+        float compileTime() const;         // in milliseconds, since the last reset
+        float loadTime() const;
+        void resetMetrics();
+
+    private:
+        struct Entry {
+            GLuint program;
+            unsigned int references;
+            Status status;
+            GLuint vertex_shader; // until the link is finished
+            GLuint fragment_shader;
+            unsigned int polls;
+            bool retrievable;
+            std::string vertex_source;
+            std::string fragment_source;
+            std::vector<unsigned char> uniform_values; // the last ones given to the program, laid out by Shader
+        };
+
+        ProgramCache();
+
+        std::vector<unsigned char> *uniformValues(GLuint program);
+
+        void compile(Entry *entry, bool retrievable);
+        void finish(quint64 key, Entry *entry);
+        GLuint load(quint64 key, quint32 vertex_length, quint32 fragment_length);
+        void store(quint64 key, GLuint program, quint32 vertex_length, quint32 fragment_length);
+        QString diskCacheFile(quint64 key) const;
+        quint64 driverHash();
+
+        QString m_directory;
+        std::map<quint64, Entry> m_entries;
+        std::map<GLuint, quint64> m_keys;
+        unsigned int m_shared;
+        unsigned int m_loaded;
+        unsigned int m_compiled;
+        qint64 m_compile_time;
+        qint64 m_load_time;
+    };
+
+}; // SceneGraph
+
+#endif//PROGRAMCACHE_H
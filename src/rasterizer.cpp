@@ -9,4 +9,166 @@
 
 #if !RAW_RASTERIZER
 QOpenGLFunctions *Rasterizer::m_current = 0;
+QOpenGLExtraFunctions *Rasterizer::m_extra = 0;
 #endif
+
+GLenum Rasterizer::m_half_float_type = 0;
+bool Rasterizer::m_element_index_uint = true;
+bool Rasterizer::m_instancing = false;
+unsigned int Rasterizer::m_compressed_formats = 0;
+bool Rasterizer::m_program_binaries = false;
+bool Rasterizer::m_parallel_shader_compile = false;
+bool Rasterizer::m_uniform_buffers = false;
+
+Rasterizer::ShadowState Rasterizer::m_state;
+unsigned int Rasterizer::m_issued_calls = 0;
+unsigned int Rasterizer::m_skipped_calls = 0;
+unsigned int Rasterizer::m_uniform_bytes = 0;
+
+void Rasterizer::makeCurrent(QOpenGLFunctions *functions)
+{
+    m_current = functions;
+    m_extra = 0;
+    m_half_float_type = 0;
+    m_element_index_uint = true;
+    m_instancing = false;
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (context && context->format().majorVersion() >= 3) {
+        m_extra = context->extraFunctions();
+        m_half_float_type = GL_HALF_FLOAT;
+        // attribute divisors are core in OpenGL ES 3.0 and OpenGL 3.3
+        m_instancing = context->isOpenGLES() || context->format().majorVersion() > 3
+                || context->format().minorVersion() >= 3;
+    } else if (context && context->isOpenGLES()) {
+        if (context->hasExtension(QByteArrayLiteral("GL_OES_vertex_half_float")))
+            m_half_float_type = GL_HALF_FLOAT_OES;
+        m_element_index_uint = context->hasExtension(QByteArrayLiteral("GL_OES_element_index_uint"));
+    }
+
+    m_compressed_formats = 0;
+    if (context) {
+        if (context->hasExtension(QByteArrayLiteral("GL_OES_compressed_ETC1_RGB8_texture")))
+            m_compressed_formats |= ETC1Formats;
+        // ETC2 is core in OpenGL ES 3.0 and OpenGL 4.3
+        if ((context->isOpenGLES() && context->format().majorVersion() >= 3)
+                || context->hasExtension(QByteArrayLiteral("GL_ARB_ES3_compatibility")))
+            m_compressed_formats |= ETC2Formats;
+        if (context->hasExtension(QByteArrayLiteral("GL_EXT_texture_compression_s3tc")))
+            m_compressed_formats |= S3TCFormats;
+        if (context->hasExtension(QByteArrayLiteral("GL_KHR_texture_compression_astc_ldr")))
+            m_compressed_formats |= ASTCFormats;
+    }
+
+    // core in OpenGL ES 3.0 and OpenGL 4.1, but a driver may offer no formats at all
+    m_program_binaries = false;
+    if (m_extra) {
+        GLint formats = 0;
+        functions->glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        m_program_binaries = formats > 0;
+    }
+    // the driver picks the number of compiler threads unless told otherwise
+    m_parallel_shader_compile = context
+            && (context->hasExtension(QByteArrayLiteral("GL_KHR_parallel_shader_compile"))
+                || context->hasExtension(QByteArrayLiteral("GL_ARB_parallel_shader_compile")));
+    // core in OpenGL ES 3.0 and OpenGL 3.1
+    m_uniform_buffers = m_extra
+            && (context->isOpenGLES() || context->format().majorVersion() > 3
+                || context->format().minorVersion() >= 1
+                || context->hasExtension(QByteArrayLiteral("GL_ARB_uniform_buffer_object")));
+    resetState();
+}
+
+bool Rasterizer::hasCompressedFormat(GLenum internal_format)
+{
+    unsigned int family = 0;
+    if (internal_format == GL_ETC1_RGB8_OES)
+        family = ETC1Formats;
+    else if (internal_format >= GL_COMPRESSED_R11_EAC && internal_format <= GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC)
+        family = ETC2Formats;
+    else if (internal_format >= GL_COMPRESSED_RGB_S3TC_DXT1_EXT && internal_format <= GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+        family = S3TCFormats;
+    else if ((internal_format >= GL_COMPRESSED_RGBA_ASTC_4x4_KHR && internal_format <= GL_COMPRESSED_RGBA_ASTC_4x4_KHR + 13)
+             || (internal_format >= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR && internal_format <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR + 13))
+        family = ASTCFormats;
+    return (m_compressed_formats & family) != 0;
+}
+
+// Anything touched outside of the Rasterizer (i.e. QPainter) leaves the shadow
+// state stale; call resetState() afterwards so the next bind is always issued.
+void Rasterizer::resetState()
+{
+    m_state.program = Unknown;
+    m_state.active_texture = Unknown;
+    for (int i = 0; i < MaxTextureUnits; ++i)
+        m_state.textures[i] = Unknown;
+    m_state.array_buffer = Unknown;
+    m_state.element_array_buffer = Unknown;
+    m_state.vertex_array = Unknown;
+    m_state.attribs_known = 0;
+    m_state.attribs_enabled = 0;
+    m_state.blend = Unknown;
+    m_state.blend_src = Unknown;
+    m_state.blend_dst = Unknown;
+}
+
+void Rasterizer::glGetIntegerv(GLenum pname, GLint *params)
+{
+    GLuint *cached = 0;
+    switch (pname) {
+    case GL_CURRENT_PROGRAM: cached = &m_state.program; break;
+    case GL_ACTIVE_TEXTURE: cached = &m_state.active_texture; break;
+    case GL_TEXTURE_BINDING_2D: cached = textureBinding(GL_TEXTURE_2D); break;
+    case GL_ARRAY_BUFFER_BINDING: cached = &m_state.array_buffer; break;
+    case GL_ELEMENT_ARRAY_BUFFER_BINDING: cached = &m_state.element_array_buffer; break;
+    case GL_BLEND: cached = &m_state.blend; break;
+    case GL_BLEND_SRC_RGB: cached = &m_state.blend_src; break;
+    case GL_BLEND_DST_RGB: cached = &m_state.blend_dst; break;
+    default: break;
+    }
+    if (cached && *cached != Unknown) {
+        ++m_skipped_calls;
+        *params = *cached;
+        return;
+    }
+    ++m_issued_calls;
+    m_current->glGetIntegerv(pname, params);
+    if (cached)
+        *cached = *params;
+}
+
+void Rasterizer::glDeleteTextures(GLsizei n, const GLuint *textures)
+{
+    // deleted textures are implicitly unbound from every unit
+    for (GLsizei i = 0; i < n; ++i) {
+        for (int unit = 0; unit < MaxTextureUnits; ++unit) {
+            if (m_state.textures[unit] == textures[i])
+                m_state.textures[unit] = 0;
+        }
+    }
+    m_current->glDeleteTextures(n, textures);
+}
+
+void Rasterizer::glDeleteBuffers(GLsizei n, const GLuint *buffers)
+{
+    // deleted buffers are implicitly unbound
+    for (GLsizei i = 0; i < n; ++i) {
+        if (m_state.array_buffer == buffers[i])
+            m_state.array_buffer = 0;
+        if (m_state.element_array_buffer == buffers[i])
+            m_state.element_array_buffer = 0;
+    }
+    m_current->glDeleteBuffers(n, buffers);
+}
+
+void Rasterizer::glDeleteVertexArrays(GLsizei n, const GLuint *arrays)
+{
+    // deleting the bound vertex array reverts to the default one
+    for (GLsizei i = 0; i < n; ++i) {
+        if (m_state.vertex_array == arrays[i]) {
+            m_state.vertex_array = 0;
+            m_state.element_array_buffer = Unknown;
+            m_state.attribs_known = 0;
+        }
+    }
+    m_extra->glDeleteVertexArrays(n, arrays);
+}
@@ -10,10 +10,230 @@
 
 #include <QtOpenGL>
 
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B
+#endif
+#ifndef GL_HALF_FLOAT_OES
+#define GL_HALF_FLOAT_OES 0x8D61
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_BUFFER_BIT
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#endif
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+#ifndef GL_UNIFORM_BUFFER
+#define GL_UNIFORM_BUFFER 0x8A11
+#endif
+#ifndef GL_INVALID_INDEX
+#define GL_INVALID_INDEX 0xFFFFFFFFu
+#endif
+
+// compressed texture formats, see Rasterizer::hasCompressedFormat()
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+#ifndef GL_COMPRESSED_R11_EAC
+#define GL_COMPRESSED_R11_EAC 0x9270
+#define GL_COMPRESSED_SIGNED_R11_EAC 0x9271
+#define GL_COMPRESSED_RG11_EAC 0x9272
+#define GL_COMPRESSED_SIGNED_RG11_EAC 0x9273
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#define GL_COMPRESSED_SRGB8_ETC2 0x9275
+#define GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2 0x9276
+#define GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2 0x9277
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC 0x9279
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+#define GL_COMPRESSED_RGBA_ASTC_4x4_KHR 0x93B0  // up to 12x12 at 0x93BD
+#define GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR 0x93D0 // up to 12x12 at 0x93DD
+#endif
+
 class Rasterizer
 {
 public:
-    static inline void makeCurrent(QOpenGLFunctions *functions) { m_current = functions; } // FIXME
+    static void makeCurrent(QOpenGLFunctions *functions); // FIXME
+
+    // optional features, available on OpenGL 3.x / OpenGL ES 3.0 contexts
+    static inline bool hasVertexArrayObjects() { return m_extra != 0; }
+    static inline GLenum halfFloatType() { return m_half_float_type; } // 0 if half float vertices are unsupported
+    static inline bool hasElementIndexUint() { return m_element_index_uint; }
+    static inline bool hasInstancing() { return m_instancing; } // instanced draws and attribute divisors
+    static inline bool hasPixelBufferObjects() { return m_extra != 0; } // and glMapBufferRange
+    static bool hasCompressedFormat(GLenum internal_format);
+    static inline bool hasProgramBinaries() { return m_program_binaries; } // glGetProgramBinary and glProgramBinary
+    static inline bool hasParallelShaderCompile() { return m_parallel_shader_compile; } // GL_COMPLETION_STATUS_KHR
+    static inline bool hasUniformBuffers() { return m_uniform_buffers; }
+
+    // shadow state
+    static void resetState();
+    static inline unsigned int issuedCalls() { return m_issued_calls; }
+    static inline unsigned int skippedCalls() { return m_skipped_calls; }
+    static inline unsigned int uniformBytes() { return m_uniform_bytes; } // given to glUniform* and uniform buffers
+    static inline void resetCallCounters() { m_issued_calls = 0; m_skipped_calls = 0; m_uniform_bytes = 0; }
+
+    // cached state
+    static void glGetIntegerv(GLenum pname, GLint *params);
+    static void glDeleteTextures(GLsizei n, const GLuint *textures);
+    static void glDeleteBuffers(GLsizei n, const GLuint *buffers);
+    static void glDeleteVertexArrays(GLsizei n, const GLuint *arrays);
+
+    static inline void glBindVertexArray(GLuint array)
+    {
+        if (m_state.vertex_array == array) {
+            ++m_skipped_calls;
+            return;
+        }
+        ++m_issued_calls;
+        m_state.vertex_array = array;
+        // the element buffer and the enabled arrays belong to the vertex array
+        m_state.element_array_buffer = Unknown;
+        m_state.attribs_known = 0;
+        m_extra->glBindVertexArray(array);
+    }
+
+    static inline void glUseProgram(GLuint program)
+    {
+        if (m_state.program == program) {
+            ++m_skipped_calls;
+            return;
+        }
+        ++m_issued_calls;
+        m_state.program = program;
+        m_current->glUseProgram(program);
+    }
+
+    static inline void glActiveTexture(GLenum texture)
+    {
+        if (m_state.active_texture == texture) {
+            ++m_skipped_calls;
+            return;
+        }
+        ++m_issued_calls;
+        m_state.active_texture = texture;
+        m_current->glActiveTexture(texture);
+    }
+
+    static inline void glBindTexture(GLenum target, GLuint texture)
+    {
+        GLuint *binding = textureBinding(target);
+        if (binding && *binding == texture) {
+            ++m_skipped_calls;
+            return;
+        }
+        ++m_issued_calls;
+        if (binding)
+            *binding = texture;
+        m_current->glBindTexture(target, texture);
+    }
+
+    static inline void glBindBuffer(GLenum target, GLuint buffer)
+    {
+        GLuint *binding = bufferBinding(target);
+        if (binding && *binding == buffer) {
+            ++m_skipped_calls;
+            return;
+        }
+        ++m_issued_calls;
+        if (binding)
+            *binding = buffer;
+        m_current->glBindBuffer(target, buffer);
+    }
+
+    static inline void glEnableVertexAttribArray(GLuint index)
+    {
+        if (index < MaxVertexAttribs) {
+            const unsigned int bit = 1u << index;
+            if ((m_state.attribs_known & bit) && (m_state.attribs_enabled & bit)) {
+                ++m_skipped_calls;
+                return;
+            }
+            m_state.attribs_known |= bit;
+            m_state.attribs_enabled |= bit;
+        }
+        ++m_issued_calls;
+        m_current->glEnableVertexAttribArray(index);
+    }
+
+    static inline void glDisableVertexAttribArray(GLuint index)
+    {
+        if (index < MaxVertexAttribs) {
+            const unsigned int bit = 1u << index;
+            if ((m_state.attribs_known & bit) && !(m_state.attribs_enabled & bit)) {
+                ++m_skipped_calls;
+                return;
+            }
+            m_state.attribs_known |= bit;
+            m_state.attribs_enabled &= ~bit;
+        }
+        ++m_issued_calls;
+        m_current->glDisableVertexAttribArray(index);
+    }
+
+    static inline void glEnable(GLenum cap)
+    {
+        if (cap == GL_BLEND) {
+            if (m_state.blend == GL_TRUE) {
+                ++m_skipped_calls;
+                return;
+            }
+            m_state.blend = GL_TRUE;
+        }
+        ++m_issued_calls;
+        m_current->glEnable(cap);
+    }
+
+    static inline void glDisable(GLenum cap)
+    {
+        if (cap == GL_BLEND) {
+            if (m_state.blend == GL_FALSE) {
+                ++m_skipped_calls;
+                return;
+            }
+            m_state.blend = GL_FALSE;
+        }
+        ++m_issued_calls;
+        m_current->glDisable(cap);
+    }
+
+    static inline void glBlendFunc(GLenum sfactor, GLenum dfactor)
+    {
+        if (m_state.blend_src == sfactor && m_state.blend_dst == dfactor) {
+            ++m_skipped_calls;
+            return;
+        }
+        ++m_issued_calls;
+        m_state.blend_src = sfactor;
+        m_state.blend_dst = dfactor;
+        m_current->glBlendFunc(sfactor, dfactor);
+    }
+
+    // uncached
 
     static inline void glDeleteProgram(GLuint program) { m_current->glDeleteProgram(program); }
     static inline void glDeleteShader(GLuint shader) { m_current->glDeleteShader(shader); }
@@ -28,32 +248,101 @@ public:
     static inline void glGetProgramiv(uint shader, GLenum pname, GLint *params) { m_current->glGetProgramiv(shader, pname, params); }
     static inline void glGetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei *length, GLchar *infoLog) { m_current->glGetProgramInfoLog(program, bufSize, length, infoLog); }
     static inline void glValidateProgram(GLuint program) { m_current->glValidateProgram(program); }
+    static inline void glProgramParameteri(GLuint program, GLenum pname, GLint value) { m_extra->glProgramParameteri(program, pname, value); }
+    static inline void glGetProgramBinary(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, GLvoid *binary) { m_extra->glGetProgramBinary(program, bufSize, length, binaryFormat, binary); }
+    static inline void glProgramBinary(GLuint program, GLenum binaryFormat, const GLvoid *binary, GLsizei length) { m_extra->glProgramBinary(program, binaryFormat, binary, length); }
+    static inline const GLubyte *glGetString(GLenum name) { return m_current->glGetString(name); }
+    static inline void glBindAttribLocation(GLuint program, GLuint index, const GLchar *name) { m_current->glBindAttribLocation(program, index, name); }
     static inline GLint glGetAttribLocation(GLuint program, const GLchar *name) { return m_current->glGetAttribLocation(program, name); }
-    static inline void glGetIntegerv(GLenum pname, GLint *params) { m_current->glGetIntegerv(pname, params); }
-    static inline void glUseProgram(GLuint program) { m_current->glUseProgram(program); }
+    static inline void glGetActiveAttrib(GLuint program, GLuint index, GLsizei bufSize, GLsizei *length, GLint *size, GLenum *type, GLchar *name) { m_current->glGetActiveAttrib(program, index, bufSize, length, size, type, name); }
+    static inline void glGetActiveUniform(GLuint program, GLuint index, GLsizei bufSize, GLsizei *length, GLint *size, GLenum *type, GLchar *name) { m_current->glGetActiveUniform(program, index, bufSize, length, size, type, name); }
     static inline GLint glGetUniformLocation(GLuint program, const GLchar *name) { return m_current->glGetUniformLocation(program, name); }
-    static inline void glUniform1i(GLint location, GLint v0) { m_current->glUniform1i(location, v0); }
-    static inline void glUniform1f(GLint location, GLfloat v0) { m_current->glUniform1f(location, v0); }
-    static inline void glUniform2fv(GLint location, GLsizei count, const GLfloat *value) { m_current->glUniform2fv(location, count, value); }
-    static inline void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) { m_current->glUniformMatrix4fv(location, count, transpose, value); }
-    static inline void glDeleteTextures(GLsizei n, const GLuint *textures) { m_current->glDeleteTextures(n, textures); }
+    static inline void glUniform1i(GLint location, GLint v0) { m_uniform_bytes += 4; m_current->glUniform1i(location, v0); }
+    static inline void glUniform1f(GLint location, GLfloat v0) { m_uniform_bytes += 4; m_current->glUniform1f(location, v0); }
+    static inline void glUniform2fv(GLint location, GLsizei count, const GLfloat *value) { m_uniform_bytes += 8 * count; m_current->glUniform2fv(location, count, value); }
+    static inline void glUniform4fv(GLint location, GLsizei count, const GLfloat *value) { m_uniform_bytes += 16 * count; m_current->glUniform4fv(location, count, value); }
+    static inline void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) { m_uniform_bytes += 64 * count; m_current->glUniformMatrix4fv(location, count, transpose, value); }
+    static inline GLuint glGetUniformBlockIndex(GLuint program, const GLchar *name) { return m_extra->glGetUniformBlockIndex(program, name); }
+    static inline void glUniformBlockBinding(GLuint program, GLuint index, GLuint binding) { m_extra->glUniformBlockBinding(program, index, binding); }
+    static inline void glBindBufferBase(GLenum target, GLuint index, GLuint buffer) { m_extra->glBindBufferBase(target, index, buffer); }
     static inline void glGenTextures(GLsizei n, GLuint *textures) { m_current->glGenTextures(n, textures); }
     static inline void glTexParameteri(GLenum target, GLenum pname, GLint param) { m_current->glTexParameteri(target, pname, param); }
     static inline void glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels) { m_current->glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels); }
-    static inline void glBindTexture(GLenum target, GLuint texture) { m_current->glBindTexture(target, texture); }
-    static inline void glActiveTexture(GLenum texture) { m_current->glActiveTexture(texture); }
-    static inline void glDeleteBuffers(GLsizei n, const GLuint *buffers) { m_current->glDeleteBuffers(n, buffers); }
+    static inline void glCompressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data) { m_current->glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data); }
+    static inline void glGenerateMipmap(GLenum target) { m_current->glGenerateMipmap(target); }
+    static inline void glPixelStorei(GLenum pname, GLint param) { m_current->glPixelStorei(pname, param); }
+    static inline void glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid *pixels) { m_current->glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels); }
     static inline void glGenBuffers(GLsizei n, GLuint *buffers) { m_current->glGenBuffers(n, buffers); }
-    static inline void glBindBuffer(GLenum target, GLuint buffer) { m_current->glBindBuffer(target, buffer); }
-    static inline void glBufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage) { m_current->glBufferData(target, size, data, usage); }
-    static inline void glEnableVertexAttribArray(GLuint index) { m_current->glEnableVertexAttribArray(index); }
+    static inline void glGenVertexArrays(GLsizei n, GLuint *arrays) { m_extra->glGenVertexArrays(n, arrays); }
+    static inline void glBufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage)
+    {
+        if (target == GL_UNIFORM_BUFFER && data)
+            m_uniform_bytes += size;
+        m_current->glBufferData(target, size, data, usage);
+    }
+    static inline void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data)
+    {
+        if (target == GL_UNIFORM_BUFFER)
+            m_uniform_bytes += size;
+        m_current->glBufferSubData(target, offset, size, data);
+    }
+    static inline void *glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) { return m_extra->glMapBufferRange(target, offset, length, access); }
+    static inline GLboolean glUnmapBuffer(GLenum target) { return m_extra->glUnmapBuffer(target); }
     static inline void glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid *pointer) { m_current->glVertexAttribPointer(index, size, type, normalized, stride, pointer); }
+    static inline void glVertexAttrib4f(GLuint index, GLfloat x, GLfloat y, GLfloat z, GLfloat w) { m_current->glVertexAttrib4f(index, x, y, z, w); }
+    static inline void glVertexAttribDivisor(GLuint index, GLuint divisor) { m_extra->glVertexAttribDivisor(index, divisor); }
     static inline void glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices) { m_current->glDrawElements(mode, count, type, indices); }
-    static inline void glDisableVertexAttribArray(GLuint index) { m_current->glDisableVertexAttribArray(index); }
-    static inline void glBlendFunc(GLenum sfactor, GLenum dfactor) { m_current->glBlendFunc(sfactor, dfactor); }
+    static inline void glDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei instancecount) { m_extra->glDrawElementsInstanced(mode, count, type, indices, instancecount); }
 
 private:
+    enum { MaxTextureUnits = 32, MaxVertexAttribs = 32 };
+    enum CompressedFormats { ETC1Formats = 1, ETC2Formats = 2, S3TCFormats = 4, ASTCFormats = 8 };
+    static const GLuint Unknown = ~0u;
+
+    struct ShadowState {
+        GLuint program;
+        GLenum active_texture;
+        GLuint textures[MaxTextureUnits];
+        GLuint array_buffer;
+        GLuint element_array_buffer;
+        GLuint vertex_array;
+        unsigned int attribs_known;
+        unsigned int attribs_enabled;
+        GLuint blend;
+        GLuint blend_src;
+        GLuint blend_dst;
+    };
+
+    static inline GLuint *textureBinding(GLenum target)
+    {
+        if (target != GL_TEXTURE_2D || m_state.active_texture == Unknown)
+            return 0;
+        GLuint unit = m_state.active_texture - GL_TEXTURE0;
+        return unit < MaxTextureUnits ? &m_state.textures[unit] : 0;
+    }
+
+    static inline GLuint *bufferBinding(GLenum target)
+    {
+        switch (target) {
+        case GL_ARRAY_BUFFER: return &m_state.array_buffer;
+        case GL_ELEMENT_ARRAY_BUFFER: return &m_state.element_array_buffer;
+        default: return 0;
+        }
+    }
+
     static QOpenGLFunctions *m_current;
+    static QOpenGLExtraFunctions *m_extra;
+    static GLenum m_half_float_type;
+    static bool m_element_index_uint;
+    static bool m_instancing;
+    static unsigned int m_compressed_formats;
+    static bool m_program_binaries;
+    static bool m_parallel_shader_compile;
+    static bool m_uniform_buffers;
+    static ShadowState m_state;
+    static unsigned int m_issued_calls;
+    static unsigned int m_skipped_calls;
+    static unsigned int m_uniform_bytes;
 };
 
 #endif//RASTERIZER_H
@@ -0,0 +1,331 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "renderlist.h"
+#include "mathematics.h"
+#include "simd.h"
+
+using namespace SceneGraph;
+
+static const float identity_matrix[16] = {
+    1, 0, 0, 0,
+    0, 1, 0, 0,
+    0, 0, 1, 0,
+    0, 0, 0, 1 };
+
+static const GLuint no_texture = ~0u;
+
+RenderList::RenderList(Node *parent)
+    : Node(parent),
+      m_dirty_all(true),
+      m_mvps_valid(false),
+      m_used_units(0),
+      m_serial(0),
+      m_emitted_serial(0),
+      m_emitted_shader(0)
+{
+}
+
+RenderList::~RenderList()
+{
+}
+
+void RenderList::execute(State *state)
+{
+    if (m_dirty_all)
+        compileAll(state);
+    else if (!m_dirty.empty())
+        compileDirty(state);
+
+    // the model-view matrices are relative to this node, so the MVPs only
+    // change when the projection or the matrix above us does
+    float view_projection[16];
+    math_kernels().multiply_matrices(state->projectionMatrix(), state->currentMatrix(), view_projection);
+    if (!m_mvps_valid || memcmp(view_projection, m_view_projection, sizeof(view_projection)) != 0) {
+        const size_t count = m_matrices.size();
+        m_mvps.resize(count);
+        if (count)
+            math_kernels().multiply_matrices_batch(view_projection, &m_matrices[0], &m_mvps[0], count / 16);
+        memcpy(m_view_projection, view_projection, sizeof(view_projection));
+        m_mvps_valid = true;
+    }
+
+    // remember the state the commands are going to overwrite
+    Shader *old_shader = state->currentShader();
+    GLint old_program = 0;
+    GLint old_unit = 0;
+    GLint old_textures[MaxTextureUnits];
+    glGetIntegerv(GL_CURRENT_PROGRAM, &old_program);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &old_unit);
+    for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+        if (m_used_units & (1u << unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &old_textures[unit]);
+        }
+    }
+
+    Shader *shader = old_shader;
+    const Command *command = m_commands.empty() ? 0 : &m_commands[0];
+    const Command *end = command + m_commands.size();
+    for (; command != end; ++command) {
+        switch (command->type) {
+        case UseProgram:
+            shader = static_cast<Shader*>(command->node);
+            shader->poll();
+            glUseProgram(shader->m_program);
+            state->setCurrentShader(shader);
+            if (shader->m_uniforms & Shader::TextureSamplerUniform)
+                shader->setUniform1i(shader->m_texture_sampler_handle, /*GL_TEXTURE*/0);
+            break;
+        case BindTexture:
+            glActiveTexture(GL_TEXTURE0 + command->argument);
+            glBindTexture(GL_TEXTURE_2D, command->id);
+            break;
+        case SetMatrix:
+            shader->setProjectionModelViewMatrix(&m_mvps[command->argument * 16]);
+            break;
+        case DrawMesh:
+            static_cast<Mesh*>(command->node)->draw(shader);
+            break;
+        case ExecuteNode:
+            state->pushMatrix();
+            state->multiplyMatrix(&m_matrices[command->argument * 16]);
+            state->execute(command->node);
+            state->popMatrix();
+            break;
+        }
+    }
+
+    for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+        if (m_used_units & (1u << unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_2D, old_textures[unit]);
+        }
+    }
+    glActiveTexture(old_unit);
+    glUseProgram(old_program);
+    state->setCurrentShader(old_shader);
+}
+
+bool RenderList::visible(State *)
+{
+    // the children are replayed from the command list
+    return false;
+}
+
+void RenderList::compile(RenderList *list, State *)
+{
+    list->addNode(this);
+}
+
+void RenderList::recompile()
+{
+    m_dirty_all = true;
+}
+
+unsigned int RenderList::commandCount() const
+{
+    return m_commands.size();
+}
+
+void RenderList::childInvalidated(Node *child)
+{
+    m_dirty.insert(child);
+}
+
+void RenderList::calculateBounds(Bounds *bounds)
+{
+    mergeChildBounds(bounds);
+}
+
+void RenderList::compileAll(State *state)
+{
+    m_commands.clear();
+    m_matrices.clear();
+    m_ranges.clear();
+    m_used_units = 0;
+    for (Node *child = firstChild(); child; child = child->nextSibling())
+        m_ranges.push_back(compileRange(child, state));
+    m_dirty.clear();
+    m_dirty_all = false;
+    m_mvps_valid = false;
+}
+
+void RenderList::compileDirty(State *state)
+{
+    // children added, removed or a large part of the list changed; start over
+    bool mirrored = m_ranges.size() == childCount() && m_dirty.size() < m_ranges.size() / 4 + 1;
+    Node *child = firstChild();
+    for (size_t i = 0; mirrored && child; child = child->nextSibling(), ++i)
+        mirrored = m_ranges[i].node == child;
+    if (!mirrored) {
+        compileAll(state);
+        return;
+    }
+
+    for (size_t i = 0; i < m_ranges.size(); ++i) {
+        Range &range = m_ranges[i];
+        if (!m_dirty.count(range.node))
+            continue;
+
+        // compile at the end of the arrays, then move it into place
+        const size_t command_count = m_commands.size();
+        const size_t matrix_count = m_matrices.size() / 16;
+        compileRange(range.node, state);
+        std::vector<Command> commands(m_commands.begin() + command_count, m_commands.end());
+        std::vector<float> matrices(m_matrices.begin() + matrix_count * 16, m_matrices.end());
+        m_commands.resize(command_count);
+        m_matrices.resize(matrix_count * 16);
+
+        const long command_delta = long(commands.size()) - long(range.end - range.begin);
+        const long matrix_delta = long(matrices.size() / 16) - long(range.matrix_end - range.matrix_begin);
+        for (size_t c = 0; c < commands.size(); ++c) {
+            if (commands[c].type == SetMatrix || commands[c].type == ExecuteNode)
+                commands[c].argument = commands[c].argument - matrix_count + range.matrix_begin;
+        }
+
+        m_commands.erase(m_commands.begin() + range.begin, m_commands.begin() + range.end);
+        m_commands.insert(m_commands.begin() + range.begin, commands.begin(), commands.end());
+        m_matrices.erase(m_matrices.begin() + range.matrix_begin * 16, m_matrices.begin() + range.matrix_end * 16);
+        m_matrices.insert(m_matrices.begin() + range.matrix_begin * 16, matrices.begin(), matrices.end());
+
+        range.end = range.begin + commands.size();
+        range.matrix_end = range.matrix_begin + matrices.size() / 16;
+        if (command_delta == 0 && matrix_delta == 0)
+            continue;
+        for (size_t c = range.end; c < m_commands.size(); ++c) {
+            if (m_commands[c].type == SetMatrix || m_commands[c].type == ExecuteNode)
+                m_commands[c].argument += matrix_delta;
+        }
+        for (size_t r = i + 1; r < m_ranges.size(); ++r) {
+            m_ranges[r].begin += command_delta;
+            m_ranges[r].end += command_delta;
+            m_ranges[r].matrix_begin += matrix_delta;
+            m_ranges[r].matrix_end += matrix_delta;
+        }
+    }
+    m_dirty.clear();
+    m_mvps_valid = false;
+}
+
+RenderList::Range RenderList::compileRange(Node *node, State *state)
+{
+    Range range;
+    range.node = node;
+    range.begin = m_commands.size();
+    range.matrix_begin = m_matrices.size() / 16;
+
+    // every range starts from unknown state so it can be replaced on its own
+    m_local.assign(identity_matrix, identity_matrix + 16);
+    m_shaders.clear();
+    m_textures.clear();
+    for (int unit = 0; unit < MaxTextureUnits; ++unit) {
+        m_required[unit] = no_texture;
+        m_emitted[unit] = no_texture;
+    }
+    m_emitted_serial = 0;
+    m_emitted_shader = 0;
+
+    if (node->enabled(state))
+        node->compile(this, state);
+
+    range.end = m_commands.size();
+    range.matrix_end = m_matrices.size() / 16;
+    return range;
+}
+
+void RenderList::pushMatrix(const float *matrix)
+{
+    float result[16];
+    math_kernels().multiply_matrices(&m_local[m_local.size() - 16], matrix, result);
+    m_local.insert(m_local.end(), result, result + 16);
+}
+
+void RenderList::popMatrix()
+{
+    m_local.resize(m_local.size() - 16);
+}
+
+void RenderList::pushShader(Shader *shader)
+{
+    ShaderFrame frame;
+    frame.shader = shader;
+    frame.serial = ++m_serial;
+    frame.matrix = addMatrix(&m_local[m_local.size() - 16]);
+    m_shaders.push_back(frame);
+}
+
+void RenderList::popShader()
+{
+    m_shaders.pop_back();
+}
+
+void RenderList::pushTexture(GLuint unit, GLuint id)
+{
+    TextureFrame frame;
+    frame.unit = unit;
+    frame.previous = unit < MaxTextureUnits ? m_required[unit] : no_texture;
+    m_textures.push_back(frame);
+    if (unit < MaxTextureUnits) {
+        m_required[unit] = id;
+        m_used_units |= 1u << unit;
+    }
+}
+
+void RenderList::popTexture()
+{
+    const TextureFrame &frame = m_textures.back();
+    if (frame.unit < MaxTextureUnits)
+        m_required[frame.unit] = frame.previous;
+    m_textures.pop_back();
+}
+
+void RenderList::addMesh(Mesh *mesh)
+{
+    flushState();
+    Command command = { DrawMesh, 0, 0, mesh };
+    m_commands.push_back(command);
+}
+
+void RenderList::addNode(Node *node)
+{
+    flushState();
+    Command command = { ExecuteNode, GLuint(addMatrix(&m_local[m_local.size() - 16])), 0, node };
+    m_commands.push_back(command);
+    // the node may upload its own matrix
+    m_emitted_serial = 0;
+}
+
+void RenderList::flushState()
+{
+    if (!m_shaders.empty()) {
+        const ShaderFrame &frame = m_shaders.back();
+        if (frame.shader != m_emitted_shader) {
+            Command command = { UseProgram, 0, 0, frame.shader };
+            m_commands.push_back(command);
+            m_emitted_shader = frame.shader;
+        }
+        if (frame.serial != m_emitted_serial) {
+            Command command = { SetMatrix, GLuint(frame.matrix), 0, 0 };
+            m_commands.push_back(command);
+            m_emitted_serial = frame.serial;
+        }
+    }
+    for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+        if (m_required[unit] != no_texture && m_required[unit] != m_emitted[unit]) {
+            Command command = { BindTexture, unit, m_required[unit], 0 };
+            m_commands.push_back(command);
+            m_emitted[unit] = m_required[unit];
+        }
+    }
+}
+
+size_t RenderList::addMatrix(const float *matrix)
+{
+    m_matrices.insert(m_matrices.end(), matrix, matrix + 16);
+    return m_matrices.size() / 16 - 1;
+}
@@ -0,0 +1,111 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef RENDERLIST_H
+#define RENDERLIST_H
+
+#include <set>
+#include <vector>
+
+#include "scenegraph.h"
+
+namespace SceneGraph {
+
+    // Compiles its subtree into a flat array of render commands and replays
+    // that array instead of traversing the children every frame. Each direct
+    // child compiles into its own range, so invalidating a node only
+    // recompiles the range of the child it lives under.
+    //
+    // Node types the compiler does not know about are kept in the list as
+    // opaque commands and executed through State as usual.
+    class RenderList : public Node
+    {
+    public:
+        RenderList(Node *parent = 0);
+        ~RenderList();
+
+        void execute(State *state);
+        bool visible(State *state);
+        void compile(RenderList *list, State *state);
+
+        void recompile();
+        unsigned int commandCount() const;
+
+        // compiler interface, used by Node::compile
+        void pushMatrix(const float *matrix);
+        void popMatrix();
+        void pushShader(Shader *shader);
+        void popShader();
+        void pushTexture(GLuint unit, GLuint id);
+        void popTexture();
+        void addMesh(Mesh *mesh);
+        void addNode(Node *node);
+
+    protected:
+        void childInvalidated(Node *child);
+        void calculateBounds(Bounds *bounds);
+
+    private:
+        enum CommandType { UseProgram, BindTexture, SetMatrix, DrawMesh, ExecuteNode };
+        enum { MaxTextureUnits = 32 };
+
+        struct Command {
+            CommandType type;
+            GLuint argument; // texture unit or matrix index
+            GLuint id;       // texture id
+            Node *node;      // shader, mesh or opaque node
+        };
+
+        struct Range {
+            Node *node;
+            size_t begin;
+            size_t end;
+            size_t matrix_begin;
+            size_t matrix_end;
+        };
+
+        struct ShaderFrame {
+            Shader *shader;
+            unsigned int serial;
+            size_t matrix;
+        };
+
+        struct TextureFrame {
+            GLuint unit;
+            GLuint previous;
+        };
+
+        void compileAll(State *state);
+        void compileDirty(State *state);
+        Range compileRange(Node *node, State *state);
+        void flushState();
+        size_t addMatrix(const float *matrix);
+
+        std::vector<Command> m_commands;
+        std::vector<float> m_matrices;
+        std::vector<float> m_mvps;
+        std::vector<Range> m_ranges;
+        std::set<Node*> m_dirty;
+        bool m_dirty_all;
+        bool m_mvps_valid;
+        float m_view_projection[16];
+        unsigned int m_used_units;
+
+        // compile time state
+        std::vector<float> m_local;
+        std::vector<ShaderFrame> m_shaders;
+        std::vector<TextureFrame> m_textures;
+        GLuint m_required[MaxTextureUnits];
+        GLuint m_emitted[MaxTextureUnits];
+        unsigned int m_serial;
+        unsigned int m_emitted_serial;
+        Shader *m_emitted_shader;
+    };
+
+}; // SceneGraph
+
+#endif//RENDERLIST_H
@@ -0,0 +1,339 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "renderqueue.h"
+
+using namespace SceneGraph;
+
+RenderQueue::RenderQueue()
+    : m_state_changes(0),
+      m_sorted_state_changes(0)
+{
+    clear();
+}
+
+RenderQueue::~RenderQueue()
+{
+}
+
+void RenderQueue::clear()
+{
+    m_items.clear();
+    m_keys.clear();
+    m_order.clear();
+    m_mvps.clear();
+    m_textures.clear();
+
+    m_shaders.clear();
+    m_shader_mvps.clear();
+    m_texture_frames.clear();
+    m_blending.clear();
+    Blending blending = { false, GL_ONE, GL_ZERO };
+    m_blending.push_back(blending);
+    memset(&m_current_textures, 0, sizeof(m_current_textures));
+    m_textures_changed = true;
+}
+
+void RenderQueue::sort()
+{
+    const unsigned int count = m_items.size();
+    m_keys.resize(count);
+    m_order.resize(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        m_keys[i] = sortKey(m_items[i]);
+        m_order[i] = i;
+    }
+    m_state_changes = countStateChanges(count ? &m_order[0] : 0);
+
+    // least significant digit radix sort, one byte per pass
+    m_sort_keys.resize(count);
+    m_sort_order.resize(count);
+    for (unsigned int shift = 0; shift < 64; shift += 8) {
+        unsigned int offsets[256];
+        memset(offsets, 0, sizeof(offsets));
+        for (unsigned int i = 0; i < count; ++i)
+            ++offsets[(m_keys[i] >> shift) & 0xff];
+        if (count == 0 || offsets[(m_keys[0] >> shift) & 0xff] == count)
+            continue; // every key has the same digit
+        for (unsigned int i = 0, sum = 0; i < 256; ++i) {
+            unsigned int size = offsets[i];
+            offsets[i] = sum;
+            sum += size;
+        }
+        for (unsigned int i = 0; i < count; ++i) {
+            unsigned int index = offsets[(m_keys[i] >> shift) & 0xff]++;
+            m_sort_keys[index] = m_keys[i];
+            m_sort_order[index] = m_order[i];
+        }
+        m_keys.swap(m_sort_keys);
+        m_order.swap(m_sort_order);
+    }
+    m_sorted_state_changes = countStateChanges(count ? &m_order[0] : 0);
+}
+
+void RenderQueue::submit(State *state)
+{
+    // remember the state the queue is going to overwrite
+    Shader *old_shader = state->currentShader();
+    GLint old_program = 0;
+    GLint old_unit = 0;
+    GLint old_blend = GL_FALSE;
+    GLint old_sfactor = GL_ONE;
+    GLint old_dfactor = GL_ZERO;
+    GLint old_textures[MaxTextureUnits];
+    GLint bound_textures[MaxTextureUnits];
+    unsigned int used_units = 0;
+    for (size_t i = 0; i < m_textures.size(); ++i) {
+        for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+            if (m_textures[i].ids[unit])
+                used_units |= 1u << unit;
+        }
+    }
+    glGetIntegerv(GL_CURRENT_PROGRAM, &old_program);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &old_unit);
+    glGetIntegerv(GL_BLEND, &old_blend);
+    glGetIntegerv(GL_BLEND_SRC_RGB, &old_sfactor);
+    glGetIntegerv(GL_BLEND_DST_RGB, &old_dfactor);
+    for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+        if (used_units & (1u << unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &old_textures[unit]);
+            bound_textures[unit] = old_textures[unit];
+        }
+    }
+
+    Shader *shader = 0;
+    unsigned int mvp = ~0u;
+    for (size_t i = 0; i < m_order.size(); ++i) {
+        const Item &item = m_items[m_order[i]];
+        if (item.shader != shader) {
+            shader = item.shader;
+            mvp = ~0u;
+            glUseProgram(shader->m_program);
+            state->setCurrentShader(shader);
+            if (shader->m_uniforms & Shader::TextureSamplerUniform)
+                shader->setUniform1i(shader->m_texture_sampler_handle, /*GL_TEXTURE*/0);
+        }
+        if (item.mvp != mvp) {
+            mvp = item.mvp;
+            shader->setProjectionModelViewMatrix(&m_mvps[mvp * 16]);
+        }
+        // units the item has no texture on get the binding from outside the queue, as in tree order
+        const Textures &textures = m_textures[item.textures];
+        for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+            if (!(used_units & (1u << unit)))
+                continue;
+            const GLint id = textures.ids[unit] ? GLint(textures.ids[unit]) : old_textures[unit];
+            if (id != bound_textures[unit]) {
+                glActiveTexture(GL_TEXTURE0 + unit);
+                glBindTexture(GL_TEXTURE_2D, id);
+                bound_textures[unit] = id;
+            }
+        }
+        if (item.blending.enabled) {
+            glEnable(GL_BLEND);
+            glBlendFunc(item.blending.sfactor, item.blending.dfactor);
+        } else {
+            glDisable(GL_BLEND);
+        }
+        if (item.count == ~0u)
+            item.mesh->draw(shader);
+        else
+            item.mesh->drawRange(shader, item.first, item.count);
+    }
+
+    for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+        if ((used_units & (1u << unit)) && bound_textures[unit] != old_textures[unit]) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_2D, old_textures[unit]);
+        }
+    }
+    glActiveTexture(old_unit);
+    if (old_blend)
+        glEnable(GL_BLEND);
+    else
+        glDisable(GL_BLEND);
+    glBlendFunc(old_sfactor, old_dfactor);
+    glUseProgram(old_program);
+    state->setCurrentShader(old_shader);
+}
+
+unsigned int RenderQueue::size() const
+{
+    return m_items.size();
+}
+
+unsigned int RenderQueue::stateChanges() const
+{
+    return m_state_changes;
+}
+
+unsigned int RenderQueue::sortedStateChanges() const
+{
+    return m_sorted_state_changes;
+}
+
+void RenderQueue::pushShader(Shader *shader, const float *mvp_matrix)
+{
+    m_shaders.push_back(shader);
+    m_shader_mvps.push_back(m_mvps.size() / 16);
+    m_mvps.insert(m_mvps.end(), mvp_matrix, mvp_matrix + 16);
+}
+
+void RenderQueue::popShader()
+{
+    m_shaders.pop_back();
+    m_shader_mvps.pop_back();
+}
+
+void RenderQueue::pushTexture(GLuint unit, GLuint id)
+{
+    TextureFrame frame = { unit, 0 };
+    if (unit < MaxTextureUnits) {
+        frame.previous = m_current_textures.ids[unit];
+        m_current_textures.ids[unit] = id;
+        m_textures_changed = true;
+    } else {
+        fprintf(stderr, "RenderQueue: texture unit %u is not supported\n", unit);
+    }
+    m_texture_frames.push_back(frame);
+}
+
+void RenderQueue::popTexture()
+{
+    const TextureFrame &frame = m_texture_frames.back();
+    if (frame.unit < MaxTextureUnits) {
+        m_current_textures.ids[frame.unit] = frame.previous;
+        m_textures_changed = true;
+    }
+    m_texture_frames.pop_back();
+}
+
+void RenderQueue::pushBlend(GLenum sfactor, GLenum dfactor)
+{
+    Blending blending = { true, sfactor, dfactor };
+    m_blending.push_back(blending);
+}
+
+void RenderQueue::popBlend()
+{
+    m_blending.pop_back();
+}
+
+void RenderQueue::addMesh(Mesh *mesh)
+{
+    // the whole mesh goes through draw(), which InstancedMesh overrides
+    addMeshRange(mesh, 0, ~0u);
+}
+
+void RenderQueue::addMeshRange(Mesh *mesh, unsigned int first, unsigned int count)
+{
+    if (m_shaders.empty())
+        return;
+    if (m_textures_changed) {
+        m_textures.push_back(m_current_textures);
+        m_textures_changed = false;
+    }
+    Item item;
+    item.mesh = mesh;
+    item.first = first;
+    item.count = count;
+    item.shader = m_shaders.back();
+    item.mvp = m_shader_mvps.back();
+    item.textures = m_textures.size() - 1;
+    item.blending = m_blending.back();
+    m_items.push_back(item);
+}
+
+RenderQueue::Key RenderQueue::sortKey(const Item &item) const
+{
+    // depth of the mesh origin in normalized device coordinates
+    const float *mvp = &m_mvps[item.mvp * 16];
+    float depth = mvp[15] > 0 ? mvp[14] / mvp[15] : 1;
+    if (depth < -1)
+        depth = -1;
+    if (depth > 1)
+        depth = 1;
+    const Key depth_bits = Key((depth * 0.5f + 0.5f) * 0xffffff) & 0xffffff;
+    const Key texture = m_textures[item.textures].ids[0];
+    const Key program = item.shader->m_program;
+    const Key mesh = item.mesh->m_ids[0];
+
+    if (!item.blending.enabled) {
+        // program:12 texture:16 mesh:11 depth:24, front-to-back
+        return ((program & 0xfff) << 51) | ((texture & 0xffff) << 35)
+                | ((mesh & 0x7ff) << 24) | depth_bits;
+    }
+    // blended:1 depth:24 blend:8 program:10 texture:12 mesh:9, back-to-front
+    const Key blend = (blendIndex(item.blending.sfactor) << 4) | blendIndex(item.blending.dfactor);
+    return (Key(1) << 63) | ((0xffffff - depth_bits) << 39) | (blend << 31)
+            | ((program & 0x3ff) << 21) | ((texture & 0xfff) << 9) | (mesh & 0x1ff);
+}
+
+unsigned int RenderQueue::countStateChanges(const unsigned int *order) const
+{
+    unsigned int changes = 0;
+    const Shader *shader = 0;
+    const Mesh *mesh = 0;
+    GLuint program = 0;
+    GLuint buffer = 0;
+    GLuint textures[MaxTextureUnits];
+    Blending blending = { false, GL_ONE, GL_ZERO };
+    memset(textures, 0, sizeof(textures));
+    for (size_t i = 0; i < m_items.size(); ++i) {
+        const Item &item = m_items[order[i]];
+        if (item.shader != shader) {
+            shader = item.shader;
+            if (shader->m_program != program)
+                ++changes;
+            program = shader->m_program;
+        }
+        if (item.mesh != mesh) {
+            mesh = item.mesh;
+            if (mesh->m_ids[0] != buffer)
+                ++changes;
+            buffer = mesh->m_ids[0];
+        }
+        // 0 stands for the binding from outside the queue
+        const Textures &item_textures = m_textures[item.textures];
+        for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+            if (item_textures.ids[unit] != textures[unit]) {
+                textures[unit] = item_textures.ids[unit];
+                ++changes;
+            }
+        }
+        if (item.blending.enabled != blending.enabled
+                || (item.blending.enabled && (item.blending.sfactor != blending.sfactor
+                                              || item.blending.dfactor != blending.dfactor))) {
+            blending = item.blending;
+            ++changes;
+        }
+    }
+    return changes;
+}
+
+unsigned int RenderQueue::blendIndex(GLenum factor)
+{
+    switch (factor) {
+    case GL_ZERO: return 0;
+    case GL_ONE: return 1;
+    case GL_SRC_COLOR: return 2;
+    case GL_ONE_MINUS_SRC_COLOR: return 3;
+    case GL_SRC_ALPHA: return 4;
+    case GL_ONE_MINUS_SRC_ALPHA: return 5;
+    case GL_DST_ALPHA: return 6;
+    case GL_ONE_MINUS_DST_ALPHA: return 7;
+    case GL_DST_COLOR: return 8;
+    case GL_ONE_MINUS_DST_COLOR: return 9;
+    case GL_SRC_ALPHA_SATURATE: return 10;
+    case GL_CONSTANT_COLOR: return 11;
+    case GL_ONE_MINUS_CONSTANT_COLOR: return 12;
+    case GL_CONSTANT_ALPHA: return 13;
+    case GL_ONE_MINUS_CONSTANT_ALPHA: return 14;
+    default: return 15;
+    }
+}
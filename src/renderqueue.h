@@ -0,0 +1,103 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <vector>
+
+#include "scenegraph.h"
+
+namespace SceneGraph {
+
+    // Collects the draws of a traversal instead of issuing them in tree order.
+    // Each draw gets a 64 bit sort key; opaque draws are grouped by program,
+    // texture and mesh and then ordered front-to-back, blended draws are
+    // ordered back-to-front first so they still composite correctly.
+    //
+    // Opt-in through State::setRenderQueue(); the queue is sorted and submitted
+    // when the outermost State::execute() returns. RenderList replays its
+    // commands immediately and does not go through the queue.
+    class RenderQueue : protected Rasterizer
+    {
+    public:
+        RenderQueue();
+        ~RenderQueue();
+
+        void clear();
+        void sort();
+        void submit(State *state);
+
+        unsigned int size() const;
+        unsigned int stateChanges() const;       // in traversal order
+        unsigned int sortedStateChanges() const; // in submission order
+
+        // traversal interface, used by the nodes while the queue is filled
+        void pushShader(Shader *shader, const float *mvp_matrix);
+        void popShader();
+        void pushTexture(GLuint unit, GLuint id);
+        void popTexture();
+        void pushBlend(GLenum sfactor, GLenum dfactor);
+        void popBlend();
+        void addMesh(Mesh *mesh);
+        void addMeshRange(Mesh *mesh, unsigned int first, unsigned int count);
+
+    private:
+        typedef unsigned long long Key;
+        enum { MaxTextureUnits = 32 };
+
+        struct Textures {
+            GLuint ids[MaxTextureUnits];
+        };
+
+        struct Blending {
+            bool enabled;
+            GLenum sfactor;
+            GLenum dfactor;
+        };
+
+        struct Item {
+            Mesh *mesh;
+            unsigned int first; // element range, count is ~0u for all of draw()
+            unsigned int count;
+            Shader *shader;
+            unsigned int mvp;
+            unsigned int textures;
+            Blending blending;
+        };
+
+        struct TextureFrame {
+            GLuint unit;
+            GLuint previous;
+        };
+
+        Key sortKey(const Item &item) const;
+        unsigned int countStateChanges(const unsigned int *order) const;
+        static unsigned int blendIndex(GLenum factor);
+
+        std::vector<Item> m_items;
+        std::vector<Key> m_keys;
+        std::vector<unsigned int> m_order;
+        std::vector<Key> m_sort_keys;
+        std::vector<unsigned int> m_sort_order;
+        std::vector<float> m_mvps;
+        std::vector<Textures> m_textures;
+        unsigned int m_state_changes;
+        unsigned int m_sorted_state_changes;
+
+        // traversal state
+        std::vector<Shader*> m_shaders;
+        std::vector<unsigned int> m_shader_mvps;
+        std::vector<TextureFrame> m_texture_frames;
+        std::vector<Blending> m_blending;
+        Textures m_current_textures;
+        bool m_textures_changed;
+    };
+
+}; // SceneGraph
+
+#endif//RENDERQUEUE_H
@@ -0,0 +1,306 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "resourcemanager.h"
+
+using namespace SceneGraph;
+
+bool ResourceManager::Key::operator==(const Key &other) const
+{
+    return width == other.width && height == other.height && format == other.format
+            && type == other.type && levels == other.levels;
+}
+
+ResourceManager *ResourceManager::instance()
+{
+    static ResourceManager manager;
+    return &manager;
+}
+
+ResourceManager::ResourceManager()
+    : m_pooled_bytes(0),
+      m_pool_limit(16 * 1024 * 1024),
+      m_frame(0),
+      m_created(0),
+      m_recycled(0),
+      m_missed(0),
+      m_deleted(0)
+{
+    for (int kind = 0; kind < KindCount; ++kind)
+        m_live_bytes[kind] = 0;
+}
+
+GLuint ResourceManager::createBuffer(GLsizeiptr size, GLenum usage, bool *recycled)
+{
+    Key key;
+    key.width = size;
+    key.height = 0;
+    key.format = usage;
+    key.type = 0;
+    key.levels = 0;
+    GLuint id = recycle(Buffer, key);
+    if (recycled)
+        *recycled = id != 0;
+    if (!id) {
+        glGenBuffers(1, &id);
+        ++m_created;
+        ++m_missed;
+    }
+    insert(Buffer, id, size, true, key);
+    return id;
+}
+
+GLuint ResourceManager::createTexture(GLuint width, GLuint height, GLenum internal_format, GLenum type,
+                                      unsigned int levels, size_t bytes, bool *recycled)
+{
+    Key key;
+    key.width = width;
+    key.height = height;
+    key.format = internal_format;
+    key.type = type;
+    key.levels = levels;
+    GLuint id = recycle(Texture, key);
+    if (recycled)
+        *recycled = id != 0;
+    if (!id) {
+        glGenTextures(1, &id);
+        ++m_created;
+        ++m_missed;
+    }
+    insert(Texture, id, bytes, true, key);
+    return id;
+}
+
+GLuint ResourceManager::createVertexArray()
+{
+    GLuint id = 0;
+    glGenVertexArrays(1, &id);
+    ++m_created;
+    adopt(VertexArray, id);
+    return id;
+}
+
+GLuint ResourceManager::uploadBuffer(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage)
+{
+    bool recycled = false;
+    const GLuint id = createBuffer(size, usage, &recycled);
+    glBindBuffer(target, id);
+    if (!recycled)
+        glBufferData(target, size, data, usage);
+    else if (data)
+        glBufferSubData(target, 0, size, data);
+    return id;
+}
+
+void ResourceManager::adopt(Kind kind, GLuint id, size_t bytes)
+{
+    Key key;
+    memset(&key, 0, sizeof(key));
+    insert(kind, id, bytes, false, key);
+}
+
+void ResourceManager::retain(Kind kind, GLuint id)
+{
+    // a released name stays dead until it is handed out again
+    std::map<GLuint, Resource>::iterator found = m_resources[kind].find(id);
+    if (found != m_resources[kind].end() && found->second.references > 0)
+        ++found->second.references;
+}
+
+void ResourceManager::release(Kind kind, GLuint id)
+{
+    std::map<GLuint, Resource>::iterator found = m_resources[kind].find(id);
+    if (found == m_resources[kind].end() || found->second.references == 0 || --found->second.references > 0)
+        return;
+    m_live_bytes[kind] -= found->second.bytes;
+    Released released;
+    released.kind = kind;
+    released.id = id;
+    m_released.push_back(released);
+}
+
+bool ResourceManager::contains(Kind kind, GLuint id) const
+{
+    std::map<GLuint, Resource>::const_iterator found = m_resources[kind].find(id);
+    return found != m_resources[kind].end() && found->second.references > 0;
+}
+
+void ResourceManager::setBytes(Kind kind, GLuint id, size_t bytes)
+{
+    std::map<GLuint, Resource>::iterator found = m_resources[kind].find(id);
+    if (found == m_resources[kind].end() || found->second.references == 0)
+        return;
+    Resource &resource = found->second;
+    m_live_bytes[kind] += bytes - resource.bytes;
+    resource.bytes = bytes;
+    if (kind == Buffer)
+        resource.key.width = bytes;
+    else
+        resource.recyclable = false; // the levels no longer match the key
+}
+
+void ResourceManager::collect()
+{
+    std::vector<GLuint> doomed[KindCount];
+    for (size_t i = 0; i < m_released.size(); ++i) {
+        const Released &released = m_released[i];
+        std::map<GLuint, Resource>::iterator found = m_resources[released.kind].find(released.id);
+        const Resource &resource = found->second;
+        if (resource.recyclable && resource.bytes <= m_pool_limit) {
+            Free free;
+            free.kind = released.kind;
+            free.id = released.id;
+            free.bytes = resource.bytes;
+            free.key = resource.key;
+            free.frame = m_frame;
+            m_free.push_back(free);
+            m_pooled_bytes += resource.bytes;
+        } else {
+            doomed[released.kind].push_back(released.id);
+        }
+        m_resources[released.kind].erase(found);
+    }
+    m_released.clear();
+
+    size_t evicted = 0;
+    while (evicted < m_free.size() && m_pooled_bytes > m_pool_limit) {
+        const Free &free = m_free[evicted++];
+        doomed[free.kind].push_back(free.id);
+        m_pooled_bytes -= free.bytes;
+    }
+    m_free.erase(m_free.begin(), m_free.begin() + evicted);
+
+    for (int kind = 0; kind < KindCount; ++kind)
+        destroy(Kind(kind), doomed[kind]);
+    ++m_frame;
+}
+
+void ResourceManager::purge()
+{
+    collect();
+    const size_t limit = m_pool_limit;
+    m_pool_limit = 0;
+    collect();
+    m_pool_limit = limit;
+}
+
+void ResourceManager::setPoolLimit(size_t bytes)
+{
+    m_pool_limit = bytes;
+}
+
+size_t ResourceManager::poolLimit() const
+{
+    return m_pool_limit;
+}
+
+unsigned int ResourceManager::liveCount(Kind kind) const
+{
+    // released names stay in the map until they are collected
+    unsigned int count = 0;
+    for (std::map<GLuint, Resource>::const_iterator i = m_resources[kind].begin(); i != m_resources[kind].end(); ++i) {
+        if (i->second.references > 0)
+            ++count;
+    }
+    return count;
+}
+
+size_t ResourceManager::liveBytes(Kind kind) const
+{
+    return m_live_bytes[kind];
+}
+
+unsigned int ResourceManager::pooledCount() const
+{
+    return m_free.size();
+}
+
+size_t ResourceManager::pooledBytes() const
+{
+    return m_pooled_bytes;
+}
+
+unsigned int ResourceManager::createdCount() const
+{
+    return m_created;
+}
+
+unsigned int ResourceManager::recycledCount() const
+{
+    return m_recycled;
+}
+
+unsigned int ResourceManager::deletedCount() const
+{
+    return m_deleted;
+}
+
+float ResourceManager::hitRate() const
+{
+    const unsigned int requests = m_recycled + m_missed;
+    return requests ? float(m_recycled) / requests : 0.0f;
+}
+
+void ResourceManager::resetMetrics()
+{
+    m_created = 0;
+    m_recycled = 0;
+    m_missed = 0;
+    m_deleted = 0;
+}
+
+GLuint ResourceManager::recycle(Kind kind, const Key &key)
+{
+    // the most recently freed first, it is the most likely to still be in the caches
+    for (size_t i = m_free.size(); i-- > 0;) {
+        const Free &free = m_free[i];
+        if (free.kind != kind || free.frame + ReuseFrames > m_frame || !(free.key == key))
+            continue;
+        const GLuint id = free.id;
+        m_pooled_bytes -= free.bytes;
+        m_free.erase(m_free.begin() + i);
+        ++m_recycled;
+        return id;
+    }
+    return 0;
+}
+
+void ResourceManager::insert(Kind kind, GLuint id, size_t bytes, bool recyclable, const Key &key)
+{
+    if (!id)
+        return;
+    Resource &resource = m_resources[kind][id];
+    resource.references = 1;
+    resource.bytes = bytes;
+    resource.recyclable = recyclable;
+    resource.key = key;
+    m_live_bytes[kind] += bytes;
+}
+
+void ResourceManager::destroy(Kind kind, const std::vector<GLuint> &ids)
+{
+    if (ids.empty())
+        return;
+    switch (kind) {
+    case Buffer:
+        glDeleteBuffers(ids.size(), &ids[0]);
+        break;
+    case Texture:
+        glDeleteTextures(ids.size(), &ids[0]);
+        break;
+    case VertexArray:
+        glDeleteVertexArrays(ids.size(), &ids[0]);
+        break;
+    case Program:
+        for (size_t i = 0; i < ids.size(); ++i)
+            glDeleteProgram(ids[i]);
+        break;
+    default:
+        break;
+    }
+    m_deleted += ids.size();
+}
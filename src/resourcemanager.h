@@ -0,0 +1,124 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef RESOURCEMANAGER_H
+#define RESOURCEMANAGER_H
+
+#include <map>
+#include <vector>
+
+#include "rasterizer.h"
+
+namespace SceneGraph {
+
+    // Owns the buffers, textures, vertex arrays and programs of the scene
+    // graph. Every name has a reference count; nodes that share a name,
+    // like the copies made with the Mesh(Mesh*) and Texture2D(Texture2D*)
+    // constructors, each hold a reference.
+    //
+    // Nothing is deleted when the last reference goes. The name waits for
+    // collect(), which State::execute() calls when the outermost execute
+    // returns, and the names are deleted there with one call per kind.
+    // Buffers and textures go on a free list instead, and the next buffer
+    // of the same size and usage, or texture of the same size and format,
+    // is handed out from there without a glGen*() call and with storage to
+    // upload into. An entry waits ReuseFrames frames first, as the GPU may
+    // still read it, and the oldest entries are deleted once the free list
+    // holds more than poolLimit() bytes.
+    class ResourceManager : protected Rasterizer
+    {
+    public:
+        enum Kind { Buffer, Texture, VertexArray, Program, KindCount };
+        enum { ReuseFrames = 2 };
+
+        static ResourceManager *instance();
+
+        // a name with one reference; recycled tells if it has storage of
+        // that size and format already, which a sub image or sub data upload
+        // may fill; the caller binds it
+        GLuint createBuffer(GLsizeiptr size, GLenum usage, bool *recycled = 0);
+        GLuint createTexture(GLuint width, GLuint height, GLenum internal_format, GLenum type,
+                             unsigned int levels, size_t bytes, bool *recycled = 0);
+        GLuint createVertexArray();
+        // createBuffer(), bound to target and filled with data, which may be 0
+        GLuint uploadBuffer(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage);
+        // takes over a name that was made elsewhere, with one reference
+        void adopt(Kind kind, GLuint id, size_t bytes = 0);
+
+        void retain(Kind kind, GLuint id);
+        void release(Kind kind, GLuint id);
+        bool contains(Kind kind, GLuint id) const;
+        // after glBufferData with another size or more levels on a texture
+        void setBytes(Kind kind, GLuint id, size_t bytes);
+
+        void collect();
+        void purge(); // collect() and delete the free list as well
+
+        void setPoolLimit(size_t bytes);
+        size_t poolLimit() const;
+
+        // metrics
+        unsigned int liveCount(Kind kind) const; // names with references
+        size_t liveBytes(Kind kind) const;
+        unsigned int pooledCount() const;        // names on the free list
+        size_t pooledBytes() const;
+        unsigned int createdCount() const;       // names made by glGen*(), since the last reset
+        unsigned int recycledCount() const;      // names handed out from the free list
+        unsigned int deletedCount() const;
+        float hitRate() const;                   // recycled out of the buffers and textures handed out
+        void resetMetrics();
+
+    private:
+        // for buffers, the size in width and the usage in format
+        struct Key {
+            GLuint width;
+            GLuint height;
+            GLenum format;
+            GLenum type;
+            unsigned int levels;
+            bool operator==(const Key &other) const;
+        };
+        struct Resource {
+            unsigned int references;
+            size_t bytes;
+            bool recyclable;
+            Key key;
+        };
+        struct Free {
+            Kind kind;
+            GLuint id;
+            size_t bytes;
+            Key key;
+            unsigned int frame;
+        };
+        struct Released {
+            Kind kind;
+            GLuint id;
+        };
+
+        ResourceManager();
+
+        GLuint recycle(Kind kind, const Key &key);
+        void insert(Kind kind, GLuint id, size_t bytes, bool recyclable, const Key &key);
+        void destroy(Kind kind, const std::vector<GLuint> &ids);
+
+        std::map<GLuint, Resource> m_resources[KindCount];
+        size_t m_live_bytes[KindCount];
+        std::vector<Released> m_released;
+        std::vector<Free> m_free; // oldest first
+        size_t m_pooled_bytes;
+        size_t m_pool_limit;
+        unsigned int m_frame;
+        unsigned int m_created;
+        unsigned int m_recycled;
+        unsigned int m_missed; // buffers and textures that had to be made
+        unsigned int m_deleted;
+    };
+
+}; // SceneGraph
+
+#endif//RESOURCEMANAGER_H
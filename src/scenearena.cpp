@@ -0,0 +1,122 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "scenearena.h"
+#include "scenegraph.h"
+
+using namespace SceneGraph;
+
+SceneArena *SceneArena::s_placing = 0;
+
+SceneArena::SceneArena(unsigned int block_size)
+    : m_cursor(0),
+      m_end(0),
+      m_block_size(block_size),
+      m_live(0),
+      m_used(0),
+      m_pending(0),
+      m_pending_size(0)
+{
+}
+
+SceneArena::~SceneArena()
+{
+    clear();
+}
+
+void SceneArena::clear()
+{
+    // nothing outside may point into the arena afterwards, and nothing in
+    // it into memory outside
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        Node *node = m_nodes[i];
+        if (!node)
+            continue;
+        if (node->m_parent && node->m_parent->m_arena != this)
+            node->setParent(0);
+        Node *child = node->m_first_child;
+        while (child) {
+            Node *next = child->m_next_sibling;
+            if (child->m_arena != this)
+                delete child;
+            child = next;
+        }
+    }
+
+    // children come after their parents; with the links gone the
+    // destructors leave the tree alone
+    for (size_t i = m_nodes.size(); i > 0; --i) {
+        Node *node = m_nodes[i - 1];
+        if (!node)
+            continue;
+        node->m_parent = 0;
+        node->m_first_child = 0;
+        node->m_last_child = 0;
+        node->m_next_sibling = 0;
+        node->m_previous_sibling = 0;
+        node->m_child_count = 0;
+        node->~Node();
+    }
+
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+        qFreeAligned(m_blocks[i]);
+    m_blocks.clear();
+    m_nodes.clear();
+    m_cursor = 0;
+    m_end = 0;
+    m_live = 0;
+    m_used = 0;
+}
+
+unsigned int SceneArena::nodeCount() const
+{
+    return m_live;
+}
+
+unsigned int SceneArena::blockCount() const
+{
+    return m_blocks.size();
+}
+
+size_t SceneArena::bytesUsed() const
+{
+    return m_used;
+}
+
+void *SceneArena::allocate(size_t size)
+{
+    size = (size + 15) & ~size_t(15);
+    if (m_cursor + size > m_end) {
+        // oversized nodes get a block of their own, the current one stays open
+        const size_t block_size = size > m_block_size ? size : m_block_size;
+        char *block = static_cast<char*>(qMallocAligned(block_size, 16));
+        if (!block)
+            return 0; // Node::operator new throws
+        m_blocks.push_back(block);
+        if (size > m_block_size) {
+            m_used += size;
+            return block;
+        }
+        m_cursor = block;
+        m_end = block + block_size;
+    }
+    char *memory = m_cursor;
+    m_cursor += size;
+    m_used += size;
+    return memory;
+}
+
+void SceneArena::adopt(Node *node)
+{
+    node->m_arena = this;
+    node->m_arena_index = m_nodes.size();
+    m_nodes.push_back(node);
+    ++m_live;
+    s_placing = 0;
+    m_pending = 0;
+    m_pending_size = 0;
+}
@@ -0,0 +1,68 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef SCENEARENA_H
+#define SCENEARENA_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace SceneGraph {
+
+    class Node;
+
+    // Memory for nodes that are created and thrown away together, such as
+    // everything in a level. Nodes of any type are placed in it with
+    //
+    //     Mesh *mesh = new (arena) Mesh(parent);
+    //
+    // and are carved out of large blocks one after the other, so a subtree
+    // built in one go ends up next to each other in memory. A node in an
+    // arena can still be deleted on its own; its memory is reclaimed with
+    // the rest of the arena.
+    //
+    // clear() runs the destructors of all the nodes that are left, so GL
+    // objects are released as usual, and then frees the blocks at once. It
+    // does not walk the tree to do so; the nodes are destroyed in reverse
+    // order of creation. Nodes outside the arena that hang below nodes in
+    // it are deleted with them, and nodes in the arena are detached from
+    // parents outside it. Like deleting the nodes, clear() must be called
+    // on the thread that owns the GL context.
+    class SceneArena
+    {
+        friend class Node;
+    public:
+        SceneArena(unsigned int block_size = 64 * 1024);
+        ~SceneArena(); // calls clear()
+
+        void clear();
+
+        unsigned int nodeCount() const;  // live nodes
+        unsigned int blockCount() const; // allocations made for the arena
+        size_t bytesUsed() const;
+
+    private:
+        void *allocate(size_t size);
+        void adopt(Node *node);
+
+        std::vector<char*> m_blocks;
+        std::vector<Node*> m_nodes; // 0 once deleted
+        char *m_cursor;
+        char *m_end;
+        unsigned int m_block_size;
+        unsigned int m_live;
+        size_t m_used;
+
+        // the memory handed out for the node being constructed
+        char *m_pending;
+        size_t m_pending_size;
+        static SceneArena *s_placing;
+    };
+
+}; // SceneGraph
+
+#endif//SCENEARENA_H
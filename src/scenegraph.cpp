@@ -6,8 +6,21 @@
 ****************************************************************************/
 
 #include "scenegraph.h"
+#include "renderlist.h"
+#include "renderqueue.h"
+#include "meshoptimizer.h"
+#include "parallelupdate.h"
+#include "transformsystem.h"
+#include "scenearena.h"
+#include "texturestreamer.h"
+#include "programcache.h"
+#include "resourcemanager.h"
 #include "mathematics.h"
+#include "simd.h"
 #include <stdlib.h>
+#include <algorithm>
+#include <new>
+#include <typeinfo>
 
 using namespace SceneGraph;
 
@@ -19,77 +32,302 @@ static const float identity_matrix[16] = {
     0, 0, 1, 0,
     0, 0, 0, 1 };
 
+// Bounds
+
+Bounds::Bounds()
+    : type(Empty),
+      radius(0)
+{
+    for (int i = 0; i < 3; ++i) {
+        minimum[i] = 0;
+        maximum[i] = 0;
+        center[i] = 0;
+    }
+}
+
+Bounds Bounds::infinite()
+{
+    Bounds bounds;
+    bounds.type = Infinite;
+    return bounds;
+}
+
+void Bounds::extend(const float *point)
+{
+    if (type == Infinite)
+        return;
+    if (type == Empty) {
+        type = Finite;
+        for (int i = 0; i < 3; ++i) {
+            minimum[i] = maximum[i] = center[i] = point[i];
+        }
+        radius = 0;
+        return;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (point[i] < minimum[i])
+            minimum[i] = point[i];
+        if (point[i] > maximum[i])
+            maximum[i] = point[i];
+    }
+    // grow the sphere just enough to touch the point
+    float distance = distance_point_to_point(center, point);
+    if (distance > radius) {
+        float grow = (distance - radius) / 2;
+        for (int i = 0; i < 3; ++i)
+            center[i] += (point[i] - center[i]) * (grow / distance);
+        radius += grow;
+    }
+}
+
+void Bounds::merge(const Bounds &other)
+{
+    if (type == Infinite || other.type == Empty)
+        return;
+    if (type == Empty || other.type == Infinite) {
+        *this = other;
+        return;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (other.minimum[i] < minimum[i])
+            minimum[i] = other.minimum[i];
+        if (other.maximum[i] > maximum[i])
+            maximum[i] = other.maximum[i];
+    }
+    float distance = distance_point_to_point(center, other.center);
+    if (distance + other.radius <= radius)
+        return;
+    if (distance + radius <= other.radius) {
+        memcpy(center, other.center, sizeof(center));
+        radius = other.radius;
+        return;
+    }
+    float merged_radius = (distance + radius + other.radius) / 2;
+    for (int i = 0; i < 3; ++i)
+        center[i] += (other.center[i] - center[i]) * ((merged_radius - radius) / distance);
+    radius = merged_radius;
+}
+
+Bounds Bounds::transformed(const float *m) const
+{
+    if (type != Finite)
+        return *this;
+    Bounds bounds;
+    bounds.type = Finite;
+    // transform the box by its center and extents
+    for (int i = 0; i < 3; ++i) {
+        float box_center = m[12 + i];
+        float box_extent = 0;
+        for (int j = 0; j < 3; ++j) {
+            box_center += m[j * 4 + i] * (minimum[j] + maximum[j]) / 2;
+            box_extent += fabsf(m[j * 4 + i]) * (maximum[j] - minimum[j]) / 2;
+        }
+        bounds.minimum[i] = box_center - box_extent;
+        bounds.maximum[i] = box_center + box_extent;
+        bounds.center[i] = m[12 + i] + m[i] * center[0] + m[4 + i] * center[1] + m[8 + i] * center[2];
+    }
+    float scale = 0;
+    for (int j = 0; j < 3; ++j) {
+        float length = distance_point_to_origin(m[j * 4], m[j * 4 + 1], m[j * 4 + 2]);
+        if (length > scale)
+            scale = length;
+    }
+    bounds.radius = radius * scale;
+    return bounds;
+}
+
+// State
+
+static QAtomicInt matrix_versions(0);
+
 State::State()
+    : m_matrices(0),
+      m_matrix_top(0),
+      m_matrix_capacity(0),
+      m_matrix_allocations(0),
+      m_projection_version(~0u),
+      m_queue(0),
+      m_depth(0),
+      m_culling(false),
+      m_inside(false),
+      m_culled(0),
+      m_prepared_frame(0),
+      m_frame_buffer(0),
+      m_frame_projection_version(~0u),
+      m_frame_view_version(~0u),
+      m_uniform_bytes(0)
 {
+    growMatrices();
     reset();
 }
 
 State::~State()
 {
-    clearMatrices();
+    ResourceManager::instance()->release(ResourceManager::Buffer, m_frame_buffer);
+    qFreeAligned(m_matrices);
 }
 
-void State::clearMatrices()
+void State::growMatrices()
 {
-    while (!m_matrices.empty()) {
-        delete m_matrices.top();
-        m_matrices.pop();
-    }
+    const unsigned int capacity = m_matrix_capacity ? m_matrix_capacity * 2 : 32;
+    m_matrices = static_cast<float*>(qReallocAligned(m_matrices, capacity * 16 * sizeof(float),
+                                                     m_matrix_capacity * 16 * sizeof(float), 16));
+    m_matrix_capacity = capacity;
+    m_matrix_versions.resize(capacity);
+    ++m_matrix_allocations;
 }
 
 void State::reset()
 {
-    clearMatrices();
-    m_matrices.push(new float[16]);
-    memcpy(m_matrices.top(), identity_matrix, sizeof(float) * 16);
+    m_shader = 0;
+    m_matrix_top = 0;
+    memcpy(m_matrices, identity_matrix, sizeof(float) * 16);
+    m_matrix_versions[0] = 0;
     setProjectionMatrix(identity_matrix);
 }
 
 void State::execute(Node *node)
 {
-    if (node->enabled(this)) {
+    const unsigned int uniform_bytes = Rasterizer::uniformBytes();
+    if (m_depth == 0) {
+        TransformSystem::instance()->update();
+        if (m_queue)
+            m_queue->clear();
+        m_inside = false;
+        m_culled = 0;
+        updateFrameUniforms();
+    }
+    ++m_depth;
+    const bool inside = m_inside;
+    // ParallelUpdate may have culled and updated the node already
+    const bool prepared = m_prepared_frame != 0 && node->m_prepared_frame == m_prepared_frame;
+    Visibility visibility = prepared ? Visibility(node->m_prepared_visibility)
+                                     : m_culling && !inside ? classify(node->bounds()) : Inside;
+    if (visibility == Outside) {
+        ++m_culled;
+        // animations may bring it back into view
+        updateCulled(node);
+    } else if (node->enabled(this)) {
+        // everything below a node that is completely inside is inside as well
+        m_inside = visibility == Inside;
         node->prepare(this);
-        node->update(this);
+        if (!prepared)
+            node->update(this);
         node->execute(this);
         if (node->visible(this)) {
-            std::list<Node*>::const_iterator it = node->m_children.begin();
-            for (; it != node->m_children.end(); ++it)
-                execute(*it);
+            for (Node *child = node->m_first_child; child; child = child->m_next_sibling)
+                execute(child);
         }
         node->cleanup(this);
+        m_inside = inside;
+    }
+    --m_depth;
+    if (m_depth == 0) {
+        if (m_queue) {
+            m_queue->sort();
+            m_queue->submit(this);
+        }
+        // leave no vertex array bound for code outside the scene graph
+        if (Rasterizer::hasVertexArrayObjects())
+            Rasterizer::glBindVertexArray(0);
+        m_prepared_frame = 0;
+        m_uniform_bytes = Rasterizer::uniformBytes() - uniform_bytes;
+        // the names released during the frame are deleted or recycled in one go
+        ResourceManager::instance()->collect();
+    }
+}
+
+void State::updateCulled(Node *node)
+{
+    if (!node->enabled(this))
+        return;
+    if (m_prepared_frame == 0 || node->m_prepared_frame != m_prepared_frame)
+        node->update(this);
+    if (node->visible(this)) {
+        for (Node *child = node->m_first_child; child; child = child->m_next_sibling)
+            updateCulled(child);
     }
 }
 
 void State::pushMatrix()
 {
-    float *matrix = new float[16];
-    memcpy(matrix, m_matrices.top(), sizeof(float) * 16);
-    m_matrices.push(matrix);
+    if (m_matrix_top + 1 == m_matrix_capacity)
+        growMatrices();
+    float *top = m_matrices + m_matrix_top * 16;
+    memcpy(top + 16, top, sizeof(float) * 16);
+    m_matrix_versions[m_matrix_top + 1] = m_matrix_versions[m_matrix_top];
+    ++m_matrix_top;
 }
 
 void State::pushIdentityMatrix()
 {
-    float *matrix = new float[16];
-    memcpy(matrix, identity_matrix, sizeof(float) * 16);
-    m_matrices.push(matrix);
+    if (m_matrix_top + 1 == m_matrix_capacity)
+        growMatrices();
+    ++m_matrix_top;
+    memcpy(m_matrices + m_matrix_top * 16, identity_matrix, sizeof(float) * 16);
+    m_matrix_versions[m_matrix_top] = 0;
+    m_frustum_valid = false;
 }
 
 void State::multiplyMatrix(const float *matrix)
 {
-    static float result[16];
-    multiply_matrices(m_matrices.top(), matrix, result);
-    memcpy(m_matrices.top(), result, sizeof(float) * 16);
+    float *top = m_matrices + m_matrix_top * 16;
+    float result[16];
+    math_kernels().multiply_matrices(top, matrix, result);
+    memcpy(top, result, sizeof(float) * 16);
+    m_matrix_versions[m_matrix_top] = createMatrixVersion();
+    m_frustum_valid = false;
+}
+
+void State::loadMatrix(const float *matrix, unsigned int version)
+{
+    memcpy(m_matrices + m_matrix_top * 16, matrix, sizeof(float) * 16);
+    m_matrix_versions[m_matrix_top] = version;
+    m_frustum_valid = false;
 }
 
 void State::popMatrix()
 {
-    delete m_matrices.top();
-    m_matrices.pop();
+    if (m_matrix_top > 0)
+        --m_matrix_top;
+    m_frustum_valid = false;
 }
 
 const float *State::currentMatrix()
 {
-    return m_matrices.top();
+    return m_matrices + m_matrix_top * 16;
+}
+
+unsigned int State::matrixAllocations() const
+{
+    return m_matrix_allocations;
+}
+
+unsigned int State::matrixVersion() const
+{
+    return m_matrix_versions[m_matrix_top];
+}
+
+unsigned int State::projectionVersion() const
+{
+    return m_projection_version;
+}
+
+unsigned int State::createMatrixVersion()
+{
+    return createMatrixVersions(1);
+}
+
+unsigned int State::createMatrixVersions(unsigned int count)
+{
+    // shared by all states, so versions from different states never collide;
+    // skip ranges that wrap around or touch the reserved 0 and ~0
+    for (;;) {
+        const unsigned int first = matrix_versions.fetchAndAddRelaxed(count) + 1;
+        const unsigned int last = first + count - 1;
+        if (first != 0 && last >= first && last != ~0u)
+            return first;
+    }
 }
 
 void State::setOrtographicProjection(float left, float right,
@@ -136,7 +374,12 @@ void State::setPerspectiveProjectionEx(float aspect, float fov_y,
 
 void State::setProjectionMatrix(const float *matrix)
 {
+    // setting the same projection every frame keeps the cached MVPs
+    if (m_projection_version != ~0u && memcmp(m_projection_matrix, matrix, sizeof(float) * 16) == 0)
+        return;
     memcpy(m_projection_matrix, matrix, sizeof(float) * 16);
+    m_projection_version = createMatrixVersion();
+    m_frustum_valid = false;
 }
 
 const float *State::projectionMatrix()
@@ -144,24 +387,236 @@ const float *State::projectionMatrix()
     return State::m_projection_matrix;
 }
 
+void State::setCurrentShader(Shader *shader)
+{
+    m_shader = shader;
+}
+
+Shader *State::currentShader() const
+{
+    return m_shader;
+}
+
+void State::setRenderQueue(RenderQueue *queue)
+{
+    m_queue = queue;
+}
+
+RenderQueue *State::renderQueue() const
+{
+    return m_queue;
+}
+
+void State::setFrustumCulling(bool enabled)
+{
+    m_culling = enabled;
+}
+
+bool State::frustumCulling() const
+{
+    return m_culling;
+}
+
+unsigned int State::culledCount() const
+{
+    return m_culled;
+}
+
+unsigned int State::uniformBytes() const
+{
+    return m_uniform_bytes;
+}
+
+void State::updateFrameUniforms()
+{
+    if (!Rasterizer::hasUniformBuffers())
+        return;
+    if (!m_frame_buffer)
+        m_frame_buffer = ResourceManager::instance()->uploadBuffer(GL_UNIFORM_BUFFER, sizeof(float) * 32, 0, GL_DYNAMIC_DRAW);
+    // other states may have used the binding since, and it also binds GL_UNIFORM_BUFFER
+    Rasterizer::glBindBufferBase(GL_UNIFORM_BUFFER, FrameUniformBinding, m_frame_buffer);
+    const unsigned int view_version = matrixVersion();
+    if (m_frame_projection_version == m_projection_version && m_frame_view_version == view_version)
+        return;
+    float block[32];
+    memcpy(block, m_projection_matrix, sizeof(float) * 16);
+    memcpy(block + 16, currentMatrix(), sizeof(float) * 16);
+    Rasterizer::glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), block);
+    m_frame_projection_version = m_projection_version;
+    m_frame_view_version = view_version;
+}
+
+void State::updateFrustum()
+{
+    // the planes of projection * model-view are the frustum in model space
+    float m[16];
+    math_kernels().multiply_matrices(m_projection_matrix, currentMatrix(), m);
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            m_frustum[i * 2][j] = m[j * 4 + 3] + m[j * 4 + i];
+            m_frustum[i * 2 + 1][j] = m[j * 4 + 3] - m[j * 4 + i];
+        }
+    }
+    for (int i = 0; i < 6; ++i) {
+        float length = magnitude_vector(m_frustum[i]);
+        if (length > 0) {
+            for (int j = 0; j < 4; ++j)
+                m_frustum[i][j] /= length;
+        }
+    }
+    m_frustum_valid = true;
+}
+
+State::Visibility State::classify(const Bounds &bounds)
+{
+    if (bounds.type == Bounds::Infinite)
+        return Intersecting;
+    if (bounds.type == Bounds::Empty)
+        return Outside;
+    if (!m_frustum_valid)
+        updateFrustum();
+
+    // the sphere is cheap and settles most cases
+    bool intersecting = false;
+    for (int i = 0; i < 6; ++i) {
+        float distance = distance_plane_to_point(m_frustum[i], bounds.center);
+        if (distance < -bounds.radius)
+            return Outside;
+        if (distance < bounds.radius)
+            intersecting = true;
+    }
+    if (!intersecting)
+        return Inside;
+
+    // test the box corners nearest and farthest along each plane normal
+    Visibility visibility = Inside;
+    for (int i = 0; i < 6; ++i) {
+        const float *plane = m_frustum[i];
+        float positive[3];
+        float negative[3];
+        for (int j = 0; j < 3; ++j) {
+            positive[j] = plane[j] >= 0 ? bounds.maximum[j] : bounds.minimum[j];
+            negative[j] = plane[j] >= 0 ? bounds.minimum[j] : bounds.maximum[j];
+        }
+        if (distance_plane_to_point(plane, positive) < 0)
+            return Outside;
+        if (distance_plane_to_point(plane, negative) < 0)
+            visibility = Intersecting;
+    }
+    return visibility;
+}
+
 // Node
 
+int Node::transformAbove(Node *node)
+{
+    for (; node; node = node->parent()) {
+        if (Transformation *transformation = dynamic_cast<Transformation*>(node))
+            return transformation->m_transform;
+    }
+    return -1;
+}
+
 Node::Node(Node *parent)
-    : m_parent(parent)
+    : m_parent(0),
+      m_first_child(0),
+      m_last_child(0),
+      m_next_sibling(0),
+      m_previous_sibling(0),
+      m_child_count(0),
+      m_arena(0),
+      m_arena_index(0),
+      m_bounds_dirty(true),
+      m_prepared_frame(0),
+      m_prepared_visibility(0)
 {
-    if (parent)
-        parent->m_children.push_back(this);
+    // operator new only knows the memory, the node registers itself once it exists
+    SceneArena *arena = SceneArena::s_placing;
+    if (arena && reinterpret_cast<char*>(this) >= arena->m_pending
+            && reinterpret_cast<char*>(this) < arena->m_pending + arena->m_pending_size)
+        arena->adopt(this);
+    if (parent) {
+        link(parent, 0);
+        invalidate();
+    }
 }
 
 Node::~Node()
 {
-    if (m_parent)
-        m_parent->m_children.remove(this);
-    std::list<Node*>::iterator it = m_children.begin();
-    for (; it != m_children.end(); ++it) {
-        (*it)->m_parent = 0;
-        delete (*it);
+    if (m_arena) {
+        m_arena->m_nodes[m_arena_index] = 0;
+        --m_arena->m_live;
+    }
+    if (m_parent) {
+        invalidate();
+        unlink();
+    }
+    // the whole subtree goes; without a parent the children skip the unlink and the invalidate
+    Node *child = m_first_child;
+    while (child) {
+        Node *next = child->m_next_sibling;
+        child->m_parent = 0;
+        delete child;
+        child = next;
+    }
+}
+
+// every node starts with a header that tells operator delete where it came from
+union NodeHeader {
+    SceneArena *arena;
+    char padding[16];
+};
+
+void *Node::operator new(size_t size)
+{
+    NodeHeader *header = static_cast<NodeHeader*>(malloc(sizeof(NodeHeader) + size));
+    if (!header)
+        throw std::bad_alloc();
+    header->arena = 0;
+    return header + 1;
+}
+
+void *Node::operator new(size_t size, SceneArena *arena)
+{
+    if (!arena)
+        return operator new(size);
+    NodeHeader *header = static_cast<NodeHeader*>(arena->allocate(sizeof(NodeHeader) + size));
+    if (!header)
+        throw std::bad_alloc();
+    header->arena = arena;
+    arena->m_pending = reinterpret_cast<char*>(header + 1);
+    arena->m_pending_size = size;
+    SceneArena::s_placing = arena;
+    return header + 1;
+}
+
+void Node::operator delete(void *memory)
+{
+    if (!memory)
+        return;
+    NodeHeader *header = static_cast<NodeHeader*>(memory) - 1;
+    // memory in an arena is given back all at once by SceneArena::clear()
+    if (!header->arena)
+        free(header);
+}
+
+// only called when the constructor throws, before the node could adopt itself
+void Node::operator delete(void *memory, SceneArena *arena)
+{
+    if (!arena) {
+        operator delete(memory);
+        return;
     }
+    // the memory stays in the arena until clear(), but the next node must not take it for its own
+    if (SceneArena::s_placing == arena)
+        SceneArena::s_placing = 0;
+    arena->m_pending = 0;
+    arena->m_pending_size = 0;
+}
+
+SceneArena *Node::arena() const
+{
+    return m_arena;
 }
 
 Node *Node::parent() const
@@ -171,7 +626,106 @@ Node *Node::parent() const
 
 std::list<Node*> Node::children() const
 {
-    return m_children;
+    std::list<Node*> children;
+    for (Node *child = m_first_child; child; child = child->m_next_sibling)
+        children.push_back(child);
+    return children;
+}
+
+Node *Node::firstChild() const
+{
+    return m_first_child;
+}
+
+Node *Node::lastChild() const
+{
+    return m_last_child;
+}
+
+Node *Node::nextSibling() const
+{
+    return m_next_sibling;
+}
+
+Node *Node::previousSibling() const
+{
+    return m_previous_sibling;
+}
+
+unsigned int Node::childCount() const
+{
+    return m_child_count;
+}
+
+void Node::setParent(Node *parent, Node *before)
+{
+    if (before && (before->m_parent != parent || !parent)) {
+        fprintf(stderr, "Node: can not insert before a node that is not a child of the new parent\n");
+        return;
+    }
+    if (before == this || (parent && parent == m_parent && before == m_next_sibling))
+        return;
+    for (Node *node = parent; node; node = node->m_parent) {
+        if (node == this) {
+            fprintf(stderr, "Node: can not move a node into its own subtree\n");
+            return;
+        }
+    }
+
+    const bool moved = parent != m_parent;
+    if (m_parent) {
+        invalidate();
+        unlink();
+    }
+    if (parent) {
+        link(parent, before);
+        invalidate();
+    }
+    if (moved)
+        reattachTransforms(transformAbove(parent));
+}
+
+void Node::link(Node *parent, Node *before)
+{
+    m_parent = parent;
+    m_next_sibling = before;
+    m_previous_sibling = before ? before->m_previous_sibling : parent->m_last_child;
+    if (m_previous_sibling)
+        m_previous_sibling->m_next_sibling = this;
+    else
+        parent->m_first_child = this;
+    if (before)
+        before->m_previous_sibling = this;
+    else
+        parent->m_last_child = this;
+    ++parent->m_child_count;
+}
+
+void Node::unlink()
+{
+    if (m_previous_sibling)
+        m_previous_sibling->m_next_sibling = m_next_sibling;
+    else
+        m_parent->m_first_child = m_next_sibling;
+    if (m_next_sibling)
+        m_next_sibling->m_previous_sibling = m_previous_sibling;
+    else
+        m_parent->m_last_child = m_previous_sibling;
+    --m_parent->m_child_count;
+    m_parent = 0;
+    m_next_sibling = 0;
+    m_previous_sibling = 0;
+}
+
+void Node::reattachTransforms(int parent_transform)
+{
+    if (Transformation *transformation = dynamic_cast<Transformation*>(this)) {
+        // the transforms further down still hang off this one
+        TransformSystem::instance()->setParent(transformation->m_transform, parent_transform);
+        return;
+    }
+    for (Node *child = m_first_child; child; child = child->m_next_sibling)
+        child->reattachTransforms(parent_transform);
 }
 
 bool Node::enabled(State *)
@@ -200,16 +754,88 @@ void Node::update(State *)
 {
 }
 
+bool Node::concurrentUpdate() const
+{
+    // subclasses were not written with threads in mind, they have to opt in
+    const std::type_info &type = typeid(*this);
+    return type == typeid(Node) || type == typeid(Transformation) || type == typeid(Shader)
+            || type == typeid(Texture2D) || type == typeid(Blend) || type == typeid(Mesh)
+            || type == typeid(InstancedMesh);
+}
+
+void Node::compile(RenderList *list, State *state)
+{
+    // only plain grouping nodes can be flattened; subclasses may do anything in their hooks
+    if (typeid(*this) == typeid(Node))
+        compileChildren(list, state);
+    else
+        list->addNode(this);
+}
+
+void Node::compileChildren(RenderList *list, State *state)
+{
+    if (!visible(state))
+        return;
+    for (Node *child = m_first_child; child; child = child->m_next_sibling) {
+        if (child->enabled(state))
+            child->compile(list, state);
+    }
+}
+
+void Node::invalidate()
+{
+    m_bounds_dirty = true;
+    // the ancestors may be shared with other threads right now
+    if (ParallelUpdate::deferInvalidation(this))
+        return;
+    Node *child = this;
+    for (Node *node = m_parent; node; child = node, node = node->m_parent) {
+        node->m_bounds_dirty = true;
+        node->childInvalidated(child);
+    }
+}
+
+void Node::childInvalidated(Node *)
+{
+}
+
+const Bounds &Node::bounds()
+{
+    if (m_bounds_dirty) {
+        m_bounds = Bounds();
+        calculateBounds(&m_bounds);
+        m_bounds_dirty = false;
+    }
+    return m_bounds;
+}
+
+void Node::calculateBounds(Bounds *bounds)
+{
+    // we don't know what other node types draw
+    if (typeid(*this) == typeid(Node))
+        mergeChildBounds(bounds);
+    else
+        *bounds = Bounds::infinite();
+}
+
+void Node::mergeChildBounds(Bounds *bounds)
+{
+    for (Node *child = m_first_child; child && bounds->type != Bounds::Infinite; child = child->m_next_sibling)
+        bounds->merge(child->bounds());
+}
+
 // Transformation
 
 Transformation::Transformation(const float *matrix, Node *parent)
     : Node(parent)
 {
-    setMatrix(matrix);
+    m_transform = TransformSystem::instance()->create(this, transformAbove(parent), matrix ? matrix : identity_matrix);
+    invalidate();
 }
 
 Transformation::~Transformation()
 {
+    TransformSystem::instance()->destroy(m_transform);
 }
 
 void Transformation::prepare(State *state)
@@ -219,7 +845,16 @@ void Transformation::prepare(State *state)
 
 void Transformation::execute(State *state)
 {
-    state->multiplyMatrix(m_matrix);
+    // usually filled in by TransformSystem::update() already
+    TransformSystem *system = TransformSystem::instance();
+    const unsigned int parent_version = state->matrixVersion();
+    unsigned int version = 0;
+    if (const float *world = system->cachedWorldMatrix(m_transform, parent_version, &version)) {
+        state->loadMatrix(world, version);
+        return;
+    }
+    state->multiplyMatrix(system->localMatrix(m_transform));
+    system->setWorldMatrix(m_transform, state->currentMatrix(), state->matrixVersion(), parent_version);
 }
 
 void Transformation::cleanup(State *state)
@@ -227,6 +862,25 @@ void Transformation::cleanup(State *state)
     state->popMatrix();
 }
 
+void Transformation::compile(RenderList *list, State *state)
+{
+    // subclasses may animate the matrix in update()
+    if (typeid(*this) != typeid(Transformation)) {
+        list->addNode(this);
+        return;
+    }
+    list->pushMatrix(matrix());
+    compileChildren(list, state);
+    list->popMatrix();
+}
+
+void Transformation::calculateBounds(Bounds *bounds)
+{
+    Bounds children;
+    mergeChildBounds(&children);
+    *bounds = children.transformed(matrix());
+}
+
 void Transformation::translate(float dx, float dy, float dz)
 {
     const float translation_matrix[] = {
@@ -270,20 +924,33 @@ void Transformation::rotate(float vx, float vy, float vz, float radians)
 void Transformation::multiply(const float *transformation)
 {
     float transformed_matrix[16];
-    multiply_matrices(m_matrix, transformation, transformed_matrix);
+    math_kernels().multiply_matrices(matrix(), transformation, transformed_matrix);
     setMatrix(transformed_matrix);
 }
 
 float *Transformation::matrix()
 {
-    return m_matrix;
+    // only valid until the next Transformation is created
+    return TransformSystem::instance()->localMatrix(m_transform);
 }
 
 void Transformation::setMatrix(const float *matrix)
 {
     if (!matrix)
         matrix = identity_matrix;
-    memcpy(m_matrix, matrix, sizeof(float) * 16);
+    // the children see a new parent version, so only this transform is marked
+    TransformSystem::instance()->setLocalMatrix(m_transform, matrix);
+    invalidate();
+}
+
+const float *Transformation::worldMatrix() const
+{
+    return TransformSystem::instance()->worldMatrix(m_transform);
+}
+
+unsigned int Transformation::worldVersion() const
+{
+    return TransformSystem::instance()->worldVersion(m_transform);
 }
 
 // Shader
@@ -317,9 +984,24 @@ const char *Shader::default_fragment_shader =
 
 const char *Shader::projection_model_view_matrix_uniform_name = "sg_projection_model_view_matrix";
 const char *Shader::texture_sampler_uniform_name = "sg_texture_sampler";
+const char *Shader::frame_uniform_block_name = "sg_frame";
+const char *Shader::frame_uniform_block_declaration =
+        "layout(std140) uniform sg_frame\n"
+        "{\n"
+            "mat4 sg_projection_matrix;\n"
+            "mat4 sg_view_matrix;\n"
+        "};\n";
 const char *Shader::position_attribute_name = "sg_position_attribute";
 const char *Shader::normal_attribute_name = "sg_normal_attribute";
 const char *Shader::texuv_attribute_name = "sg_texuv_attribute";
+const char *Shader::color_attribute_name = "sg_color_attribute";
+const char *Shader::instance_index_attribute_name = "sg_instance_index_attribute";
+const char *Shader::instance_color_attribute_name = "sg_instance_color_attribute";
+const char *Shader::instance_texuv_offset_attribute_name = "sg_instance_texuv_offset_attribute";
+const char *Shader::instance_matrix_attribute_name = "sg_instance_matrix_attribute";
+const char *Shader::instance_matrices_uniform_name = "sg_instance_matrices";
+const char *Shader::instance_colors_uniform_name = "sg_instance_colors";
+const char *Shader::instance_texuv_offsets_uniform_name = "sg_instance_texuv_offsets";
 
 Shader::Shader(const char *vertex_source,
                const char *fragment_source,
@@ -328,25 +1010,120 @@ Shader::Shader(const char *vertex_source,
                Node *parent)
     : Node(parent),
       m_program(0),
+      m_pending_program(0),
+      m_pending_attributes(0),
       m_old_program(0),
-      m_owner(false)
+      m_old_shader(0),
+      m_owner(false),
+      m_ready(false),
+      m_uniform_values(0),
+      m_projection_model_view_handle(-1),
+      m_texture_sampler_handle(-1),
+      m_mvp_matrix_version(0),
+      m_mvp_projection_version(0),
+      m_mvp_valid(false)
 {
+    for (int i = 0; i < AttributeSlotCount; ++i)
+        m_attribute_locations[i] = -1;
+    memcpy(m_projection_model_view_matrix, identity_matrix, sizeof(m_projection_model_view_matrix));
     initialize(vertex_source, fragment_source, uniforms, attributes);
 }
 
 Shader::Shader(Shader *other, Node *parent)
     : Node(parent),
-      m_program(other ? other->m_program : 0),
+      m_program(0),
+      m_pending_program(other ? other->m_pending_program : 0),
+      m_pending_attributes(other ? other->m_pending_attributes : 0),
       m_old_program(0),
+      m_old_shader(0),
       m_uniforms(other ? other->m_uniforms : 0),
-      m_owner(false)
+      m_owner(false),
+      m_ready(other ? other->m_ready : false),
+      m_uniform_values(0),
+      m_projection_model_view_handle(-1),
+      m_texture_sampler_handle(-1),
+      m_mvp_matrix_version(0),
+      m_mvp_projection_version(0),
+      m_mvp_valid(false)
 {
+    for (int i = 0; i < AttributeSlotCount; ++i)
+        m_attribute_locations[i] = -1;
+    memcpy(m_projection_model_view_matrix, identity_matrix, sizeof(m_projection_model_view_matrix));
+    if (other)
+        borrow(other);
+    // a copy of a shader that is still linking waits for the same program
+    if (m_pending_program)
+        ProgramCache::instance()->retain(m_pending_program);
 }
 
 Shader::~Shader()
 {
     if (m_owner)
-        glDeleteProgram(m_program);
+        ProgramCache::instance()->release(m_program);
+    if (m_pending_program)
+        ProgramCache::instance()->release(m_pending_program);
+}
+
+Shader *Shader::createAsync(const char *vertex_source,
+                            const char *fragment_source,
+                            Shader *fallback,
+                            unsigned int uniforms,
+                            unsigned int attributes,
+                            Node *parent)
+{
+    Shader *shader = new Shader(static_cast<Shader*>(0), parent);
+    shader->m_uniforms = uniforms;
+    shader->m_pending_attributes = attributes;
+    shader->m_pending_program = ProgramCache::instance()->submit(vertex_source, fragment_source);
+    if (fallback)
+        shader->borrow(fallback);
+    return shader;
+}
+
+bool Shader::isReady() const
+{
+    return m_ready;
+}
+
+void Shader::borrow(const Shader *other)
+{
+    // the program and what was read from it; a reference keeps the program alive
+    if (m_owner)
+        ProgramCache::instance()->release(m_program);
+    m_program = other->m_program;
+    m_owner = m_program != 0;
+    if (m_owner)
+        ProgramCache::instance()->retain(m_program);
+    m_uniform_table = other->m_uniform_table;
+    m_uniform_values = other->m_uniform_values;
+    m_attribute_table = other->m_attribute_table;
+    for (int i = 0; i < AttributeSlotCount; ++i)
+        m_attribute_locations[i] = other->m_attribute_locations[i];
+    m_projection_model_view_handle = other->m_projection_model_view_handle;
+    m_texture_sampler_handle = other->m_texture_sampler_handle;
+}
+
+void Shader::finishPending()
+{
+    ProgramCache *cache = ProgramCache::instance();
+    const ProgramCache::Status status = cache->status(m_pending_program);
+    if (status == ProgramCache::Pending)
+        return;
+    if (status == ProgramCache::Failed) {
+        fprintf(stderr, "Shader: the program did not build, keeping the fallback\n");
+        cache->release(m_pending_program);
+        m_pending_program = 0;
+        return;
+    }
+
+    if (m_owner)
+        cache->release(m_program);
+    m_program = m_pending_program;
+    m_pending_program = 0;
+    m_owner = true;
+    m_ready = true;
+    introspect();
+    warnMissingAttributes(m_pending_attributes);
 }
 
 bool Shader::initialize(const char *vertex_source,
@@ -354,160 +1131,347 @@ bool Shader::initialize(const char *vertex_source,
                         unsigned int uniforms,
                         unsigned int attributes)
 {
-    m_owner = true;
     m_uniforms = uniforms;
+    m_program = ProgramCache::instance()->acquire(vertex_source, fragment_source);
+    m_owner = m_program != 0;
+    m_ready = m_owner;
+    if (!m_program)
+        return false;
 
-    GLint compile_ok = GL_FALSE;
-    GLint link_ok = GL_FALSE;
-    GLuint vertex_shader = 0;
-    GLuint fragment_shader = 0;
-
-    if (vertex_source) {
-       vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-       glShaderSource(vertex_shader, 1, &vertex_source, 0);
-       glCompileShader(vertex_shader);
-       glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &compile_ok);
-       if (!compile_ok) {
-           GLint logLen;
-           glGetShaderiv(vertex_shader, GL_INFO_LOG_LENGTH, &logLen);
-           if (logLen > 0) {
-               GLchar *log = (GLchar *)malloc(logLen);
-               glGetShaderInfoLog(vertex_shader, logLen, &logLen, log);
-               fprintf(stderr, "Vertex shader info log: %s\n", log);
-               free(log);
-           }
-       }
-    }
-
-    if (fragment_source) {
-       fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-       glShaderSource(fragment_shader, 1, &fragment_source, 0);
-       glCompileShader(fragment_shader);
-       glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &compile_ok);
-       if (!compile_ok) {
-         GLint logLen;
-         glGetShaderiv(fragment_shader, GL_INFO_LOG_LENGTH, &logLen);
-         if (logLen > 0) {
-             GLchar *log = (GLchar *)malloc(logLen);
-             glGetShaderInfoLog(fragment_shader, logLen, &logLen, log);
-             fprintf(stderr, "Fragment shader info log: %s\n", log);
-             free(log);
-         }
-       }
-    }
-
-    m_program = glCreateProgram();
-    glAttachShader(m_program, vertex_shader);
-    glAttachShader(m_program, fragment_shader);
-    glLinkProgram(m_program);
-    glGetProgramiv(m_program, GL_LINK_STATUS, &link_ok);
-    if (!link_ok) {
-        GLint logLen;
-        glGetProgramiv(m_program, GL_INFO_LOG_LENGTH, &logLen);
-        if (logLen > 0) {
-            GLchar *log = (GLchar *)malloc(logLen);
-            glGetProgramInfoLog(m_program, logLen, &logLen, log);
-            fprintf(stderr, "Shader program info log: %s\n", log);
-            free(log);
-        }
-    }
+    introspect();
+    warnMissingAttributes(attributes);
+    return true;
+}
 
-    glValidateProgram(m_program);
+void Shader::warnMissingAttributes(unsigned int attributes)
+{
+    if ((attributes & PositionAttribute) && m_attribute_locations[PositionSlot] == -1)
+        fprintf(stderr, "Could not bind attribute %s\n", Shader::position_attribute_name);
+    if ((attributes & NormalAttribute) && m_attribute_locations[NormalSlot] == -1)
+        fprintf(stderr, "Could not bind attribute %s\n", Shader::normal_attribute_name);
+    if ((attributes & TexuvAttribute) && m_attribute_locations[TexuvSlot] == -1)
+        fprintf(stderr, "Could not bind attribute %s\n", Shader::texuv_attribute_name);
+}
 
-    if (attributes & PositionAttribute) {
-        GLint position_attrib = glGetAttribLocation(m_program, Shader::position_attribute_name);
-        if (position_attrib == -1)
-            fprintf(stderr, "Could not bind attribute %s\n", Shader::position_attribute_name);
-    }
+void Shader::bindAttributeLocations(GLuint program)
+{
+    glBindAttribLocation(program, PositionSlot, Shader::position_attribute_name);
+    glBindAttribLocation(program, NormalSlot, Shader::normal_attribute_name);
+    glBindAttribLocation(program, TexuvSlot, Shader::texuv_attribute_name);
+    glBindAttribLocation(program, ColorSlot, Shader::color_attribute_name);
+    glBindAttribLocation(program, InstanceIndexSlot, Shader::instance_index_attribute_name);
+    glBindAttribLocation(program, InstanceColorSlot, Shader::instance_color_attribute_name);
+    glBindAttribLocation(program, InstanceTexuvOffsetSlot, Shader::instance_texuv_offset_attribute_name);
+    // the matrix takes four slots past the eight every context has
+    if (hasInstancing())
+        glBindAttribLocation(program, InstanceMatrixSlot, Shader::instance_matrix_attribute_name);
+}
 
-    if (attributes & NormalAttribute) {
-        GLint normal_attrib = glGetAttribLocation(m_program, Shader::normal_attribute_name);
-        if (normal_attrib == -1)
-            fprintf(stderr, "Could not bind attribute %s\n", Shader::normal_attribute_name);
-    }
+void Shader::bindUniformBlocks(GLuint program)
+{
+    if (!hasUniformBuffers())
+        return;
+    const GLuint frame = glGetUniformBlockIndex(program, Shader::frame_uniform_block_name);
+    if (frame != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, frame, State::FrameUniformBinding);
+}
 
-    if (attributes & TexuvAttribute) {
-        GLint texuv_attrib = glGetAttribLocation(m_program, Shader::texuv_attribute_name);
-        if (texuv_attrib == -1)
-            fprintf(stderr, "Could not bind attribute %s\n", Shader::texuv_attribute_name);
+// bytes of one element, 0 for the types setUniform*() does not cover
+static unsigned int uniform_type_size(GLenum type)
+{
+    switch (type) {
+    case GL_FLOAT: case GL_INT: case GL_BOOL: case GL_SAMPLER_2D: case GL_SAMPLER_CUBE: return 4;
+    case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2: return 8;
+    case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3: return 12;
+    case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2: return 16;
+    case GL_FLOAT_MAT3: return 36;
+    case GL_FLOAT_MAT4: return 64;
+    default: return 0;
     }
+}
 
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
-
-    if (!compile_ok || !link_ok) {
-        glDeleteProgram(m_program);
-        m_program = 0;
-        m_owner = false;
-        return false;
+void Shader::introspect()
+{
+    GLint count = 0;
+    GLint max_length = 0;
+    unsigned int offset = 0;
+    std::vector<GLchar> name;
+
+    m_uniform_table.clear();
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    name.resize(max_length + 1);
+    for (GLint i = 0; i < count; ++i) {
+        Location uniform;
+        GLsizei length = 0;
+        glGetActiveUniform(m_program, i, name.size(), &length, &uniform.size, &uniform.type, &name[0]);
+        uniform.name.assign(&name[0], length);
+        uniform.location = glGetUniformLocation(m_program, &name[0]);
+        // arrays are reported as "name[0]"; look them up by their base name
+        std::string::size_type bracket = uniform.name.find('[');
+        if (bracket != std::string::npos)
+            uniform.name.erase(bracket);
+        // members of uniform blocks have no location
+        uniform.offset = offset;
+        uniform.bytes = uniform.location < 0 ? 0 : uniform_type_size(uniform.type) * uniform.size;
+        offset += uniform.bytes;
+        m_uniform_table.push_back(uniform);
+    }
+    // every shader with the program comes up with the same layout; a new
+    // program starts out with all of its uniforms set to 0
+    m_uniform_values = ProgramCache::instance()->uniformValues(m_program);
+    if (m_uniform_values && m_uniform_values->size() < offset)
+        m_uniform_values->resize(offset, 0);
+
+    m_attribute_table.clear();
+    glGetProgramiv(m_program, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(m_program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+    name.resize(max_length + 1);
+    for (GLint i = 0; i < count; ++i) {
+        Location attribute;
+        GLsizei length = 0;
+        glGetActiveAttrib(m_program, i, name.size(), &length, &attribute.size, &attribute.type, &name[0]);
+        attribute.name.assign(&name[0], length);
+        attribute.location = glGetAttribLocation(m_program, &name[0]);
+        m_attribute_table.push_back(attribute);
     }
 
-    return true;
+    m_attribute_locations[PositionSlot] = attributeLocation(Shader::position_attribute_name);
+    m_attribute_locations[NormalSlot] = attributeLocation(Shader::normal_attribute_name);
+    m_attribute_locations[TexuvSlot] = attributeLocation(Shader::texuv_attribute_name);
+    m_attribute_locations[ColorSlot] = attributeLocation(Shader::color_attribute_name);
+    m_projection_model_view_handle = uniformHandle(Shader::projection_model_view_matrix_uniform_name);
+    m_texture_sampler_handle = uniformHandle(Shader::texture_sampler_uniform_name);
 }
 
-void Shader::prepare(State *)
+void Shader::prepare(State *state)
 {
+    poll();
     glGetIntegerv(GL_CURRENT_PROGRAM, (GLint*)&m_old_program);
+    m_old_shader = state->currentShader();
 }
 
 void Shader::execute(State *state)
 {
+    if (RenderQueue *queue = state->renderQueue()) {
+        queue->pushShader(this, updateProjectionModelView(state));
+        state->setCurrentShader(this);
+        return;
+    }
     if (m_old_program != m_program)
         glUseProgram(m_program);
-    if (m_uniforms & ProjectionModelViewUniform) {
-        float mvp_matrix[16];
-        multiply_matrices(state->projectionMatrix(), state->currentMatrix(), mvp_matrix);
-        setUniformMatrix4fv(Shader::projection_model_view_matrix_uniform_name, mvp_matrix, false);
-    }
+    state->setCurrentShader(this);
+    if (m_uniforms & ProjectionModelViewUniform)
+        setProjectionModelViewMatrix(updateProjectionModelView(state));
     if (m_uniforms & TextureSamplerUniform) {
-        setUniform1i(Shader::texture_sampler_uniform_name, /*GL_TEXTURE*/0);
+        setUniform1i(m_texture_sampler_handle, /*GL_TEXTURE*/0);
     }
 }
 
-void Shader::cleanup(State *)
+void Shader::cleanup(State *state)
 {
+    state->setCurrentShader(m_old_shader);
+    if (RenderQueue *queue = state->renderQueue()) {
+        queue->popShader();
+        return;
+    }
     if (m_old_program != m_program)
         glUseProgram(m_old_program);
 }
 
+void Shader::compile(RenderList *list, State *state)
+{
+    if (typeid(*this) != typeid(Shader)) {
+        list->addNode(this);
+        return;
+    }
+    list->pushShader(this);
+    compileChildren(list, state);
+    list->popShader();
+}
+
 bool Shader::setUniform1i(const char *name, int value)
 {
-    GLint location = glGetUniformLocation(m_program, name);
-    if (location < 0)
+    int handle = uniformHandle(name);
+    if (handle < 0)
         fprintf(stderr, "Could not transfer uniform %s\n", name);
-    else
-        glUniform1i(location, value);
-    return location >= 0;
+    return setUniform1i(handle, value);
 }
 
 bool Shader::setUniform1f(const char *name, float value)
 {
-    GLint location = glGetUniformLocation(m_program, name);
-    if (location < 0)
+    int handle = uniformHandle(name);
+    if (handle < 0)
         fprintf(stderr, "Could not transfer uniform %s\n", name);
-    else
-        glUniform1f(location, value);
-    return location >= 0;
+    return setUniform1f(handle, value);
 }
 
 bool Shader::setUniform2fv(const char *name, int count, const float *vector)
 {
-    GLint location = glGetUniformLocation(m_program, name);
-    if (location < 0)
+    int handle = uniformHandle(name);
+    if (handle < 0)
         fprintf(stderr, "Could not transfer uniform %s\n", name);
-    else
-        glUniform2fv(location, count, vector);
-    return location >= 0;
+    return setUniform2fv(handle, count, vector);
 }
 
-bool Shader::setUniformMatrix4fv(const char *name, const float *matrix, bool transpose)
+bool Shader::setUniform4fv(const char *name, int count, const float *vector)
 {
-    GLint location = glGetUniformLocation(m_program, name);
-    if (location < 0)
+    int handle = uniformHandle(name);
+    if (handle < 0)
         fprintf(stderr, "Could not transfer uniform %s\n", name);
-    else
-        glUniformMatrix4fv(location, 1, transpose, matrix);
-    return location >= 0;
+    return setUniform4fv(handle, count, vector);
+}
+
+bool Shader::setUniformMatrix4fv(const char *name, const float *matrix, bool transpose)
+{
+    int handle = uniformHandle(name);
+    if (handle < 0)
+        fprintf(stderr, "Could not transfer uniform %s\n", name);
+    return setUniformMatrix4fv(handle, matrix, transpose);
+}
+
+void Shader::setProjectionModelViewMatrix(const float *matrix)
+{
+    memcpy(m_projection_model_view_matrix, matrix, sizeof(m_projection_model_view_matrix));
+    if (m_uniforms & ProjectionModelViewUniform)
+        setUniformMatrix4fv(m_projection_model_view_handle, matrix, false);
+}
+
+const float *Shader::projectionModelViewMatrix() const
+{
+    return m_projection_model_view_matrix;
+}
+
+const float *Shader::updateProjectionModelView(State *state)
+{
+    const unsigned int matrix_version = state->matrixVersion();
+    const unsigned int projection_version = state->projectionVersion();
+    if (!m_mvp_valid || m_mvp_matrix_version != matrix_version || m_mvp_projection_version != projection_version) {
+        math_kernels().multiply_matrices(state->projectionMatrix(), state->currentMatrix(), m_mvp_matrix);
+        m_mvp_matrix_version = matrix_version;
+        m_mvp_projection_version = projection_version;
+        m_mvp_valid = true;
+    }
+    return m_mvp_matrix;
+}
+
+int Shader::uniformHandle(const char *name) const
+{
+    for (size_t i = 0; i < m_uniform_table.size(); ++i) {
+        if (m_uniform_table[i].name == name)
+            return i;
+    }
+    return -1;
+}
+
+bool Shader::setUniform1i(int handle, int value)
+{
+    if (handle < 0 || handle >= int(m_uniform_table.size()))
+        return false;
+    if (uniformChanged(handle, &value, sizeof(value)))
+        glUniform1i(m_uniform_table[handle].location, value);
+    return true;
+}
+
+bool Shader::setUniform1f(int handle, float value)
+{
+    if (handle < 0 || handle >= int(m_uniform_table.size()))
+        return false;
+    if (uniformChanged(handle, &value, sizeof(value)))
+        glUniform1f(m_uniform_table[handle].location, value);
+    return true;
+}
+
+bool Shader::setUniform2fv(int handle, int count, const float *vector)
+{
+    if (handle < 0 || handle >= int(m_uniform_table.size()))
+        return false;
+    if (uniformChanged(handle, vector, sizeof(float) * 2 * count))
+        glUniform2fv(m_uniform_table[handle].location, count, vector);
+    return true;
+}
+
+bool Shader::setUniform4fv(int handle, int count, const float *vector)
+{
+    if (handle < 0 || handle >= int(m_uniform_table.size()))
+        return false;
+    if (uniformChanged(handle, vector, sizeof(float) * 4 * count))
+        glUniform4fv(m_uniform_table[handle].location, count, vector);
+    return true;
+}
+
+bool Shader::setUniformMatrix4fv(int handle, const float *matrix, bool transpose)
+{
+    if (handle < 0 || handle >= int(m_uniform_table.size()))
+        return false;
+    // OpenGL ES 2.0 has no transpose, and the kept values are the ones the program sees
+    float transposed[16];
+    if (transpose) {
+        for (int column = 0; column < 4; ++column) {
+            for (int row = 0; row < 4; ++row)
+                transposed[column * 4 + row] = matrix[row * 4 + column];
+        }
+        matrix = transposed;
+    }
+    if (uniformChanged(handle, matrix, sizeof(float) * 16))
+        glUniformMatrix4fv(m_uniform_table[handle].location, 1, GL_FALSE, matrix);
+    return true;
+}
+
+bool Shader::setUniformMatrix4fv(int handle, int count, const float *matrices)
+{
+    if (handle < 0 || handle >= int(m_uniform_table.size()))
+        return false;
+    if (uniformChanged(handle, matrices, sizeof(float) * 16 * count))
+        glUniformMatrix4fv(m_uniform_table[handle].location, count, GL_FALSE, matrices);
+    return true;
+}
+
+bool Shader::uniformChanged(int handle, const void *value, unsigned int bytes)
+{
+    // keeps value as the one the program has; false if it had it already
+    const Location &uniform = m_uniform_table[handle];
+    if (uniform.location < 0)
+        return false;
+    if (!m_uniform_values || !uniform.bytes)
+        return true;
+    // the driver drops what goes past the end of an array
+    unsigned char *current = &(*m_uniform_values)[uniform.offset];
+    if (bytes <= uniform.bytes && memcmp(current, value, bytes) == 0)
+        return false;
+    memcpy(current, value, std::min(bytes, uniform.bytes));
+    return true;
+}
+
+int Shader::attributeSlot(Attributes attribute)
+{
+    switch (attribute) {
+    case PositionAttribute: return PositionSlot;
+    case NormalAttribute: return NormalSlot;
+    case TexuvAttribute: return TexuvSlot;
+    case ColorAttribute: return ColorSlot;
+    default: return -1;
+    }
+}
+
+GLint Shader::attributeLocation(Attributes attribute) const
+{
+    int slot = attributeSlot(attribute);
+    return slot < 0 ? -1 : m_attribute_locations[slot];
+}
+
+GLint Shader::attributeLocation(const char *name) const
+{
+    for (size_t i = 0; i < m_attribute_table.size(); ++i) {
+        if (m_attribute_table[i].name == name)
+            return m_attribute_table[i].location;
+    }
+    return -1;
+}
+
+void Shader::calculateBounds(Bounds *bounds)
+{
+    mergeChildBounds(bounds);
 }
 
 SceneGraph::Shader *Shader::createDefault(Node *parent)
@@ -522,32 +1486,190 @@ SceneGraph::Shader *Shader::createDefault(Node *parent)
 // Texture2D
 
 Texture2D::Texture2D(GLuint width, GLuint height, GLuint format, const GLvoid *bits, GLuint unit, Node *parent)
-    : Node(parent), m_id(0), m_unit(0), m_owner(false)
+    : Node(parent), m_id(0), m_unit(0), m_width(0), m_height(0), m_memory(0), m_owner(false), m_streamer(0)
 {
     initialize(width, height, format, bits, unit);
 }
 
+Texture2D::Texture2D(const Level *levels, unsigned int level_count, GLenum internal_format, GLenum format, GLenum type,
+                     GLuint unit, Node *parent)
+    : Node(parent), m_id(0), m_unit(0), m_width(0), m_height(0), m_memory(0), m_owner(false), m_streamer(0)
+{
+    initialize(levels, level_count, internal_format, format, type, unit);
+}
+
 Texture2D::Texture2D(Texture2D *other, Node *parent)
     : Node(parent),
       m_id(other ? other->m_id : 0),
       m_unit(other ? other->m_unit : 0),
-      m_owner(false)
+      m_width(other ? other->m_width : 0),
+      m_height(other ? other->m_height : 0),
+      m_memory(other ? other->m_memory : 0),
+      m_owner(other ? other->m_owner : false),
+      m_streamer(0)
 {
+    // the copy keeps the texture alive after the original is gone
+    if (m_owner)
+        ResourceManager::instance()->retain(ResourceManager::Texture, m_id);
 }
 
 Texture2D::~Texture2D()
+{
+    if (m_streamer)
+        m_streamer->cancel(this);
+    if (m_owner)
+        ResourceManager::instance()->release(ResourceManager::Texture, m_id);
+}
+
+void Texture2D::setTexture(GLuint id, bool owner, GLuint width, GLuint height, size_t memory)
 {
     if (m_owner)
-        glDeleteTextures(1, &m_id);
+        ResourceManager::instance()->release(ResourceManager::Texture, m_id);
+    m_id = id;
+    m_owner = owner;
+    m_width = width;
+    m_height = height;
+    m_memory = memory;
+    // compiled lists hold on to the id
+    invalidate();
 }
 
 bool Texture2D::initialize(GLuint width, GLuint height, GLuint format, const GLvoid *bits, GLuint unit)
 {
-    m_owner = true;
     m_unit = unit;
+    setTexture(createTexture(width, height, format, bits), true, width, height, size_t(width) * height * pixelSize(format, GL_UNSIGNED_BYTE));
+    return true;
+}
+
+bool Texture2D::initialize(const Level *levels, unsigned int level_count, GLenum internal_format, GLenum format, GLenum type, GLuint unit)
+{
+    m_unit = unit;
+    if (level_count == 0)
+        return false;
+    const bool compressed = type == 0;
+    if (compressed && !hasCompressedFormat(internal_format)) {
+        // ETC2 decoders read ETC1 as well
+        if (internal_format == GL_ETC1_RGB8_OES && hasCompressedFormat(GL_COMPRESSED_RGB8_ETC2)) {
+            internal_format = GL_COMPRESSED_RGB8_ETC2;
+        } else {
+            fprintf(stderr, "Texture2D: compressed format 0x%x is not supported\n", internal_format);
+            return false;
+        }
+    }
+
+    size_t memory = 0;
+    const size_t pixel_size = compressed ? 0 : pixelSize(format, type);
+    for (unsigned int i = 0; i < level_count; ++i) {
+        const Level &level = levels[i];
+        if (compressed) {
+            memory += level.size;
+            continue;
+        }
+        memory += size_t(level.width) * level.height * pixel_size;
+        // GL reads this much, whatever the size says
+        const size_t alignment = level.alignment > 0 ? level.alignment : 1;
+        const size_t row = size_t(level.width) * pixel_size;
+        const size_t pitch = (row + alignment - 1) / alignment * alignment;
+        if (level.bits && (level.size < 0 || size_t(level.size) < pitch * (level.height - 1) + row)) {
+            fprintf(stderr, "Texture2D: level %u is too small for %ux%u pixels\n", i, level.width, level.height);
+            return false;
+        }
+    }
+
+    bool recycled = false;
+    const GLuint id = ResourceManager::instance()->createTexture(levels[0].width, levels[0].height,
+                                                                 compressed ? internal_format : format, type,
+                                                                 level_count, memory, &recycled);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, level_count > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // a chain that stops early is only complete where the last level can be set, OpenGL (ES) 3.x
+    if (level_count > 1 && hasVertexArrayObjects())
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+
+    GLint old_alignment = 4;
+    if (!compressed)
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &old_alignment);
+    for (unsigned int i = 0; i < level_count; ++i) {
+        const Level &level = levels[i];
+        if (!compressed)
+            glPixelStorei(GL_UNPACK_ALIGNMENT, level.alignment > 0 ? level.alignment : 1);
+        if (compressed) {
+            // ETC1 has no sub image uploads
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, internal_format, level.width, level.height, 0, level.size, level.bits);
+        } else if (recycled) {
+            if (level.bits)
+                glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, level.width, level.height, format, type, level.bits);
+        } else {
+            // unsized internal formats work on every version
+            glTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0, format, type, level.bits);
+        }
+    }
+    if (!compressed)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, old_alignment);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    glGenTextures(1, &m_id);
+    setTexture(id, true, levels[0].width, levels[0].height, memory);
+    return true;
+}
+
+bool Texture2D::generateMipmaps()
+{
+    if (!m_owner || !m_id)
+        return false;
+    const bool power_of_two = (m_width & (m_width - 1)) == 0 && (m_height & (m_height - 1)) == 0;
+    if (!power_of_two && !hasVertexArrayObjects()) {
+        fprintf(stderr, "Texture2D: OpenGL ES 2.0 needs power of two sizes for mipmaps\n");
+        return false;
+    }
     glBindTexture(GL_TEXTURE_2D, m_id);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    // every level is a quarter of the one above
+    m_memory += m_memory / 3;
+    ResourceManager::instance()->setBytes(ResourceManager::Texture, m_id, m_memory);
+    return true;
+}
+
+size_t Texture2D::memoryUsage() const
+{
+    return m_memory;
+}
+
+size_t Texture2D::totalMemoryUsage()
+{
+    return ResourceManager::instance()->liveBytes(ResourceManager::Texture);
+}
+
+size_t Texture2D::pixelSize(GLenum format, GLenum type)
+{
+    switch (type) {
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+        return 2;
+    default:
+        break;
+    }
+    const size_t size = VertexFormat::typeSize(type);
+    switch (format) {
+    case GL_RGBA: return 4 * size;
+    case GL_RGB: return 3 * size;
+    case GL_LUMINANCE_ALPHA: return 2 * size;
+    default: return size; // GL_ALPHA, GL_LUMINANCE
+    }
+}
+
+GLuint Texture2D::createTexture(GLuint width, GLuint height, GLuint format, const GLvoid *bits)
+{
+    bool recycled = false;
+    const GLuint id = ResourceManager::instance()->createTexture(width, height, format, GL_UNSIGNED_BYTE, 1,
+                                                                 size_t(width) * height * pixelSize(format, GL_UNSIGNED_BYTE),
+                                                                 &recycled);
+    glBindTexture(GL_TEXTURE_2D, id);
 
 #if 1
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -557,14 +1679,13 @@ bool Texture2D::initialize(GLuint width, GLuint height, GLuint format, const GLv
 #else
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 #endif
-    /*for (unsigned int i = 0; i < images.size(); ++i) {
-        glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, images.at(i).width, images.at(i).height,
-                     0, images.at(i).format, GL_UNSIGNED_BYTE, images.at(i).bits);
-    }*/
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, format, GL_UNSIGNED_BYTE, bits);
+    if (!recycled)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, format, GL_UNSIGNED_BYTE, bits);
+    else if (bits)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, bits);
     glBindTexture(GL_TEXTURE_2D, 0);
 
-    return true;
+    return id;
 }
 
 void Texture2D::prepare(State *)
@@ -573,19 +1694,163 @@ void Texture2D::prepare(State *)
     glGetIntegerv(GL_ACTIVE_TEXTURE, (GLint *)&m_old_unit);
 }
 
-void Texture2D::execute(State *)
+void Texture2D::execute(State *state)
 {
+    if (RenderQueue *queue = state->renderQueue()) {
+        queue->pushTexture(m_unit, m_id);
+        return;
+    }
     glActiveTexture(GL_TEXTURE0 + m_unit);
     glBindTexture(GL_TEXTURE_2D, m_id);
 }
 
-void Texture2D::cleanup(State *)
+void Texture2D::cleanup(State *state)
 {
+    if (RenderQueue *queue = state->renderQueue()) {
+        queue->popTexture();
+        return;
+    }
     glActiveTexture(m_old_unit);
     glBindTexture(GL_TEXTURE_2D, m_old_id);
 }
 
-// Mesh - FIXME: should use array of structs, rather than struct of arrays
+void Texture2D::calculateBounds(Bounds *bounds)
+{
+    mergeChildBounds(bounds);
+}
+
+void Texture2D::compile(RenderList *list, State *state)
+{
+    if (typeid(*this) != typeid(Texture2D)) {
+        list->addNode(this);
+        return;
+    }
+    list->pushTexture(m_unit, m_id);
+    compileChildren(list, state);
+    list->popTexture();
+}
+
+// Blend
+
+Blend::Blend(GLenum sfactor, GLenum dfactor, Node *parent)
+    : Node(parent),
+      m_sfactor(sfactor),
+      m_dfactor(dfactor),
+      m_old_enabled(GL_FALSE),
+      m_old_sfactor(GL_ONE),
+      m_old_dfactor(GL_ZERO)
+{
+}
+
+Blend::~Blend()
+{
+}
+
+void Blend::prepare(State *)
+{
+    glGetIntegerv(GL_BLEND, &m_old_enabled);
+    glGetIntegerv(GL_BLEND_SRC_RGB, &m_old_sfactor);
+    glGetIntegerv(GL_BLEND_DST_RGB, &m_old_dfactor);
+}
+
+void Blend::execute(State *state)
+{
+    if (RenderQueue *queue = state->renderQueue()) {
+        queue->pushBlend(m_sfactor, m_dfactor);
+        return;
+    }
+    glEnable(GL_BLEND);
+    glBlendFunc(m_sfactor, m_dfactor);
+}
+
+void Blend::cleanup(State *state)
+{
+    if (RenderQueue *queue = state->renderQueue()) {
+        queue->popBlend();
+        return;
+    }
+    if (!m_old_enabled)
+        glDisable(GL_BLEND);
+    glBlendFunc(m_old_sfactor, m_old_dfactor);
+}
+
+void Blend::calculateBounds(Bounds *bounds)
+{
+    mergeChildBounds(bounds);
+}
+
+// VertexFormat
+
+VertexFormat::VertexFormat()
+    : m_stride(0)
+{
+    for (int i = 0; i < SemanticCount; ++i) {
+        m_attributes[i].size = 0;
+        m_attributes[i].type = GL_FLOAT;
+        m_attributes[i].normalized = false;
+        m_attributes[i].offset = 0;
+    }
+}
+
+VertexFormat &VertexFormat::add(Semantic semantic, GLint size, GLenum type, bool normalized)
+{
+    Attribute &attribute = m_attributes[semantic];
+    attribute.size = size;
+    attribute.type = type;
+    attribute.normalized = normalized;
+    attribute.offset = m_stride;
+    // keep every attribute 4 byte aligned
+    m_stride += (size * typeSize(type) + 3) & ~3;
+    return *this;
+}
+
+bool VertexFormat::has(Semantic semantic) const
+{
+    return m_attributes[semantic].size > 0;
+}
+
+GLint VertexFormat::size(Semantic semantic) const
+{
+    return m_attributes[semantic].size;
+}
+
+GLenum VertexFormat::type(Semantic semantic) const
+{
+    return m_attributes[semantic].type;
+}
+
+bool VertexFormat::normalized(Semantic semantic) const
+{
+    return m_attributes[semantic].normalized;
+}
+
+GLuint VertexFormat::offset(Semantic semantic) const
+{
+    return m_attributes[semantic].offset;
+}
+
+GLsizei VertexFormat::stride() const
+{
+    return m_stride;
+}
+
+GLsizei VertexFormat::typeSize(GLenum type)
+{
+    switch (type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+        return 1;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT:
+    case GL_HALF_FLOAT_OES:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+// Mesh
 
 const GLint Mesh::positionElementCount = 3;
 const GLint Mesh::positionSize = 3 * sizeof(float);
@@ -602,8 +1867,10 @@ Mesh::Mesh(GLenum mode,
            const float *texuvs, unsigned int texuvs_size,
            const unsigned int *triangles, unsigned int triangles_size,
            Node *parent)
-   : Node(parent), m_mode(0), m_elementCount(0), m_owner(false)
+   : Node(parent), m_mode(0), m_vao(0), m_elementCount(0), m_index_type(GL_UNSIGNED_INT),
+     m_quantized(false), m_byte_size(0), m_bytes_saved(0), m_retained(0)
 {
+    m_ids[VertexBuffer] = m_ids[IndexBuffer] = 0;
     initialize(mode,
                positions, positions_size,
                //normals, normals_size,
@@ -611,95 +1878,816 @@ Mesh::Mesh(GLenum mode,
                triangles, triangles_size);
 }
 
+Mesh::Mesh(GLenum mode,
+           const float *positions, unsigned int positions_size,
+           //const float *normals, unsigned int normals_size,
+           const float *texuvs, unsigned int texuvs_size,
+           const unsigned int *triangles, unsigned int triangles_size,
+           Options options,
+           Node *parent)
+   : Node(parent), m_mode(0), m_vao(0), m_elementCount(0), m_index_type(GL_UNSIGNED_INT),
+     m_quantized(false), m_byte_size(0), m_bytes_saved(0), m_retained(0)
+{
+    m_ids[VertexBuffer] = m_ids[IndexBuffer] = 0;
+    initialize(mode,
+               positions, positions_size,
+               //normals, normals_size,
+               texuvs, texuvs_size,
+               triangles, triangles_size,
+               options);
+}
+
+Mesh::Mesh(GLenum mode,
+           const VertexFormat &format,
+           const void *vertices, unsigned int vertices_size,
+           const void *indices, unsigned int indices_size,
+           GLenum index_type,
+           Node *parent)
+   : Node(parent), m_mode(0), m_vao(0), m_elementCount(0), m_index_type(GL_UNSIGNED_INT),
+     m_quantized(false), m_byte_size(0), m_bytes_saved(0), m_retained(0)
+{
+    m_ids[VertexBuffer] = m_ids[IndexBuffer] = 0;
+    initialize(mode, format, vertices, vertices_size, indices, indices_size, index_type);
+}
+
+Mesh::Mesh(GLenum mode,
+           const VertexFormat &format,
+           const void *vertices, unsigned int vertices_size,
+           const void *indices, unsigned int indices_size,
+           GLenum index_type,
+           Options options,
+           Node *parent)
+   : Node(parent), m_mode(0), m_vao(0), m_elementCount(0), m_index_type(GL_UNSIGNED_INT),
+     m_quantized(false), m_byte_size(0), m_bytes_saved(0), m_retained(0)
+{
+    m_ids[VertexBuffer] = m_ids[IndexBuffer] = 0;
+    initialize(mode, format, vertices, vertices_size, indices, indices_size, index_type, options);
+}
+
 Mesh::Mesh(Mesh *other, Node *parent)
     : Node(parent),
       m_mode(other ? other->m_mode : 0),
+      m_vao(other ? other->m_vao : 0),
       m_elementCount(other ? other->m_elementCount : 0),
-      m_owner(false)
+      m_index_type(other ? other->m_index_type : GL_UNSIGNED_INT),
+      m_quantized(other ? other->m_quantized : false),
+      m_byte_size(0),
+      m_bytes_saved(0),
+      m_retained(other ? other->m_retained : 0)
 {
+    m_ids[VertexBuffer] = m_ids[IndexBuffer] = 0;
     if (other) {
-        m_ids[0] = other->m_ids[0];
-        m_ids[1] = other->m_ids[1];
-        m_ids[2] = other->m_ids[2];
+        m_format = other->m_format;
+        m_mesh_bounds = other->m_mesh_bounds;
+        m_ids[VertexBuffer] = other->m_ids[VertexBuffer];
+        m_ids[IndexBuffer] = other->m_ids[IndexBuffer];
+        memcpy(m_dequantize_matrix, other->m_dequantize_matrix, sizeof(m_dequantize_matrix));
+        // the copy keeps the buffers alive after the original is gone
+        ResourceManager *resources = ResourceManager::instance();
+        resources->retain(ResourceManager::Buffer, m_ids[VertexBuffer]);
+        resources->retain(ResourceManager::Buffer, m_ids[IndexBuffer]);
+        resources->retain(ResourceManager::VertexArray, m_vao);
+        if (m_retained)
+            ++m_retained->references;
     }
 }
 
 Mesh::~Mesh()
 {
-    if (m_owner)
-        glDeleteBuffers(BufferCount, m_ids);
+    releaseBuffers();
+    if (m_retained && --m_retained->references == 0)
+        delete m_retained;
+}
+
+void Mesh::releaseBuffers()
+{
+    ResourceManager *resources = ResourceManager::instance();
+    resources->release(ResourceManager::VertexArray, m_vao);
+    resources->release(ResourceManager::Buffer, m_ids[VertexBuffer]);
+    resources->release(ResourceManager::Buffer, m_ids[IndexBuffer]);
+    m_vao = 0;
+    m_ids[VertexBuffer] = m_ids[IndexBuffer] = 0;
 }
 
 bool Mesh::initialize(GLenum mode,
                       const float *positions, unsigned int positions_size,
                       //const float *normals, unsigned int normals_size,
                       const float *texuvs, unsigned int texuvs_size,
-                      const unsigned int *triangles, unsigned int triangles_size)
+                      const unsigned int *triangles, unsigned int triangles_size,
+                      Options options)
+{
+    // interleave the separate arrays into one array of structs
+    const unsigned int vertex_count = positions_size / positionSize;
+    const bool has_texuvs = texuvs && texuvs_size >= vertex_count * texuvSize;
+    VertexFormat format;
+    format.add(VertexFormat::Position, positionElementCount);
+    if (has_texuvs)
+        format.add(VertexFormat::Texuv, texuvElementCount);
+
+    const unsigned int stride = format.stride() / sizeof(float);
+    std::vector<float> vertices(vertex_count * stride);
+    for (unsigned int i = 0; i < vertex_count; ++i) {
+        float *vertex = &vertices[i * stride];
+        memcpy(vertex, positions + i * positionElementCount, positionSize);
+        if (has_texuvs)
+            memcpy(vertex + positionElementCount, texuvs + i * texuvElementCount, texuvSize);
+    }
+
+    bool result = initialize(mode, format,
+                             vertices.empty() ? 0 : &vertices[0], vertices.size() * sizeof(float),
+                             triangles, triangles_size, GL_UNSIGNED_INT, options);
+    // measure against the separate arrays we were given
+    const unsigned int original_size = positions_size + (has_texuvs ? texuvs_size : 0) + triangles_size;
+    m_bytes_saved = original_size > m_byte_size ? original_size - m_byte_size : 0;
+    return result;
+}
+
+static unsigned int read_index(const void *indices, GLenum type, unsigned int i)
+{
+    switch (type) {
+    case GL_UNSIGNED_BYTE: return static_cast<const unsigned char*>(indices)[i];
+    case GL_UNSIGNED_SHORT: return static_cast<const unsigned short*>(indices)[i];
+    default: return static_cast<const unsigned int*>(indices)[i];
+    }
+}
+
+static void write_index(void *indices, GLenum type, unsigned int i, unsigned int index)
+{
+    switch (type) {
+    case GL_UNSIGNED_BYTE: static_cast<unsigned char*>(indices)[i] = index; break;
+    case GL_UNSIGNED_SHORT: static_cast<unsigned short*>(indices)[i] = index; break;
+    default: static_cast<unsigned int*>(indices)[i] = index; break;
+    }
+}
+
+bool Mesh::initialize(GLenum mode,
+                      const VertexFormat &format,
+                      const void *vertices, unsigned int vertices_size,
+                      const void *indices, unsigned int indices_size,
+                      GLenum index_type,
+                      Options options)
 {
-    m_owner = true;
     m_mode = mode;
-    m_elementCount = ((triangles_size) / sizeof(unsigned int));
+    m_format = format;
+    m_index_type = index_type;
+    m_elementCount = indices_size / VertexFormat::typeSize(index_type);
+    m_quantized = false;
+
+    const unsigned int stride = format.stride();
+    unsigned int vertex_count = stride ? vertices_size / stride : 0;
+    const unsigned int original_size = stride * vertex_count + m_elementCount * VertexFormat::typeSize(index_type);
+    const bool float_positions = format.type(VertexFormat::Position) == GL_FLOAT && format.size(VertexFormat::Position) >= 3;
+    m_mesh_bounds = vertexBounds(format, vertices, vertex_count);
+    invalidate();
+
+    // reorder the triangles for the post-transform cache, then the vertices in the order they are used
+    std::vector<char> optimized_vertices;
+    std::vector<char> optimized_indices;
+    if ((options & (OptimizeVertexCache | OptimizeOverdraw)) && mode == GL_TRIANGLES && m_elementCount >= 3 && vertex_count > 0) {
+        std::vector<unsigned int> triangles(m_elementCount);
+        bool valid = true;
+        for (unsigned int i = 0; i < m_elementCount; ++i) {
+            triangles[i] = read_index(indices, index_type, i);
+            valid = valid && triangles[i] < vertex_count;
+        }
+        if (!valid) {
+            fprintf(stderr, "mesh indices out of range, skipping optimization\n");
+        } else {
+            std::vector<unsigned int> clusters;
+            MeshOptimizer::optimizeVertexCache(&triangles[0], m_elementCount, vertex_count,
+                                               MeshOptimizer::DefaultCacheSize, &clusters);
+            if ((options & OptimizeOverdraw) && float_positions) {
+                const char *position = static_cast<const char*>(vertices) + format.offset(VertexFormat::Position);
+                MeshOptimizer::optimizeOverdraw(&triangles[0], m_elementCount,
+                                                reinterpret_cast<const float*>(position), stride / sizeof(float),
+                                                vertex_count, clusters);
+            }
+            optimized_vertices.assign(static_cast<const char*>(vertices), static_cast<const char*>(vertices) + vertex_count * stride);
+            vertex_count = MeshOptimizer::optimizeVertexFetch(&optimized_vertices[0], vertex_count, stride,
+                                                              &triangles[0], m_elementCount);
+            optimized_vertices.resize(vertex_count * stride);
+            optimized_indices.resize(indices_size);
+            for (unsigned int i = 0; i < m_elementCount; ++i)
+                write_index(&optimized_indices[0], index_type, i, triangles[i]);
+            vertices = &optimized_vertices[0];
+            vertices_size = optimized_vertices.size();
+            indices = &optimized_indices[0];
+        }
+    }
+
+    // keep the unquantized data around for StaticBatch
+    if (options & RetainVertexData) {
+        if (m_retained && --m_retained->references == 0)
+            delete m_retained;
+        m_retained = new RetainedData;
+        m_retained->references = 1;
+        m_retained->format = format;
+        m_retained->vertices.assign(static_cast<const char*>(vertices), static_cast<const char*>(vertices) + vertex_count * stride);
+        m_retained->indices.resize(m_elementCount);
+        for (unsigned int i = 0; i < m_elementCount; ++i)
+            m_retained->indices[i] = read_index(indices, index_type, i);
+    }
 
-    glGenBuffers(BufferCount, m_ids);
+    // quantize the vertices
+    std::vector<char> quantized_vertices;
+    if ((options & (QuantizePositions | HalfFloatPositions | QuantizeTexuvs)) && vertex_count > 0) {
+        quantize(format, vertices, vertex_count, options, &m_format, &quantized_vertices);
+        vertices = &quantized_vertices[0];
+        vertices_size = quantized_vertices.size();
+    }
+
+    // pick the smallest index type that can address every vertex
+    std::vector<char> compact_indices;
+    if ((options & CompactIndices) && m_elementCount > 0) {
+        GLenum compact_type = GL_UNSIGNED_INT;
+        if (vertex_count <= 0x100)
+            compact_type = GL_UNSIGNED_BYTE;
+        else if (vertex_count <= 0x10000)
+            compact_type = GL_UNSIGNED_SHORT;
+        compact_indices.resize(m_elementCount * VertexFormat::typeSize(compact_type));
+        for (unsigned int i = 0; i < m_elementCount; ++i)
+            write_index(&compact_indices[0], compact_type, i, read_index(indices, index_type, i));
+        m_index_type = compact_type;
+        indices = &compact_indices[0];
+        indices_size = compact_indices.size();
+    }
+    if (m_index_type == GL_UNSIGNED_INT && !hasElementIndexUint())
+        fprintf(stderr, "32 bit indices are not supported by this context\n");
 
-    // positions
-    glBindBuffer(GL_ARRAY_BUFFER, m_ids[PositionBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, positions_size, positions, GL_STATIC_DRAW);
+    m_byte_size = vertices_size + indices_size;
+    m_bytes_saved = original_size > m_byte_size ? original_size - m_byte_size : 0;
 
-    // normals
-    //glBindBuffer(GL_ARRAY_BUFFER, m_ids[NormalBuffer]);
-    //glBufferData(GL_ARRAY_BUFFER, normals_size, normals, GL_STATIC_DRAW);
+    upload(vertices, vertices_size, indices, indices_size);
+    return true;
+}
 
-    // texuvs
-    glBindBuffer(GL_ARRAY_BUFFER, m_ids[TexuvBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, texuvs_size, texuvs, GL_STATIC_DRAW);
+Bounds Mesh::vertexBounds(const VertexFormat &format, const void *vertices, unsigned int vertex_count)
+{
+    Bounds bounds;
+    if (format.type(VertexFormat::Position) != GL_FLOAT || format.size(VertexFormat::Position) < 3)
+        return Bounds::infinite();
+    const unsigned int stride = format.stride();
+    const char *position = static_cast<const char*>(vertices) + format.offset(VertexFormat::Position);
+    for (unsigned int i = 0; i < vertex_count; ++i)
+        bounds.extend(reinterpret_cast<const float*>(position + i * stride));
+    // tighten the sphere around the center of the box
+    if (bounds.type == Bounds::Finite) {
+        float radius = 0;
+        for (int j = 0; j < 3; ++j)
+            bounds.center[j] = (bounds.minimum[j] + bounds.maximum[j]) / 2;
+        for (unsigned int i = 0; i < vertex_count; ++i) {
+            float distance = distance_point_to_point(bounds.center, reinterpret_cast<const float*>(position + i * stride));
+            if (distance > radius)
+                radius = distance;
+        }
+        bounds.radius = radius;
+    }
+    return bounds;
+}
 
-    // triangles
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ids[TriangleBuffer]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangles_size, triangles, GL_STATIC_DRAW);
+void Mesh::upload(const void *vertices, unsigned int vertices_size, const void *indices, unsigned int indices_size)
+{
+    ResourceManager *resources = ResourceManager::instance();
+    releaseBuffers();
+
+    // uploading the indices would otherwise end up in whatever vertex array is bound
+    if (hasVertexArrayObjects())
+        glBindVertexArray(0);
+
+    m_ids[VertexBuffer] = resources->uploadBuffer(GL_ARRAY_BUFFER, vertices_size, vertices, GL_STATIC_DRAW);
+    m_ids[IndexBuffer] = resources->uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_size, indices, GL_STATIC_DRAW);
+
+    // record the attribute setup once; the built-in attributes have fixed slots in every Shader
+    if (hasVertexArrayObjects()) {
+        m_vao = resources->createVertexArray();
+        glBindVertexArray(m_vao);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ids[IndexBuffer]);
+        for (int semantic = 0; semantic < VertexFormat::SemanticCount; ++semantic) {
+            VertexFormat::Semantic s = VertexFormat::Semantic(semantic);
+            if (!m_format.has(s))
+                continue;
+            glEnableVertexAttribArray(semantic);
+            glVertexAttribPointer(semantic, m_format.size(s), m_format.type(s), m_format.normalized(s),
+                                  m_format.stride(), reinterpret_cast<const GLvoid*>(size_t(m_format.offset(s))));
+        }
+        glBindVertexArray(0);
+    }
 
     // unbind
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    return true;
 }
 
-void Mesh::execute(State *)
+void Mesh::quantize(const VertexFormat &format, const void *vertices, unsigned int vertex_count,
+                    Options options, VertexFormat *quantized_format, std::vector<char> *quantized)
+{
+    const char *source = static_cast<const char*>(vertices);
+    const unsigned int source_stride = format.stride();
+    const bool float_positions = format.type(VertexFormat::Position) == GL_FLOAT && format.size(VertexFormat::Position) >= 3;
+
+    // positions relative to the bounds; the inverse is applied through the model matrix
+    GLenum position_type = GL_FLOAT;
+    if (float_positions && m_mesh_bounds.type == Bounds::Finite) {
+        if (options & QuantizePositions)
+            position_type = GL_SHORT;
+        else if ((options & HalfFloatPositions) && halfFloatType())
+            position_type = halfFloatType();
+    }
+    float center[3];
+    float extent[3];
+    for (int j = 0; j < 3; ++j) {
+        center[j] = (m_mesh_bounds.minimum[j] + m_mesh_bounds.maximum[j]) / 2;
+        extent[j] = (m_mesh_bounds.maximum[j] - m_mesh_bounds.minimum[j]) / 2;
+        if (position_type != GL_SHORT || extent[j] <= 0)
+            extent[j] = 1;
+    }
+
+    bool quantize_texuvs = (options & QuantizeTexuvs) && format.has(VertexFormat::Texuv)
+            && format.type(VertexFormat::Texuv) == GL_FLOAT;
+    for (unsigned int i = 0; quantize_texuvs && i < vertex_count; ++i) {
+        const float *texuv = reinterpret_cast<const float*>(source + i * source_stride + format.offset(VertexFormat::Texuv));
+        for (int j = 0; j < format.size(VertexFormat::Texuv); ++j)
+            quantize_texuvs = quantize_texuvs && texuv[j] >= 0 && texuv[j] <= 1;
+    }
+
+    VertexFormat result;
+    for (int semantic = 0; semantic < VertexFormat::SemanticCount; ++semantic) {
+        VertexFormat::Semantic s = VertexFormat::Semantic(semantic);
+        if (!format.has(s))
+            continue;
+        if (s == VertexFormat::Position && position_type != GL_FLOAT)
+            result.add(s, 3, position_type, position_type == GL_SHORT);
+        else if (s == VertexFormat::Texuv && quantize_texuvs)
+            result.add(s, format.size(s), GL_UNSIGNED_SHORT, true);
+        else
+            result.add(s, format.size(s), format.type(s), format.normalized(s));
+    }
+
+    const unsigned int stride = result.stride();
+    quantized->assign(stride * vertex_count, 0);
+    for (unsigned int i = 0; i < vertex_count; ++i) {
+        const char *vertex = source + i * source_stride;
+        char *destination = &(*quantized)[i * stride];
+        for (int semantic = 0; semantic < VertexFormat::SemanticCount; ++semantic) {
+            VertexFormat::Semantic s = VertexFormat::Semantic(semantic);
+            if (!format.has(s))
+                continue;
+            const float *input = reinterpret_cast<const float*>(vertex + format.offset(s));
+            char *output = destination + result.offset(s);
+            if (s == VertexFormat::Position && position_type == GL_SHORT) {
+                for (int j = 0; j < 3; ++j)
+                    reinterpret_cast<short*>(output)[j] = short(floorf((input[j] - center[j]) / extent[j] * 32767 + 0.5f));
+            } else if (s == VertexFormat::Position && position_type != GL_FLOAT) {
+                for (int j = 0; j < 3; ++j)
+                    reinterpret_cast<unsigned short*>(output)[j] = float_to_half(input[j] - center[j]);
+            } else if (s == VertexFormat::Texuv && quantize_texuvs) {
+                for (int j = 0; j < format.size(s); ++j)
+                    reinterpret_cast<unsigned short*>(output)[j] = (unsigned short)(input[j] * 65535 + 0.5f);
+            } else {
+                memcpy(output, input, format.size(s) * VertexFormat::typeSize(format.type(s)));
+            }
+        }
+    }
+    *quantized_format = result;
+
+    m_quantized = position_type != GL_FLOAT;
+    const float dequantize_matrix[] = {
+        extent[0], 0, 0, 0,
+        0, extent[1], 0, 0,
+        0, 0, extent[2], 0,
+        center[0], center[1], center[2], 1
+    };
+    memcpy(m_dequantize_matrix, dequantize_matrix, sizeof(m_dequantize_matrix));
+}
+
+const VertexFormat &Mesh::format() const
+{
+    return m_format;
+}
+
+GLenum Mesh::indexType() const
+{
+    return m_index_type;
+}
+
+unsigned int Mesh::byteSize() const
+{
+    return m_byte_size;
+}
+
+unsigned int Mesh::bytesSaved() const
+{
+    return m_bytes_saved;
+}
+
+void Mesh::execute(State *state)
+{
+    if (RenderQueue *queue = state->renderQueue())
+        queue->addMesh(this);
+    else
+        draw(state->currentShader());
+}
+
+void Mesh::calculateBounds(Bounds *bounds)
 {
-    GLint program;
-    glGetIntegerv(GL_CURRENT_PROGRAM, (GLint*) &program);
+    *bounds = m_mesh_bounds;
+    mergeChildBounds(bounds);
+}
+
+void Mesh::compile(RenderList *list, State *state)
+{
+    if (typeid(*this) != typeid(Mesh)) {
+        list->addNode(this);
+        return;
+    }
+    list->addMesh(this);
+    compileChildren(list, state);
+}
 
-    // positions
-    GLint position_attrib = glGetAttribLocation(program, Shader::position_attribute_name);
-    glEnableVertexAttribArray(position_attrib);
-    glBindBuffer(GL_ARRAY_BUFFER, m_ids[PositionBuffer]);
-    glVertexAttribPointer(position_attrib, positionElementCount, GL_FLOAT, GL_FALSE, positionSize, 0);
+void Mesh::draw(Shader *shader)
+{
+    drawRange(shader, 0, m_elementCount);
+}
 
-    // normals
-    //GLint normal_attrib = glGetAttribLocation(program, Shader::normal_attribute_name); // FIXME: crashes on Android
-    //glEnableVertexAttribArray(normal_attrib);
-    //glBindBuffer(GL_ARRAY_BUFFER, m_ids[NormalBuffer]);
-    //glVertexAttribPointer(normal_attrib, normalElementCount, GL_FLOAT, GL_FALSE, normalSize, 0);
+void Mesh::drawRange(Shader *shader, unsigned int first, unsigned int count)
+{
+    if (!shader) {
+        // the attribute locations come from the shader, a program bound outside the tree is not used
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "Mesh: nothing is drawn without a Shader above the mesh\n");
+            warned = true;
+        }
+        return;
+    }
+    if (shader->attributeLocation(Shader::PositionAttribute) < 0)
+        return;
+    if (m_quantized && shader->m_projection_model_view_handle < 0) {
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "Mesh: quantized positions need a shader with %s\n",
+                    Shader::projection_model_view_matrix_uniform_name);
+            warned = true;
+        }
+        return;
+    }
+    const GLvoid *offset = reinterpret_cast<const GLvoid*>(size_t(first) * VertexFormat::typeSize(m_index_type));
+
+    // fold the dequantization into the model matrix for this draw
+    float projection_model_view_matrix[16];
+    if (m_quantized) {
+        float dequantized_matrix[16];
+        memcpy(projection_model_view_matrix, shader->projectionModelViewMatrix(), sizeof(projection_model_view_matrix));
+        math_kernels().multiply_matrices(projection_model_view_matrix, m_dequantize_matrix, dequantized_matrix);
+        shader->setProjectionModelViewMatrix(dequantized_matrix);
+    }
 
-    // texuvs
-    GLint texuv_attrib = glGetAttribLocation(program, Shader::texuv_attribute_name);
-    glEnableVertexAttribArray(texuv_attrib);
-    glBindBuffer(GL_ARRAY_BUFFER, m_ids[TexuvBuffer]);
-    glVertexAttribPointer(texuv_attrib, texuvElementCount, GL_FLOAT, GL_FALSE, texuvSize, 0);
+    if (m_vao) {
+        glBindVertexArray(m_vao);
+        glDrawElements(m_mode, count, m_index_type, offset);
+        if (m_quantized)
+            shader->setProjectionModelViewMatrix(projection_model_view_matrix);
+        return;
+    }
 
-    // triangles
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ids[TriangleBuffer]);
+    // plain ES 2.0: specify the attributes for every draw
+    glBindBuffer(GL_ARRAY_BUFFER, m_ids[VertexBuffer]);
+    setupAttributes(shader);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ids[IndexBuffer]);
 
     // draw
-    glDrawElements(m_mode, /*m_vertexCount*/m_elementCount, GL_UNSIGNED_INT, 0);
+    glDrawElements(m_mode, count, m_index_type, offset);
 
     // disable
-    glDisableVertexAttribArray(position_attrib);
-    //glDisableVertexAttribArray(normal_attrib);
-    glDisableVertexAttribArray(texuv_attrib);
+    disableAttributes(shader);
+    if (m_quantized)
+        shader->setProjectionModelViewMatrix(projection_model_view_matrix);
 
     // unbind
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
+
+void Mesh::setupAttributes(const Shader *shader)
+{
+    for (int semantic = 0; semantic < VertexFormat::SemanticCount; ++semantic) {
+        VertexFormat::Semantic s = VertexFormat::Semantic(semantic);
+        GLint location = shader->attributeLocation(Shader::Attributes(1 << semantic));
+        if (!m_format.has(s) || location < 0)
+            continue;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, m_format.size(s), m_format.type(s), m_format.normalized(s),
+                              m_format.stride(), reinterpret_cast<const GLvoid*>(size_t(m_format.offset(s))));
+    }
+}
+
+void Mesh::disableAttributes(const Shader *shader)
+{
+    for (int semantic = 0; semantic < VertexFormat::SemanticCount; ++semantic) {
+        GLint location = shader->attributeLocation(Shader::Attributes(1 << semantic));
+        if (m_format.has(VertexFormat::Semantic(semantic)) && location >= 0)
+            glDisableVertexAttribArray(location);
+    }
+}
+
+// InstancedMesh
+
+const char *InstancedMesh::instanced_vertex_shader =
+#ifdef GL_ES_VERSION_2_0
+        "#version 100\n"
+#endif
+        "uniform mat4 sg_projection_model_view_matrix;\n"
+        "attribute vec3 sg_position_attribute;\n"
+        "attribute vec2 sg_texuv_attribute;\n"
+        "attribute mat4 sg_instance_matrix_attribute;\n"
+        "attribute vec4 sg_instance_color_attribute;\n"
+        "attribute vec2 sg_instance_texuv_offset_attribute;\n"
+        "varying vec2 v_texuv;\n"
+        "varying vec4 v_color;\n"
+        "void main()\n"
+        "{\n"
+            "gl_Position = sg_projection_model_view_matrix * sg_instance_matrix_attribute * vec4(sg_position_attribute, 1.0);\n"
+            "v_texuv = sg_texuv_attribute + sg_instance_texuv_offset_attribute;\n"
+            "v_color = sg_instance_color_attribute;\n"
+        "}";
+const char *InstancedMesh::batched_vertex_shader =
+#ifdef GL_ES_VERSION_2_0
+        "#version 100\n"
+#endif
+        "uniform mat4 sg_projection_model_view_matrix;\n"
+        "uniform mat4 sg_instance_matrices[16];\n"
+        "uniform vec4 sg_instance_colors[16];\n"
+        "uniform vec2 sg_instance_texuv_offsets[16];\n"
+        "attribute vec3 sg_position_attribute;\n"
+        "attribute vec2 sg_texuv_attribute;\n"
+        "attribute float sg_instance_index_attribute;\n"
+        "varying vec2 v_texuv;\n"
+        "varying vec4 v_color;\n"
+        "void main()\n"
+        "{\n"
+            "int i = int(sg_instance_index_attribute);\n"
+            "gl_Position = sg_projection_model_view_matrix * sg_instance_matrices[i] * vec4(sg_position_attribute, 1.0);\n"
+            "v_texuv = sg_texuv_attribute + sg_instance_texuv_offsets[i];\n"
+            "v_color = sg_instance_colors[i];\n"
+        "}";
+const char *InstancedMesh::instance_fragment_shader =
+#ifdef GL_ES_VERSION_2_0
+        "#version 100\n"
+        "precision highp float;\n"
+        "uniform highp sampler2D sg_texture_sampler;\n"
+#else
+        "uniform sampler2D sg_texture_sampler;\n"
+#endif
+        "varying vec2 v_texuv;\n"
+        "varying vec4 v_color;\n"
+        "void main()\n"
+        "{\n"
+            "gl_FragColor = texture2D(sg_texture_sampler, v_texuv) * v_color;\n"
+        "}";
+
+InstancedMesh::InstancedMesh(GLenum mode,
+                             const VertexFormat &format,
+                             const void *vertices, unsigned int vertices_size,
+                             const void *indices, unsigned int indices_size,
+                             GLenum index_type,
+                             unsigned int instance_count,
+                             unsigned int instance_data,
+                             Node *parent)
+    : Mesh(static_cast<Mesh*>(0), parent),
+      m_instance_count(0),
+      m_instance_data(instance_data | Matrices),
+      m_instance_buffer(0),
+      m_copy_element_count(0)
+{
+    if (hasInstancing()) {
+        initialize(mode, format, vertices, vertices_size, indices, indices_size, index_type);
+        m_copy_element_count = m_elementCount;
+    } else {
+        // replicate the mesh; every copy reads its own entry of the uniform arrays
+        const unsigned int stride = format.stride();
+        const unsigned int vertex_count = stride ? vertices_size / stride : 0;
+        const unsigned int element_count = indices_size / VertexFormat::typeSize(index_type);
+        std::vector<char> batch_vertices(vertex_count * stride * BatchSize);
+        std::vector<unsigned int> batch_indices(element_count * BatchSize);
+        std::vector<float> instance_indices(vertex_count * BatchSize);
+        for (unsigned int copy = 0; copy < BatchSize; ++copy) {
+            if (vertex_count)
+                memcpy(&batch_vertices[copy * vertex_count * stride], vertices, vertex_count * stride);
+            for (unsigned int i = 0; i < element_count; ++i)
+                batch_indices[copy * element_count + i] = read_index(indices, index_type, i) + copy * vertex_count;
+            for (unsigned int v = 0; v < vertex_count; ++v)
+                instance_indices[copy * vertex_count + v] = copy;
+        }
+        initialize(mode, format,
+                   batch_vertices.empty() ? 0 : &batch_vertices[0], batch_vertices.size(),
+                   batch_indices.empty() ? 0 : &batch_indices[0], batch_indices.size() * sizeof(unsigned int),
+                   GL_UNSIGNED_INT, CompactIndices);
+        m_copy_element_count = element_count;
+
+        m_instance_buffer = ResourceManager::instance()->uploadBuffer(GL_ARRAY_BUFFER, instance_indices.size() * sizeof(float),
+                                                                      instance_indices.empty() ? 0 : &instance_indices[0],
+                                                                      GL_STATIC_DRAW);
+        if (m_vao) {
+            glBindVertexArray(m_vao);
+            glEnableVertexAttribArray(Shader::InstanceIndexSlot);
+            glVertexAttribPointer(Shader::InstanceIndexSlot, 1, GL_FLOAT, GL_FALSE, 0, 0);
+            glBindVertexArray(0);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    setInstanceCount(instance_count);
+}
+
+InstancedMesh::~InstancedMesh()
+{
+    ResourceManager::instance()->release(ResourceManager::Buffer, m_instance_buffer);
+}
+
+void InstancedMesh::draw(Shader *shader)
+{
+    if (!shader || shader->attributeLocation(Shader::PositionAttribute) < 0 || m_instance_count == 0)
+        return;
+
+    if (hasInstancing()) {
+        // streams we do not have read a constant instead
+        if (!(m_instance_data & Colors))
+            glVertexAttrib4f(Shader::InstanceColorSlot, 1, 1, 1, 1);
+        if (!(m_instance_data & TexuvOffsets))
+            glVertexAttrib4f(Shader::InstanceTexuvOffsetSlot, 0, 0, 0, 1);
+        glBindVertexArray(m_vao);
+        glDrawElementsInstanced(m_mode, m_elementCount, m_index_type, 0, m_instance_count);
+        return;
+    }
+
+    if (m_vao) {
+        glBindVertexArray(m_vao);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, m_ids[VertexBuffer]);
+        setupAttributes(shader);
+        glBindBuffer(GL_ARRAY_BUFFER, m_instance_buffer);
+        glEnableVertexAttribArray(Shader::InstanceIndexSlot);
+        glVertexAttribPointer(Shader::InstanceIndexSlot, 1, GL_FLOAT, GL_FALSE, 0, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ids[IndexBuffer]);
+    }
+
+    const int matrices_handle = shader->uniformHandle(Shader::instance_matrices_uniform_name);
+    const int colors_handle = shader->uniformHandle(Shader::instance_colors_uniform_name);
+    const int texuv_offsets_handle = shader->uniformHandle(Shader::instance_texuv_offsets_uniform_name);
+    if (!(m_instance_data & Colors) && colors_handle >= 0) {
+        float white[BatchSize * 4];
+        for (int i = 0; i < BatchSize * 4; ++i)
+            white[i] = 1;
+        shader->setUniform4fv(colors_handle, BatchSize, white);
+    }
+    if (!(m_instance_data & TexuvOffsets) && texuv_offsets_handle >= 0) {
+        float zero[BatchSize * 2];
+        memset(zero, 0, sizeof(zero));
+        shader->setUniform2fv(texuv_offsets_handle, BatchSize, zero);
+    }
+
+    for (unsigned int first = 0; first < m_instance_count; first += BatchSize) {
+        const unsigned int count = std::min<unsigned int>(BatchSize, m_instance_count - first);
+        shader->setUniformMatrix4fv(matrices_handle, count, &m_matrices[first * 16]);
+        if (m_instance_data & Colors)
+            shader->setUniform4fv(colors_handle, count, &m_colors[first * 4]);
+        if (m_instance_data & TexuvOffsets)
+            shader->setUniform2fv(texuv_offsets_handle, count, &m_texuv_offsets[first * 2]);
+        glDrawElements(m_mode, m_copy_element_count * count, m_index_type, 0);
+    }
+
+    if (!m_vao) {
+        glDisableVertexAttribArray(Shader::InstanceIndexSlot);
+        disableAttributes(shader);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+unsigned int InstancedMesh::instanceCount() const
+{
+    return m_instance_count;
+}
+
+void InstancedMesh::setInstanceCount(unsigned int count)
+{
+    const unsigned int old_count = std::min(m_instance_count, count);
+    m_instance_count = count;
+    m_matrices.resize(count * 16);
+    for (unsigned int i = old_count; i < count; ++i)
+        memcpy(&m_matrices[i * 16], identity_matrix, sizeof(identity_matrix));
+    if (m_instance_data & Colors)
+        m_colors.resize(count * 4, 1.0f);
+    if (m_instance_data & TexuvOffsets)
+        m_texuv_offsets.resize(count * 2, 0.0f);
+    if (hasInstancing())
+        allocateInstanceBuffer();
+    invalidate();
+}
+
+void InstancedMesh::setMatrices(unsigned int first, unsigned int count, const float *matrices)
+{
+    if (first >= m_instance_count)
+        return;
+    count = std::min(count, m_instance_count - first);
+    memcpy(&m_matrices[first * 16], matrices, count * 16 * sizeof(float));
+    updateInstanceBuffer(first * 16, count * 16, matrices);
+    invalidate();
+}
+
+void InstancedMesh::setColors(unsigned int first, unsigned int count, const float *colors)
+{
+    if (!(m_instance_data & Colors) || first >= m_instance_count)
+        return;
+    count = std::min(count, m_instance_count - first);
+    memcpy(&m_colors[first * 4], colors, count * 4 * sizeof(float));
+    updateInstanceBuffer(colorsOffset() + first * 4, count * 4, colors);
+}
+
+void InstancedMesh::setTexuvOffsets(unsigned int first, unsigned int count, const float *offsets)
+{
+    if (!(m_instance_data & TexuvOffsets) || first >= m_instance_count)
+        return;
+    count = std::min(count, m_instance_count - first);
+    memcpy(&m_texuv_offsets[first * 2], offsets, count * 2 * sizeof(float));
+    updateInstanceBuffer(texuvOffsetsOffset() + first * 2, count * 2, offsets);
+}
+
+Shader *InstancedMesh::createDefaultShader(Node *parent)
+{
+    return new Shader(hasInstancing() ? instanced_vertex_shader : batched_vertex_shader,
+                      instance_fragment_shader,
+                      Shader::DefaultUniforms,
+                      Shader::DefaultAttributes,
+                      parent);
+}
+
+void InstancedMesh::calculateBounds(Bounds *bounds)
+{
+    *bounds = Bounds();
+    for (unsigned int i = 0; i < m_instance_count; ++i)
+        bounds->merge(m_mesh_bounds.transformed(&m_matrices[i * 16]));
+    mergeChildBounds(bounds);
+}
+
+void InstancedMesh::allocateInstanceBuffer()
+{
+    // matrices, colors and texuv offsets, one block after the other
+    const size_t size = m_matrices.size() + m_colors.size() + m_texuv_offsets.size();
+    ResourceManager *resources = ResourceManager::instance();
+    if (!m_instance_buffer)
+        m_instance_buffer = resources->createBuffer(0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, size * sizeof(float), 0, GL_DYNAMIC_DRAW);
+    resources->setBytes(ResourceManager::Buffer, m_instance_buffer, size * sizeof(float));
+    if (!m_matrices.empty())
+        glBufferSubData(GL_ARRAY_BUFFER, 0, m_matrices.size() * sizeof(float), &m_matrices[0]);
+    if (!m_colors.empty())
+        glBufferSubData(GL_ARRAY_BUFFER, colorsOffset() * sizeof(float), m_colors.size() * sizeof(float), &m_colors[0]);
+    if (!m_texuv_offsets.empty())
+        glBufferSubData(GL_ARRAY_BUFFER, texuvOffsetsOffset() * sizeof(float), m_texuv_offsets.size() * sizeof(float), &m_texuv_offsets[0]);
+
+    // the block offsets depend on the instance count, so record them again
+    glBindVertexArray(m_vao);
+    for (GLuint column = 0; column < 4; ++column) {
+        const GLuint slot = Shader::InstanceMatrixSlot + column;
+        glEnableVertexAttribArray(slot);
+        glVertexAttribPointer(slot, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float),
+                              reinterpret_cast<const GLvoid*>(column * 4 * sizeof(float)));
+        glVertexAttribDivisor(slot, 1);
+    }
+    if (m_instance_data & Colors) {
+        glEnableVertexAttribArray(Shader::InstanceColorSlot);
+        glVertexAttribPointer(Shader::InstanceColorSlot, 4, GL_FLOAT, GL_FALSE, 0,
+                              reinterpret_cast<const GLvoid*>(colorsOffset() * sizeof(float)));
+        glVertexAttribDivisor(Shader::InstanceColorSlot, 1);
+    }
+    if (m_instance_data & TexuvOffsets) {
+        glEnableVertexAttribArray(Shader::InstanceTexuvOffsetSlot);
+        glVertexAttribPointer(Shader::InstanceTexuvOffsetSlot, 2, GL_FLOAT, GL_FALSE, 0,
+                              reinterpret_cast<const GLvoid*>(texuvOffsetsOffset() * sizeof(float)));
+        glVertexAttribDivisor(Shader::InstanceTexuvOffsetSlot, 1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstancedMesh::updateInstanceBuffer(size_t offset, size_t count, const float *data)
+{
+    // the batched path uploads from the copies at draw time
+    if (!hasInstancing() || count == 0)
+        return;
+    glBindBuffer(GL_ARRAY_BUFFER, m_instance_buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(float), count * sizeof(float), data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+size_t InstancedMesh::colorsOffset() const
+{
+    return m_matrices.size();
+}
+
+size_t InstancedMesh::texuvOffsetsOffset() const
+{
+    return m_matrices.size() + m_colors.size();
+}
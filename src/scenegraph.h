@@ -9,16 +9,50 @@
 #define SCENEGRAPH_H
 
 #include <list>
-#include <stack>
+#include <string>
+#include <vector>
 
 #include "rasterizer.h"
 
 namespace SceneGraph {
 
     class Node;
+    class Shader;
+    class RenderList;
+    class RenderQueue;
+    class InstancedMesh;
+    class StaticBatch;
+    class ParallelUpdate;
+    class SceneArena;
+    class TextureStreamer;
+    class TextureAtlas;
+    class KtxLoader;
+    class MeshFile;
+    class ProgramCache;
+
+    // Axis aligned box and sphere around the content of a subtree. Nodes whose
+    // content is not known report infinite bounds and are never culled.
+    struct Bounds
+    {
+        enum Type { Empty, Finite, Infinite };
+
+        Bounds();
+        static Bounds infinite();
+
+        void extend(const float *point);
+        void merge(const Bounds &other);
+        Bounds transformed(const float *matrix) const;
+
+        Type type;
+        float minimum[3];
+        float maximum[3];
+        float center[3];
+        float radius;
+    };
 
     class State
     {
+        friend class ParallelUpdate;
     public:
         State();
         ~State();
@@ -27,12 +61,21 @@ namespace SceneGraph {
         void reset();
         void execute(Node *node);
 
-        // matrix stack
+        // matrix stack, valid until the next push
         void pushMatrix();
         void pushIdentityMatrix();
         void multiplyMatrix(const float *matrix);
+        void loadMatrix(const float *matrix, unsigned int version);
         void popMatrix();
         const float *currentMatrix();
+        unsigned int matrixAllocations() const; // times the stack had to grow
+
+        // every distinct matrix on the stack and every projection gets a version;
+        // equal versions mean equal matrices, 0 is the identity
+        unsigned int matrixVersion() const;
+        unsigned int projectionVersion() const;
+        static unsigned int createMatrixVersion();
+        static unsigned int createMatrixVersions(unsigned int count); // the first of count in a row
 
         // projection
         void setOrtographicProjection(float left, float right,
@@ -48,23 +91,89 @@ namespace SceneGraph {
         void setProjectionMatrix(const float *matrix);
         const float *projectionMatrix();
 
+        // shader
+        void setCurrentShader(Shader *shader);
+        Shader *currentShader() const;
+
+        // render queue, filled during traversal and submitted when the outermost execute returns
+        void setRenderQueue(RenderQueue *queue);
+        RenderQueue *renderQueue() const;
+
+        // frustum culling, tests bounds in the space of the current matrix;
+        // a culled subtree still has update() called, but is not drawn
+        enum Visibility { Outside, Intersecting, Inside };
+        void setFrustumCulling(bool enabled);
+        bool frustumCulling() const;
+        Visibility classify(const Bounds &bounds);
+        unsigned int culledCount() const;
+
+        // the projection and the matrix the outermost execute starts with, for
+        // programs that declare Shader::frame_uniform_block_declaration; the
+        // block is only written when either changes. OpenGL 3.1 / ES 3.0 only
+        enum { FrameUniformBinding = 0 };
+        unsigned int uniformBytes() const; // uploaded by the last execute, see Rasterizer::uniformBytes()
+
     private:
-        void clearMatrices();
+        void growMatrices();
+        void updateFrustum();
+        void updateFrameUniforms();
+        void updateCulled(Node *node);
 
     private:
-        std::stack<float*> m_matrices;
+        // one contiguous, 16 byte aligned block; grows geometrically and is kept between frames
+        float *m_matrices;
+        std::vector<unsigned int> m_matrix_versions;
+        unsigned int m_matrix_top;
+        unsigned int m_matrix_capacity;
+        unsigned int m_matrix_allocations;
         float m_projection_matrix[16];
+        unsigned int m_projection_version;
+        Shader *m_shader;
+        RenderQueue *m_queue;
+        unsigned int m_depth;
+        float m_frustum[6][4];
+        bool m_frustum_valid;
+        bool m_culling;
+        bool m_inside;
+        unsigned int m_culled;
+        unsigned int m_prepared_frame; // set by ParallelUpdate for the next execute
+        GLuint m_frame_buffer;
+        unsigned int m_frame_projection_version;
+        unsigned int m_frame_view_version;
+        unsigned int m_uniform_bytes;
     };
 
     class Node : protected Rasterizer
     {
         friend class State;
+        friend class RenderList;
+        friend class StaticBatch;
+        friend class ParallelUpdate;
+        friend class SceneArena;
     public:
         Node(Node *parent = 0);
         virtual ~Node();
 
+        // new (arena) Node(...) places the node in a SceneArena
+        static void *operator new(size_t size);
+        static void *operator new(size_t size, SceneArena *arena);
+        static void operator delete(void *memory);
+        static void operator delete(void *memory, SceneArena *arena);
+        SceneArena *arena() const;
+
         Node *parent() const;
-        std::list<Node*> children() const;
+        std::list<Node*> children() const; // a copy; walk the siblings below instead
+
+        // the children are linked through their siblings, none of these allocate
+        Node *firstChild() const;
+        Node *lastChild() const;
+        Node *nextSibling() const;
+        Node *previousSibling() const;
+        unsigned int childCount() const;
+
+        // moves the node and its subtree in front of before, or to the end
+        // of the children of parent; 0 detaches it from the tree
+        void setParent(Node *parent, Node *before = 0);
 
         virtual bool enabled(State *state);
         virtual void prepare(State *state);
@@ -73,16 +182,55 @@ namespace SceneGraph {
         virtual void cleanup(State *state);
         virtual void update(State *state);
 
+        // true if update(), enabled() and visible() may run on a worker
+        // thread, see ParallelUpdate; only the built-in node types say so,
+        // override and return true once update() makes no GL calls and
+        // changes nothing outside this subtree
+        virtual bool concurrentUpdate() const;
+
+        // compiled mode, see RenderList
+        virtual void compile(RenderList *list, State *state);
+        void invalidate();
+
+        // bounds of the subtree, in the space the node is executed in
+        const Bounds &bounds();
+
    protected:
+        void compileChildren(RenderList *list, State *state);
+        virtual void childInvalidated(Node *child);
+        virtual void calculateBounds(Bounds *bounds);
+        void mergeChildBounds(Bounds *bounds);
+
+        // index of the nearest Transformation at or above node, or -1
+        static int transformAbove(Node *node);
+
         Rasterizer *m_rasterizer;
 
     private:
+        void link(Node *parent, Node *before);
+        void unlink();
+        void reattachTransforms(int parent_transform);
+
         Node *m_parent;
-        std::list<Node*> m_children;
+        Node *m_first_child;
+        Node *m_last_child;
+        Node *m_next_sibling;
+        Node *m_previous_sibling;
+        unsigned int m_child_count;
+        SceneArena *m_arena;
+        unsigned int m_arena_index;
+        Bounds m_bounds;
+        bool m_bounds_dirty;
+        unsigned int m_prepared_frame;
+        unsigned char m_prepared_visibility;
     };
 
+    // A handle into the TransformSystem, which holds the matrices
     class Transformation : public Node
     {
+        friend class Node;
+        friend class StaticBatch;
+        friend class TransformSystem;
     public:
         Transformation(const float *matrix, Node *parent = 0);
         ~Transformation();
@@ -90,12 +238,18 @@ namespace SceneGraph {
         void prepare(State *state);
         void execute(State *state);
         void cleanup(State *state);
+        void compile(RenderList *list, State *state);
 
         void scale(float sx, float sy, float sz);
         void translate(float dx, float dy, float dz);
         void rotate(float vx, float vy, float vz, float radians);
 
+        // local matrix times the matrices above it, as of the last traversal
+        const float *worldMatrix() const;
+        unsigned int worldVersion() const;
+
     protected:
+        void calculateBounds(Bounds *bounds);
         void multiply(const float *transformation);
 
         float *matrix();
@@ -104,14 +258,20 @@ namespace SceneGraph {
         static void create_rotation_matrix(float vx, float vy, float vz, float radians, float *destination);
 
     private:
-        float m_matrix[16];
+        unsigned int m_transform; // index in the TransformSystem, changes on compaction
     };
 
     class Shader : public Node
     {
+        friend class RenderList;
+        friend class RenderQueue;
+        friend class Mesh;
+        friend class InstancedMesh;
+        friend class StaticBatch;
+        friend class ProgramCache;
     public:
         enum Uniforms { ProjectionModelViewUniform = 1, TextureSamplerUniform = 2, DefaultUniforms = 3 };
-        enum Attributes { PositionAttribute = 1, NormalAttribute = 2, TexuvAttribute = 4, DefaultAttributes = 5 };
+        enum Attributes { PositionAttribute = 1, NormalAttribute = 2, TexuvAttribute = 4, ColorAttribute = 8, DefaultAttributes = 5 };
 
         Shader(const char *vertex_source = default_vertex_shader,
                const char *fragment_source = default_fragment_shader,
@@ -121,22 +281,64 @@ namespace SceneGraph {
         Shader(Shader *other, Node *parent = 0);
         ~Shader();
 
+        // compiled and linked without waiting; until the program is ready the
+        // shader draws with the program of fallback, which should be ready itself
+        static Shader *createAsync(const char *vertex_source,
+                                   const char *fragment_source,
+                                   Shader *fallback,
+                                   unsigned int uniforms = DefaultUniforms,
+                                   unsigned int attributes = DefaultAttributes,
+                                   Node *parent = 0);
+        bool isReady() const; // false while the fallback is used, also for good if the program fails
+
         void prepare(State *state);
         void execute(State *state);
         void cleanup(State *state);
+        void compile(RenderList *list, State *state);
 
         bool setUniform1i(const char *name, int value);
         bool setUniform1f(const char *name, float value);
         bool setUniform2fv(const char *name, int count, const float *vector);
+        bool setUniform4fv(const char *name, int count, const float *vector);
         bool setUniformMatrix4fv(const char *name, const float *matrix, bool transpose = false);
 
+        // handles are resolved once from the link-time location table; values
+        // the program already has are not uploaded again, also when another
+        // shader with the same program gave them
+        int uniformHandle(const char *name) const;
+        bool setUniform1i(int handle, int value);
+        bool setUniform1f(int handle, float value);
+        bool setUniform2fv(int handle, int count, const float *vector);
+        bool setUniform4fv(int handle, int count, const float *vector);
+        bool setUniformMatrix4fv(int handle, const float *matrix, bool transpose = false);
+        bool setUniformMatrix4fv(int handle, int count, const float *matrices);
+
+        GLint attributeLocation(Attributes attribute) const;
+        GLint attributeLocation(const char *name) const;
+
+        // the last projection * model-view matrix given to the program
+        void setProjectionModelViewMatrix(const float *matrix);
+        const float *projectionModelViewMatrix() const;
+
         static const char *default_vertex_shader;
         static const char *default_fragment_shader;
         static const char *projection_model_view_matrix_uniform_name;
         static const char *texture_sampler_uniform_name;
+        static const char *frame_uniform_block_name;
+        static const char *frame_uniform_block_declaration; // GLSL 1.40 / ES 3.00, see State::FrameUniformBinding
         static const char *position_attribute_name;
         static const char *normal_attribute_name;
         static const char *texuv_attribute_name;
+        static const char *color_attribute_name;
+
+        // per-instance data, see InstancedMesh
+        static const char *instance_index_attribute_name;
+        static const char *instance_color_attribute_name;
+        static const char *instance_texuv_offset_attribute_name;
+        static const char *instance_matrix_attribute_name;
+        static const char *instance_matrices_uniform_name;
+        static const char *instance_colors_uniform_name;
+        static const char *instance_texuv_offsets_uniform_name;
 
         static Shader *createDefault(Node *parent = 0); // FIXME
 
@@ -145,58 +347,258 @@ namespace SceneGraph {
                         const char *fragment_source,
                         unsigned int uniforms,
                         unsigned int attributes);
+        void introspect();
+        void calculateBounds(Bounds *bounds);
 
     private:
+        struct Location {
+            std::string name;
+            GLint location;
+            GLenum type;
+            GLint size;
+            unsigned int offset; // in the uniform values of the program
+            unsigned int bytes;  // 0 if the value is not kept
+        };
+
+        // the built-in attributes are bound to fixed slots, matching VertexFormat::Semantic
+        enum { PositionSlot = 0, NormalSlot, TexuvSlot, ColorSlot, AttributeSlotCount };
+        enum { InstanceIndexSlot = AttributeSlotCount, InstanceColorSlot, InstanceTexuvOffsetSlot, InstanceMatrixSlot };
+        static int attributeSlot(Attributes attribute);
+        static void bindAttributeLocations(GLuint program); // before linking
+        static void bindUniformBlocks(GLuint program); // after linking
+        bool uniformChanged(int handle, const void *value, unsigned int bytes);
+        void borrow(const Shader *other);
+        void warnMissingAttributes(unsigned int attributes);
+        void poll() { if (m_pending_program) finishPending(); }
+        void finishPending();
+        const float *updateProjectionModelView(State *state);
+
         GLuint m_program;
+        GLuint m_pending_program; // still linking, m_program belongs to the fallback meanwhile
+        unsigned int m_pending_attributes;
         GLuint m_old_program;
+        Shader *m_old_shader;
         unsigned int m_uniforms;
         bool m_owner;
+        bool m_ready;
+
+        std::vector<Location> m_uniform_table;
+        std::vector<unsigned char> *m_uniform_values; // shared by every shader with the program, see ProgramCache
+        std::vector<Location> m_attribute_table;
+        GLint m_attribute_locations[AttributeSlotCount];
+        int m_projection_model_view_handle;
+        int m_texture_sampler_handle;
+        float m_projection_model_view_matrix[16];
+        // projection * model-view, recomputed when either version changes
+        float m_mvp_matrix[16];
+        unsigned int m_mvp_matrix_version;
+        unsigned int m_mvp_projection_version;
+        bool m_mvp_valid;
     };
 
     class Texture2D : public Node
     {
+        friend class StaticBatch;
+        friend class TextureStreamer;
+        friend class TextureAtlas;
+        friend class KtxLoader;
     public:
+        // one level of a mip chain; size is the number of bytes at bits, and
+        // uncompressed rows start on multiples of alignment, 1, 2, 4 or 8 as
+        // for GL_UNPACK_ALIGNMENT
+        struct Level {
+            GLuint width;
+            GLuint height;
+            const GLvoid *bits;
+            GLsizei size;
+            GLint alignment;
+        };
+
         Texture2D(GLuint width, GLuint height, GLuint format, const GLvoid *bits, GLuint unit = 0, Node *parent = 0);
+        // level 0 first; compressed internal formats are passed with type 0
+        Texture2D(const Level *levels, unsigned int level_count, GLenum internal_format, GLenum format, GLenum type,
+                  GLuint unit = 0, Node *parent = 0);
         Texture2D(Texture2D *other, Node *parent = 0);
         ~Texture2D();
 
         void prepare(State *state);
         void execute(State *state);
         void cleanup(State *state);
+        void compile(RenderList *list, State *state);
+
+        // fills in the levels below level 0 and turns on trilinear filtering
+        bool generateMipmaps();
+
+        // expected video memory of the texture, and of all the live textures, see ResourceManager
+        size_t memoryUsage() const;
+        static size_t totalMemoryUsage();
 
     protected:
         bool initialize(GLuint width, GLuint height, GLuint format, const GLvoid *bits, GLuint unit = 0);
+        bool initialize(const Level *levels, unsigned int level_count, GLenum internal_format, GLenum format, GLenum type, GLuint unit = 0);
+        void calculateBounds(Bounds *bounds);
+
+        // a new RGBA texture with the parameters every Texture2D uses, with one
+        // reference in the ResourceManager; bits may be 0
+        static GLuint createTexture(GLuint width, GLuint height, GLuint format, const GLvoid *bits);
+        static size_t pixelSize(GLenum format, GLenum type);
+
+    private:
+        // owner hands a reference over to the texture, otherwise the id is only borrowed
+        void setTexture(GLuint id, bool owner, GLuint width, GLuint height, size_t memory);
 
     private:
         GLuint m_id;
         GLuint m_old_id;
         GLuint m_unit;
         GLuint m_old_unit;
-        bool m_owner;
+        GLuint m_width;
+        GLuint m_height;
+        size_t m_memory;
+        bool m_owner; // holds a reference
+        TextureStreamer *m_streamer; // while it is loading
+    };
+
+    class Blend : public Node
+    {
+    public:
+        Blend(GLenum sfactor = GL_SRC_ALPHA, GLenum dfactor = GL_ONE_MINUS_SRC_ALPHA, Node *parent = 0);
+        ~Blend();
+
+        void prepare(State *state);
+        void execute(State *state);
+        void cleanup(State *state);
+
+    protected:
+        void calculateBounds(Bounds *bounds);
+
+    private:
+        GLenum m_sfactor;
+        GLenum m_dfactor;
+        GLint m_old_enabled;
+        GLint m_old_sfactor;
+        GLint m_old_dfactor;
+    };
+
+    // Describes one interleaved vertex; attributes are laid out in the order they are added.
+    class VertexFormat
+    {
+    public:
+        enum Semantic { Position = 0, Normal, Texuv, Color, SemanticCount };
+
+        VertexFormat();
+
+        VertexFormat &add(Semantic semantic, GLint size, GLenum type = GL_FLOAT, bool normalized = false);
+
+        bool has(Semantic semantic) const;
+        GLint size(Semantic semantic) const;
+        GLenum type(Semantic semantic) const;
+        bool normalized(Semantic semantic) const;
+        GLuint offset(Semantic semantic) const;
+        GLsizei stride() const;
+
+        static GLsizei typeSize(GLenum type);
+
+    private:
+        struct Attribute {
+            GLint size;
+            GLenum type;
+            bool normalized;
+            GLuint offset;
+        };
+
+        Attribute m_attributes[SemanticCount];
+        GLsizei m_stride;
     };
 
     class Mesh : public Node
     {
+        friend class RenderQueue;
+        friend class InstancedMesh;
+        friend class StaticBatch;
+        friend class MeshFile;
     public:
+        // import time options, applied before the data is uploaded; quantized
+        // positions are scaled back through sg_projection_model_view_matrix,
+        // so those meshes are only drawn by shaders that have that uniform
+        enum Options {
+            NoOptions = 0,
+            QuantizePositions = 1,    // normalized shorts against the bounds
+            HalfFloatPositions = 2,   // half floats relative to the center of the bounds
+            QuantizeTexuvs = 4,       // normalized unsigned shorts, if all texuvs are within [0, 1]
+            CompactIndices = 8,       // 8, 16 or 32 bit indices depending on the vertex count
+            OptimizeVertexCache = 16, // reorder triangles for the vertex cache and vertices for fetching
+            OptimizeOverdraw = 32,    // also reorder clusters of triangles to reduce overdraw
+            RetainVertexData = 64     // keep a copy of the unquantized data, see StaticBatch
+        };
+
+        Mesh(GLenum mode,
+             const float *positions, unsigned int positions_size,
+             //const float *normals, unsigned int normals_size,
+             const float *texuvs, unsigned int texuvs_size,
+             const unsigned int *triangles, unsigned int triangles_size,
+             Node *parent = 0);
         Mesh(GLenum mode,
              const float *positions, unsigned int positions_size,
              //const float *normals, unsigned int normals_size,
              const float *texuvs, unsigned int texuvs_size,
              const unsigned int *triangles, unsigned int triangles_size,
+             Options options,
+             Node *parent = 0);
+        Mesh(GLenum mode,
+             const VertexFormat &format,
+             const void *vertices, unsigned int vertices_size,
+             const void *indices, unsigned int indices_size,
+             GLenum index_type = GL_UNSIGNED_INT,
+             Node *parent = 0);
+        Mesh(GLenum mode,
+             const VertexFormat &format,
+             const void *vertices, unsigned int vertices_size,
+             const void *indices, unsigned int indices_size,
+             GLenum index_type,
+             Options options,
              Node *parent = 0);
         Mesh(Mesh *other, Node *parent = 0);
         ~Mesh();
 
         void execute(State *state);
+        void compile(RenderList *list, State *state);
+
+        // with the attributes and matrix of shader; nothing is drawn without one
+        virtual void draw(Shader *shader);
+        void drawRange(Shader *shader, unsigned int first, unsigned int count);
+
+        const VertexFormat &format() const;
+        GLenum indexType() const;
+
+        // GPU memory used, and saved compared to the data the mesh was created from
+        unsigned int byteSize() const;
+        unsigned int bytesSaved() const;
 
     protected:
         bool initialize(GLenum mode,
                         const float *positions, unsigned int positions_size,
                         //const float *normals, unsigned int normals_size,
                         const float *texuvs, unsigned int texuvs_size,
-                        const unsigned int *triangles, unsigned int triangles_size);
+                        const unsigned int *triangles, unsigned int triangles_size,
+                        Options options = NoOptions);
+        bool initialize(GLenum mode,
+                        const VertexFormat &format,
+                        const void *vertices, unsigned int vertices_size,
+                        const void *indices, unsigned int indices_size,
+                        GLenum index_type,
+                        Options options = NoOptions);
+        void calculateBounds(Bounds *bounds);
 
     private:
+        static Bounds vertexBounds(const VertexFormat &format, const void *vertices, unsigned int vertex_count);
+        void upload(const void *vertices, unsigned int vertices_size, const void *indices, unsigned int indices_size);
+        void releaseBuffers();
+        void setupAttributes(const Shader *shader);
+        void disableAttributes(const Shader *shader);
+        void quantize(const VertexFormat &format, const void *vertices, unsigned int vertex_count,
+                      Options options, VertexFormat *quantized_format, std::vector<char> *quantized);
+
         static const GLint positionElementCount;
         static const GLint positionSize;
 
@@ -206,18 +608,96 @@ namespace SceneGraph {
         static const GLint texuvElementCount;
         static const GLint texuvSize;
 
+        struct RetainedData {
+            unsigned int references;
+            VertexFormat format;
+            std::vector<char> vertices;
+            std::vector<unsigned int> indices;
+        };
+
         enum Buffer {
-            PositionBuffer = 0,
-            //NormalBuffer = 1,
-            TexuvBuffer,
-            TriangleBuffer,
-            BufferCount = TriangleBuffer + 1
+            VertexBuffer = 0,
+            IndexBuffer,
+            BufferCount = IndexBuffer + 1
         };
 
         GLenum m_mode;
-        GLuint m_ids[3];
+        VertexFormat m_format;
+        GLuint m_ids[BufferCount];
+        GLuint m_vao;
         GLuint m_elementCount;
-        bool m_owner;
+        GLenum m_index_type;
+        Bounds m_mesh_bounds;
+        bool m_quantized;
+        float m_dequantize_matrix[16];
+        unsigned int m_byte_size;
+        unsigned int m_bytes_saved;
+        RetainedData *m_retained; // shared with the copies, like the buffers, see ResourceManager
+    };
+
+    inline Mesh::Options operator|(Mesh::Options a, Mesh::Options b)
+    {
+        return Mesh::Options(int(a) | int(b));
+    }
+
+    // Draws many copies of one mesh in as few calls as possible. Every copy
+    // has its own model matrix and optionally a color and a texuv offset,
+    // which can be updated in place.
+    //
+    // With instanced arrays (OpenGL ES 3.0, OpenGL 3.3) the per-instance data
+    // is read through attribute divisors and every copy is drawn in one call.
+    // Otherwise the vertices are replicated BatchSize times with an instance
+    // index attribute, and each batch reads its data from uniform arrays.
+    // createDefaultShader() returns a shader for the path the context takes.
+    class InstancedMesh : public Mesh
+    {
+    public:
+        enum InstanceData { Matrices = 1, Colors = 2, TexuvOffsets = 4 };
+        enum { BatchSize = 16 }; // the size of the arrays in batched_vertex_shader
+
+        InstancedMesh(GLenum mode,
+                      const VertexFormat &format,
+                      const void *vertices, unsigned int vertices_size,
+                      const void *indices, unsigned int indices_size,
+                      GLenum index_type,
+                      unsigned int instance_count,
+                      unsigned int instance_data = Matrices,
+                      Node *parent = 0);
+        ~InstancedMesh();
+
+        void draw(Shader *shader);
+
+        // new instances get an identity matrix, white and no offset
+        unsigned int instanceCount() const;
+        void setInstanceCount(unsigned int count);
+
+        // 16, 4 and 2 floats per instance
+        void setMatrices(unsigned int first, unsigned int count, const float *matrices);
+        void setColors(unsigned int first, unsigned int count, const float *colors);
+        void setTexuvOffsets(unsigned int first, unsigned int count, const float *offsets);
+
+        static const char *instanced_vertex_shader;
+        static const char *batched_vertex_shader;
+        static const char *instance_fragment_shader;
+
+        static Shader *createDefaultShader(Node *parent = 0);
+
+    protected:
+        void calculateBounds(Bounds *bounds);
+
+    private:
+        void allocateInstanceBuffer();
+        void updateInstanceBuffer(size_t offset, size_t count, const float *data);
+        size_t colorsOffset() const;
+        size_t texuvOffsetsOffset() const;
+
+        unsigned int m_instance_count;
+        unsigned int m_instance_data;
+        GLuint m_instance_buffer; // per-instance data, or instance indices when batched
+        GLuint m_copy_element_count;
+        std::vector<float> m_matrices;
+        std::vector<float> m_colors;
+        std::vector<float> m_texuv_offsets;
     };
 
 }; // SceneGraph
@@ -0,0 +1,164 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "shaderpermutations.h"
+
+using namespace SceneGraph;
+
+const char *ShaderPermutations::standard_vertex_shader =
+#ifdef GL_ES_VERSION_2_0
+        "#version 100\n"
+#endif
+        "uniform mat4 sg_projection_model_view_matrix;\n"
+        "attribute vec3 sg_position_attribute;\n"
+        "#ifdef SG_TEXTURING\n"
+        "attribute vec2 sg_texuv_attribute;\n"
+        "varying vec2 v_texuv;\n"
+        "#endif\n"
+        "#ifdef SG_VERTEX_COLORS\n"
+        "attribute vec4 sg_color_attribute;\n"
+        "varying vec4 v_color;\n"
+        "#endif\n"
+        "#ifdef SG_FOG\n"
+        "varying float v_fog_distance;\n"
+        "#endif\n"
+        "void main()\n"
+        "{\n"
+            "gl_Position = sg_projection_model_view_matrix * vec4(sg_position_attribute, 1.0);\n"
+        "#ifdef SG_TEXTURING\n"
+            "v_texuv = sg_texuv_attribute;\n"
+        "#endif\n"
+        "#ifdef SG_VERTEX_COLORS\n"
+            "v_color = sg_color_attribute;\n"
+        "#endif\n"
+        "#ifdef SG_FOG\n"
+            "v_fog_distance = gl_Position.w;\n"
+        "#endif\n"
+        "}";
+const char *ShaderPermutations::standard_fragment_shader =
+#ifdef GL_ES_VERSION_2_0
+        "#version 100\n"
+        "precision highp float;\n"
+#endif
+        "#ifdef SG_TEXTURING\n"
+        "uniform sampler2D sg_texture_sampler;\n"
+        "varying vec2 v_texuv;\n"
+        "#endif\n"
+        "#ifdef SG_VERTEX_COLORS\n"
+        "varying vec4 v_color;\n"
+        "#endif\n"
+        "#ifdef SG_FOG\n"
+        "uniform vec4 sg_fog_color;\n"
+        "uniform float sg_fog_density;\n"
+        "varying float v_fog_distance;\n"
+        "#endif\n"
+        "void main()\n"
+        "{\n"
+            "vec4 color = vec4(1.0);\n"
+        "#ifdef SG_TEXTURING\n"
+            "color *= texture2D(sg_texture_sampler, v_texuv);\n"
+        "#endif\n"
+        "#ifdef SG_VERTEX_COLORS\n"
+            "color *= v_color;\n"
+        "#endif\n"
+        "#ifdef SG_FOG\n"
+            "float fog = exp(-sg_fog_density * v_fog_distance);\n"
+            "color.rgb = mix(sg_fog_color.rgb, color.rgb, clamp(fog, 0.0, 1.0));\n"
+        "#endif\n"
+            "gl_FragColor = color;\n"
+        "}";
+
+const char *ShaderPermutations::fog_color_uniform_name = "sg_fog_color";
+const char *ShaderPermutations::fog_density_uniform_name = "sg_fog_density";
+
+ShaderPermutations::ShaderPermutations(const char *vertex_source,
+                                       const char *fragment_source,
+                                       unsigned int uniforms,
+                                       unsigned int attributes)
+    : m_vertex_source(vertex_source ? vertex_source : ""),
+      m_fragment_source(fragment_source ? fragment_source : ""),
+      m_uniforms(uniforms),
+      m_attributes(attributes)
+{
+}
+
+unsigned int ShaderPermutations::addFeature(const char *define)
+{
+    if (m_defines.size() == 32) {
+        fprintf(stderr, "ShaderPermutations: too many features\n");
+        return 0;
+    }
+    m_defines.push_back(define);
+    return 1u << (m_defines.size() - 1);
+}
+
+unsigned int ShaderPermutations::featureCount() const
+{
+    return m_defines.size();
+}
+
+std::string ShaderPermutations::vertexSource(unsigned int features) const
+{
+    return expand(m_vertex_source, features);
+}
+
+std::string ShaderPermutations::fragmentSource(unsigned int features) const
+{
+    return expand(m_fragment_source, features);
+}
+
+Shader *ShaderPermutations::create(unsigned int features, Node *parent)
+{
+    Shader *shader = new Shader(vertexSource(features).c_str(), fragmentSource(features).c_str(),
+                                m_uniforms, m_attributes, parent);
+    if (!shader->isReady()) {
+        delete shader;
+        return 0;
+    }
+    return shader;
+}
+
+Shader *ShaderPermutations::createAsync(unsigned int features, unsigned int fallback_features, Node *parent)
+{
+    // the new shader holds on to the program of the fallback, not the node
+    Shader *fallback = create(fallback_features);
+    Shader *shader = Shader::createAsync(vertexSource(features).c_str(), fragmentSource(features).c_str(),
+                                         fallback, m_uniforms, m_attributes, parent);
+    delete fallback;
+    return shader;
+}
+
+ShaderPermutations *ShaderPermutations::standard()
+{
+    static ShaderPermutations *permutations = 0;
+    if (!permutations) {
+        permutations = new ShaderPermutations(standard_vertex_shader, standard_fragment_shader,
+                                              Shader::DefaultUniforms, Shader::PositionAttribute);
+        permutations->addFeature("SG_TEXTURING");
+        permutations->addFeature("SG_VERTEX_COLORS");
+        permutations->addFeature("SG_FOG");
+    }
+    return permutations;
+}
+
+std::string ShaderPermutations::expand(const std::string &source, unsigned int features) const
+{
+    std::string defines;
+    for (size_t i = 0; i < m_defines.size(); ++i) {
+        if (features & (1u << i))
+            defines += "#define " + m_defines[i] + "\n";
+    }
+    // nothing but comments and white space may come before #version
+    std::string::size_type start = 0;
+    if (source.compare(0, 8, "#version") == 0) {
+        start = source.find('\n');
+        start = start == std::string::npos ? source.size() : start + 1;
+    }
+    std::string expanded = source;
+    expanded.insert(start, defines);
+    return expanded;
+}
@@ -0,0 +1,73 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef SHADERPERMUTATIONS_H
+#define SHADERPERMUTATIONS_H
+
+#include <string>
+#include <vector>
+
+#include "scenegraph.h"
+
+namespace SceneGraph {
+
+    // One pair of sources with #ifdef'd feature blocks, expanded into a
+    // variant per combination of features on demand. Each feature is one
+    // bit, and turning it on puts "#define <name>" at the top of both
+    // sources, after the #version line. Variants with the same features
+    // share a program through the ProgramCache.
+    //
+    // createAsync() hands out a shader right away that draws with a simpler
+    // variant, typically one without the expensive features, until its own
+    // program has linked.
+    //
+    // standard() has the default shader with texturing, vertex colors and
+    // fog as features. Fog is exponential over the distance to the eye,
+    // with the sg_fog_color and sg_fog_density uniforms; the density is 0
+    // until it is set.
+    class ShaderPermutations
+    {
+    public:
+        enum StandardFeatures { Texturing = 1, VertexColors = 2, Fog = 4 };
+
+        ShaderPermutations(const char *vertex_source,
+                           const char *fragment_source,
+                           unsigned int uniforms = Shader::DefaultUniforms,
+                           unsigned int attributes = Shader::DefaultAttributes);
+
+        // the bit for the define, in the order of the calls; up to 32
+        unsigned int addFeature(const char *define);
+        unsigned int featureCount() const;
+
+        std::string vertexSource(unsigned int features) const;
+        std::string fragmentSource(unsigned int features) const;
+
+        // linked before it returns; 0 if it does not build
+        Shader *create(unsigned int features, Node *parent = 0);
+        // see Shader::createAsync(); the fallback variant is linked before it returns
+        Shader *createAsync(unsigned int features, unsigned int fallback_features, Node *parent = 0);
+
+        static ShaderPermutations *standard();
+
+        static const char *standard_vertex_shader;
+        static const char *standard_fragment_shader;
+        static const char *fog_color_uniform_name;
+        static const char *fog_density_uniform_name;
+
+    private:
+        std::string expand(const std::string &source, unsigned int features) const;
+
+        std::string m_vertex_source;
+        std::string m_fragment_source;
+        unsigned int m_uniforms;
+        unsigned int m_attributes;
+        std::vector<std::string> m_defines;
+    };
+
+}; // SceneGraph
+
+#endif//SHADERPERMUTATIONS_H
@@ -0,0 +1,145 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "simd.h"
+#include "mathematics.h"
+#include <QtGlobal>
+#include <string.h>
+
+#if defined(Q_PROCESSOR_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+using namespace SceneGraph;
+
+static void scalar_multiply_matrices(const float *a, const float *b, float *r)
+{
+    multiply_matrices(a, b, r);
+}
+
+static void scalar_multiply_matrices_batch(const float *a, const float *b, float *r, unsigned int count)
+{
+    multiply_matrices_batch(a, b, r, count);
+}
+
+static void scalar_transform_points(const float *m, const float *points, float *result, unsigned int count)
+{
+    transform_points(m, points, result, count);
+}
+
+static void scalar_transform_vectors(const float *m, const float *vectors, float *result, unsigned int count)
+{
+    transform_vectors(m, vectors, result, count);
+}
+
+static bool scalar_invert_matrix(const float *m, float *r)
+{
+    return invert_matrix(m, r);
+}
+
+static void scalar_multiply_quaternions(const float *a, const float *b, float *r)
+{
+    multiply_quaternions(a, b, r);
+}
+
+static void scalar_slerp_quaternions(const float *a, const float *b, float t, float *r)
+{
+    slerp_quaternions(a, b, t, r);
+}
+
+const MathKernels *SceneGraph::scalar_math_kernels()
+{
+    static const MathKernels kernels = {
+        "scalar",
+        scalar_multiply_matrices,
+        scalar_multiply_matrices_batch,
+        scalar_transform_points,
+        scalar_transform_vectors,
+        scalar_invert_matrix,
+        scalar_multiply_quaternions,
+        scalar_slerp_quaternions
+    };
+    return &kernels;
+}
+
+#if defined(Q_PROCESSOR_X86)
+
+static void cpuid(unsigned int leaf, unsigned int *registers)
+{
+#if defined(_MSC_VER)
+    int values[4];
+    __cpuid(values, leaf);
+    for (int i = 0; i < 4; ++i)
+        registers[i] = values[i];
+#else
+    if (!__get_cpuid(leaf, &registers[0], &registers[1], &registers[2], &registers[3]))
+        memset(registers, 0, 4 * sizeof(unsigned int));
+#endif
+}
+
+static unsigned long long xgetbv()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+
+bool SceneGraph::cpu_has_sse2()
+{
+    unsigned int registers[4];
+    cpuid(1, registers);
+    return registers[3] & (1u << 26);
+}
+
+bool SceneGraph::cpu_has_avx()
+{
+    unsigned int registers[4];
+    cpuid(1, registers);
+    const bool avx = registers[2] & (1u << 28);
+    const bool osxsave = registers[2] & (1u << 27);
+    // the os has to save the ymm registers too
+    return avx && osxsave && (xgetbv() & 0x6) == 0x6;
+}
+
+#else
+
+bool SceneGraph::cpu_has_sse2()
+{
+    return false;
+}
+
+bool SceneGraph::cpu_has_avx()
+{
+    return false;
+}
+
+#endif
+
+static const MathKernels *resolve_math_kernels()
+{
+    if (const MathKernels *kernels = avx_math_kernels())
+        return kernels;
+    if (const MathKernels *kernels = sse2_math_kernels())
+        return kernels;
+    if (const MathKernels *kernels = neon_math_kernels())
+        return kernels;
+    return scalar_math_kernels();
+}
+
+const MathKernels &SceneGraph::math_kernels()
+{
+    static const MathKernels *kernels = resolve_math_kernels();
+    return *kernels;
+}
@@ -0,0 +1,61 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+namespace SceneGraph {
+
+    // The matrix and quaternion functions from mathematics.h, in versions for
+    // SSE2, AVX and NEON. math_kernels() picks the best one the CPU supports
+    // the first time it is called; on x86 this is decided with CPUID, on ARM
+    // at compile time. The scalar functions in mathematics.h stay the
+    // reference and the fallback.
+    //
+    // Matrices are column major float[16], quaternions are float[4] with w
+    // first and points and vectors are packed float[3]. The matrix products
+    // add up the terms in the same order as multiply_matrices() and use no
+    // fused multiply-add, so they give the same bits as the scalar version.
+    // The other functions are only as close as float math allows; the
+    // inverse may differ by 1e-3 of its largest element for badly
+    // conditioned matrices and slerp by 1e-6, see tests/simd.
+    struct MathKernels
+    {
+        const char *name;
+
+        // r = a * b
+        void (*multiply_matrices)(const float *a, const float *b, float *r);
+        // r[i] = a * b[i], for count matrices
+        void (*multiply_matrices_batch)(const float *a, const float *b, float *r, unsigned int count);
+        // result[i] = m * (points[i], 1)
+        void (*transform_points)(const float *m, const float *points, float *result, unsigned int count);
+        // result[i] = m * (vectors[i], 0)
+        void (*transform_vectors)(const float *m, const float *vectors, float *result, unsigned int count);
+        // returns false and leaves r alone if m is singular
+        bool (*invert_matrix)(const float *m, float *r);
+        // r = a * b
+        void (*multiply_quaternions)(const float *a, const float *b, float *r);
+        // shortest path interpolation between two unit quaternions
+        void (*slerp_quaternions)(const float *a, const float *b, float t, float *r);
+    };
+
+    const MathKernels &math_kernels();
+
+    // the individual versions; 0 if not built for this CPU or not supported
+    // by the one we are running on
+    const MathKernels *scalar_math_kernels();
+    const MathKernels *sse2_math_kernels();
+    const MathKernels *avx_math_kernels();
+    const MathKernels *neon_math_kernels();
+
+    // runtime checks, always false on other architectures than x86
+    bool cpu_has_sse2();
+    bool cpu_has_avx();
+
+}; // SceneGraph
+
+#endif//SIMD_H
@@ -0,0 +1,88 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "simd.h"
+#include <QtGlobal>
+
+using namespace SceneGraph;
+
+#if defined(Q_PROCESSOR_X86)
+
+#include <immintrin.h>
+
+// only these functions may use avx, the cpu is checked before they are picked
+#if defined(__GNUC__)
+#define AVX_FUNCTION __attribute__((target("avx")))
+#else
+#define AVX_FUNCTION
+#endif
+
+// two columns of the product at a time; a is in both halves of every
+// register and the shuffles pick the matching element of each b column
+AVX_FUNCTION static inline __m256 transform_columns(const __m256 *a, const float *b)
+{
+    const __m256 columns = _mm256_loadu_ps(b);
+    __m256 r = _mm256_mul_ps(a[0], _mm256_shuffle_ps(columns, columns, 0x00));
+    r = _mm256_add_ps(r, _mm256_mul_ps(a[1], _mm256_shuffle_ps(columns, columns, 0x55)));
+    r = _mm256_add_ps(r, _mm256_mul_ps(a[2], _mm256_shuffle_ps(columns, columns, 0xaa)));
+    return _mm256_add_ps(r, _mm256_mul_ps(a[3], _mm256_shuffle_ps(columns, columns, 0xff)));
+}
+
+AVX_FUNCTION static inline void load_columns(const float *a, __m256 *columns)
+{
+    for (int i = 0; i < 4; ++i)
+        columns[i] = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + i * 4));
+}
+
+AVX_FUNCTION static void avx_multiply_matrices(const float *a, const float *b, float *r)
+{
+    __m256 columns[4];
+    load_columns(a, columns);
+    const __m256 r01 = transform_columns(columns, b);
+    const __m256 r23 = transform_columns(columns, b + 8);
+    _mm256_storeu_ps(r, r01);
+    _mm256_storeu_ps(r + 8, r23);
+}
+
+AVX_FUNCTION static void avx_multiply_matrices_batch(const float *a, const float *b, float *r, unsigned int count)
+{
+    __m256 columns[4];
+    load_columns(a, columns);
+    for (unsigned int i = 0; i < count; ++i) {
+        const __m256 r01 = transform_columns(columns, b + i * 16);
+        const __m256 r23 = transform_columns(columns, b + i * 16 + 8);
+        _mm256_storeu_ps(r + i * 16, r01);
+        _mm256_storeu_ps(r + i * 16 + 8, r23);
+    }
+}
+
+const MathKernels *SceneGraph::avx_math_kernels()
+{
+    if (!cpu_has_avx())
+        return 0;
+    // the rest does not gain anything from the wider registers
+    static const MathKernels kernels = {
+        "avx",
+        avx_multiply_matrices,
+        avx_multiply_matrices_batch,
+        sse2_math_kernels()->transform_points,
+        sse2_math_kernels()->transform_vectors,
+        sse2_math_kernels()->invert_matrix,
+        sse2_math_kernels()->multiply_quaternions,
+        sse2_math_kernels()->slerp_quaternions
+    };
+    return &kernels;
+}
+
+#else
+
+const MathKernels *SceneGraph::avx_math_kernels()
+{
+    return 0;
+}
+
+#endif
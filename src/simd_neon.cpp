@@ -0,0 +1,137 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "simd.h"
+#include "mathematics.h"
+
+using namespace SceneGraph;
+
+// neon is either there at compile time (aarch64, or armv7 with -mfpu=neon)
+// or not at all; there is no portable way to ask the cpu on arm
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+// vmlaq is not fused, so the sums come out the same as multiply_matrices()
+static inline float32x4_t transform_column(const float32x4_t *a, const float *b)
+{
+    float32x4_t r = vmulq_n_f32(a[0], b[0]);
+    r = vmlaq_n_f32(r, a[1], b[1]);
+    r = vmlaq_n_f32(r, a[2], b[2]);
+    return vmlaq_n_f32(r, a[3], b[3]);
+}
+
+static void neon_multiply_matrices(const float *a, const float *b, float *r)
+{
+    const float32x4_t columns[] = { vld1q_f32(a), vld1q_f32(a + 4), vld1q_f32(a + 8), vld1q_f32(a + 12) };
+    // r may be a or b, so compute everything before storing
+    const float32x4_t r0 = transform_column(columns, b);
+    const float32x4_t r1 = transform_column(columns, b + 4);
+    const float32x4_t r2 = transform_column(columns, b + 8);
+    const float32x4_t r3 = transform_column(columns, b + 12);
+    vst1q_f32(r, r0);
+    vst1q_f32(r + 4, r1);
+    vst1q_f32(r + 8, r2);
+    vst1q_f32(r + 12, r3);
+}
+
+static void neon_multiply_matrices_batch(const float *a, const float *b, float *r, unsigned int count)
+{
+    const float32x4_t columns[] = { vld1q_f32(a), vld1q_f32(a + 4), vld1q_f32(a + 8), vld1q_f32(a + 12) };
+    for (unsigned int i = 0; i < count; ++i) {
+        const float *bi = b + i * 16;
+        float *ri = r + i * 16;
+        const float32x4_t r0 = transform_column(columns, bi);
+        const float32x4_t r1 = transform_column(columns, bi + 4);
+        const float32x4_t r2 = transform_column(columns, bi + 8);
+        const float32x4_t r3 = transform_column(columns, bi + 12);
+        vst1q_f32(ri, r0);
+        vst1q_f32(ri + 4, r1);
+        vst1q_f32(ri + 8, r2);
+        vst1q_f32(ri + 12, r3);
+    }
+}
+
+static inline void store_xyz(float *destination, float32x4_t v)
+{
+    vst1_f32(destination, vget_low_f32(v));
+    vst1q_lane_f32(destination + 2, v, 2);
+}
+
+static void neon_transform_points(const float *m, const float *points, float *result, unsigned int count)
+{
+    const float32x4_t c0 = vld1q_f32(m), c1 = vld1q_f32(m + 4), c2 = vld1q_f32(m + 8), c3 = vld1q_f32(m + 12);
+    for (unsigned int i = 0; i < count; ++i) {
+        const float *p = points + i * 3;
+        float32x4_t r = vmulq_n_f32(c0, p[0]);
+        r = vmlaq_n_f32(r, c1, p[1]);
+        r = vmlaq_n_f32(r, c2, p[2]);
+        store_xyz(result + i * 3, vaddq_f32(r, c3));
+    }
+}
+
+static void neon_transform_vectors(const float *m, const float *vectors, float *result, unsigned int count)
+{
+    const float32x4_t c0 = vld1q_f32(m), c1 = vld1q_f32(m + 4), c2 = vld1q_f32(m + 8);
+    for (unsigned int i = 0; i < count; ++i) {
+        const float *v = vectors + i * 3;
+        float32x4_t r = vmulq_n_f32(c0, v[0]);
+        r = vmlaq_n_f32(r, c1, v[1]);
+        r = vmlaq_n_f32(r, c2, v[2]);
+        store_xyz(result + i * 3, r);
+    }
+}
+
+static bool neon_invert_matrix(const float *m, float *r)
+{
+    return invert_matrix(m, r);
+}
+
+static void neon_multiply_quaternions(const float *a, const float *b, float *r)
+{
+    // r = aw * b + ax * (-bx, bw, -bz, by) + ay * (-by, bz, bw, -bx) + az * (-bz, -by, bx, bw)
+    static const float signs_x[] = { -1, 1, -1, 1 };
+    static const float signs_y[] = { -1, 1, 1, -1 };
+    static const float signs_z[] = { -1, -1, 1, 1 };
+    const float qx[] = { b[1], b[0], b[3], b[2] };
+    const float qy[] = { b[2], b[3], b[0], b[1] };
+    const float qz[] = { b[3], b[2], b[1], b[0] };
+    float32x4_t result = vmulq_n_f32(vld1q_f32(b), a[0]);
+    result = vmlaq_n_f32(result, vmulq_f32(vld1q_f32(qx), vld1q_f32(signs_x)), a[1]);
+    result = vmlaq_n_f32(result, vmulq_f32(vld1q_f32(qy), vld1q_f32(signs_y)), a[2]);
+    result = vmlaq_n_f32(result, vmulq_f32(vld1q_f32(qz), vld1q_f32(signs_z)), a[3]);
+    vst1q_f32(r, result);
+}
+
+static void neon_slerp_quaternions(const float *a, const float *b, float t, float *r)
+{
+    slerp_quaternions(a, b, t, r);
+}
+
+const MathKernels *SceneGraph::neon_math_kernels()
+{
+    static const MathKernels kernels = {
+        "neon",
+        neon_multiply_matrices,
+        neon_multiply_matrices_batch,
+        neon_transform_points,
+        neon_transform_vectors,
+        neon_invert_matrix,
+        neon_multiply_quaternions,
+        neon_slerp_quaternions
+    };
+    return &kernels;
+}
+
+#else
+
+const MathKernels *SceneGraph::neon_math_kernels()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,224 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "simd.h"
+#include "mathematics.h"
+#include <QtGlobal>
+
+using namespace SceneGraph;
+
+#if defined(Q_PROCESSOR_X86)
+
+#include <emmintrin.h>
+
+// the functions carry their own target, so the rest of the library can be
+// built without -msse2 on 32 bit x86
+#if defined(__GNUC__)
+#define SSE2_FUNCTION __attribute__((target("sse2")))
+#else
+#define SSE2_FUNCTION
+#endif
+
+#define SHUFFLE(v, x, y, z, w) _mm_shuffle_ps(v, v, _MM_SHUFFLE(w, z, y, x))
+
+SSE2_FUNCTION static inline __m128 transform_column(const __m128 *a, const float *b)
+{
+    // same order of additions as multiply_matrices()
+    __m128 r = _mm_mul_ps(a[0], _mm_set1_ps(b[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(a[1], _mm_set1_ps(b[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(a[2], _mm_set1_ps(b[2])));
+    return _mm_add_ps(r, _mm_mul_ps(a[3], _mm_set1_ps(b[3])));
+}
+
+SSE2_FUNCTION static void sse2_multiply_matrices(const float *a, const float *b, float *r)
+{
+    const __m128 columns[] = { _mm_loadu_ps(a), _mm_loadu_ps(a + 4), _mm_loadu_ps(a + 8), _mm_loadu_ps(a + 12) };
+    // r may be a or b, so compute everything before storing
+    const __m128 r0 = transform_column(columns, b);
+    const __m128 r1 = transform_column(columns, b + 4);
+    const __m128 r2 = transform_column(columns, b + 8);
+    const __m128 r3 = transform_column(columns, b + 12);
+    _mm_storeu_ps(r, r0);
+    _mm_storeu_ps(r + 4, r1);
+    _mm_storeu_ps(r + 8, r2);
+    _mm_storeu_ps(r + 12, r3);
+}
+
+SSE2_FUNCTION static void sse2_multiply_matrices_batch(const float *a, const float *b, float *r, unsigned int count)
+{
+    const __m128 columns[] = { _mm_loadu_ps(a), _mm_loadu_ps(a + 4), _mm_loadu_ps(a + 8), _mm_loadu_ps(a + 12) };
+    for (unsigned int i = 0; i < count; ++i) {
+        const float *bi = b + i * 16;
+        float *ri = r + i * 16;
+        const __m128 r0 = transform_column(columns, bi);
+        const __m128 r1 = transform_column(columns, bi + 4);
+        const __m128 r2 = transform_column(columns, bi + 8);
+        const __m128 r3 = transform_column(columns, bi + 12);
+        _mm_storeu_ps(ri, r0);
+        _mm_storeu_ps(ri + 4, r1);
+        _mm_storeu_ps(ri + 8, r2);
+        _mm_storeu_ps(ri + 12, r3);
+    }
+}
+
+SSE2_FUNCTION static inline void store_xyz(float *destination, __m128 v)
+{
+    _mm_storel_pi(reinterpret_cast<__m64*>(destination), v);
+    _mm_store_ss(destination + 2, _mm_movehl_ps(v, v));
+}
+
+SSE2_FUNCTION static void sse2_transform_points(const float *m, const float *points, float *result, unsigned int count)
+{
+    const __m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8), c3 = _mm_loadu_ps(m + 12);
+    for (unsigned int i = 0; i < count; ++i) {
+        const float *p = points + i * 3;
+        __m128 r = _mm_mul_ps(c0, _mm_set1_ps(p[0]));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(p[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(p[2])));
+        store_xyz(result + i * 3, _mm_add_ps(r, c3));
+    }
+}
+
+SSE2_FUNCTION static void sse2_transform_vectors(const float *m, const float *vectors, float *result, unsigned int count)
+{
+    const __m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8);
+    for (unsigned int i = 0; i < count; ++i) {
+        const float *v = vectors + i * 3;
+        __m128 r = _mm_mul_ps(c0, _mm_set1_ps(v[0]));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(v[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(v[2])));
+        store_xyz(result + i * 3, r);
+    }
+}
+
+// 2x2 blocks stored as (x, y, z, w) = | x y |
+//                                     | z w |
+SSE2_FUNCTION static inline __m128 block_multiply(__m128 a, __m128 b)
+{
+    return _mm_add_ps(_mm_mul_ps(a, SHUFFLE(b, 0, 3, 0, 3)),
+                      _mm_mul_ps(SHUFFLE(a, 1, 0, 3, 2), SHUFFLE(b, 2, 1, 2, 1)));
+}
+
+// adjugate(a) * b
+SSE2_FUNCTION static inline __m128 block_adjugate_multiply(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(SHUFFLE(a, 3, 3, 0, 0), b),
+                      _mm_mul_ps(SHUFFLE(a, 1, 1, 2, 2), SHUFFLE(b, 2, 3, 0, 1)));
+}
+
+// a * adjugate(b)
+SSE2_FUNCTION static inline __m128 block_multiply_adjugate(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(a, SHUFFLE(b, 3, 0, 3, 0)),
+                      _mm_mul_ps(SHUFFLE(a, 1, 0, 3, 2), SHUFFLE(b, 2, 1, 2, 1)));
+}
+
+SSE2_FUNCTION static bool sse2_invert_matrix(const float *m, float *r)
+{
+    // blockwise inversion; the transpose of the inverse is the inverse of the
+    // transpose, so working on the columns as if they were rows is fine
+    const __m128 m0 = _mm_loadu_ps(m), m1 = _mm_loadu_ps(m + 4), m2 = _mm_loadu_ps(m + 8), m3 = _mm_loadu_ps(m + 12);
+    const __m128 a = _mm_movelh_ps(m0, m1);
+    const __m128 b = _mm_movehl_ps(m1, m0);
+    const __m128 c = _mm_movelh_ps(m2, m3);
+    const __m128 d = _mm_movehl_ps(m3, m2);
+
+    // determinants of a, b, c and d
+    const __m128 determinants = _mm_sub_ps(
+        _mm_mul_ps(_mm_shuffle_ps(m0, m2, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(m1, m3, _MM_SHUFFLE(3, 1, 3, 1))),
+        _mm_mul_ps(_mm_shuffle_ps(m0, m2, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(m1, m3, _MM_SHUFFLE(2, 0, 2, 0))));
+    const __m128 determinant_a = SHUFFLE(determinants, 0, 0, 0, 0);
+    const __m128 determinant_b = SHUFFLE(determinants, 1, 1, 1, 1);
+    const __m128 determinant_c = SHUFFLE(determinants, 2, 2, 2, 2);
+    const __m128 determinant_d = SHUFFLE(determinants, 3, 3, 3, 3);
+
+    const __m128 dc = block_adjugate_multiply(d, c);
+    const __m128 ab = block_adjugate_multiply(a, b);
+    __m128 x = _mm_sub_ps(_mm_mul_ps(determinant_d, a), block_multiply(b, dc));
+    __m128 w = _mm_sub_ps(_mm_mul_ps(determinant_a, d), block_multiply(c, ab));
+    __m128 y = _mm_sub_ps(_mm_mul_ps(determinant_b, c), block_multiply_adjugate(d, ab));
+    __m128 z = _mm_sub_ps(_mm_mul_ps(determinant_c, b), block_multiply_adjugate(a, dc));
+
+    // trace(ab * dc), summed without sse3
+    __m128 trace = _mm_mul_ps(ab, SHUFFLE(dc, 0, 2, 1, 3));
+    trace = _mm_add_ps(trace, SHUFFLE(trace, 1, 0, 3, 2));
+    trace = _mm_add_ps(trace, SHUFFLE(trace, 2, 3, 0, 1));
+    __m128 determinant = _mm_add_ps(_mm_mul_ps(determinant_a, determinant_d), _mm_mul_ps(determinant_b, determinant_c));
+    determinant = _mm_sub_ps(determinant, trace);
+    if (_mm_cvtss_f32(determinant) == 0)
+        return false;
+
+    const __m128 reciprocal = _mm_div_ps(_mm_setr_ps(1, -1, -1, 1), determinant);
+    x = _mm_mul_ps(x, reciprocal);
+    y = _mm_mul_ps(y, reciprocal);
+    z = _mm_mul_ps(z, reciprocal);
+    w = _mm_mul_ps(w, reciprocal);
+    _mm_storeu_ps(r, _mm_shuffle_ps(x, y, _MM_SHUFFLE(1, 3, 1, 3)));
+    _mm_storeu_ps(r + 4, _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 2, 0, 2)));
+    _mm_storeu_ps(r + 8, _mm_shuffle_ps(z, w, _MM_SHUFFLE(1, 3, 1, 3)));
+    _mm_storeu_ps(r + 12, _mm_shuffle_ps(z, w, _MM_SHUFFLE(0, 2, 0, 2)));
+    return true;
+}
+
+SSE2_FUNCTION static void sse2_multiply_quaternions(const float *a, const float *b, float *r)
+{
+    // r = aw * b + ax * (-bx, bw, -bz, by) + ay * (-by, bz, bw, -bx) + az * (-bz, -by, bx, bw)
+    const __m128 q = _mm_loadu_ps(b);
+    __m128 result = _mm_mul_ps(_mm_set1_ps(a[0]), q);
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(a[1]), _mm_mul_ps(SHUFFLE(q, 1, 0, 3, 2), _mm_setr_ps(-1, 1, -1, 1))));
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(a[2]), _mm_mul_ps(SHUFFLE(q, 2, 3, 0, 1), _mm_setr_ps(-1, 1, 1, -1))));
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(a[3]), _mm_mul_ps(SHUFFLE(q, 3, 2, 1, 0), _mm_setr_ps(-1, -1, 1, 1))));
+    _mm_storeu_ps(r, result);
+}
+
+SSE2_FUNCTION static void sse2_slerp_quaternions(const float *a, const float *b, float t, float *r)
+{
+    const __m128 qa = _mm_loadu_ps(a);
+    __m128 qb = _mm_loadu_ps(b);
+    __m128 products = _mm_mul_ps(qa, qb);
+    products = _mm_add_ps(products, SHUFFLE(products, 1, 0, 3, 2));
+    products = _mm_add_ps(products, SHUFFLE(products, 2, 3, 0, 1));
+    float cosine = _mm_cvtss_f32(products);
+    if (cosine < 0) {
+        // take the shorter way around
+        cosine = -cosine;
+        qb = _mm_sub_ps(_mm_setzero_ps(), qb);
+    }
+    float wa = 1 - t;
+    float wb = t;
+    if (cosine < 0.9995f) {
+        const float angle = acosf(cosine);
+        const float inverse_sine = 1 / sinf(angle);
+        wa = sinf((1 - t) * angle) * inverse_sine;
+        wb = sinf(t * angle) * inverse_sine;
+    }
+    _mm_storeu_ps(r, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(wa), qa), _mm_mul_ps(_mm_set1_ps(wb), qb)));
+}
+
+const MathKernels *SceneGraph::sse2_math_kernels()
+{
+    static const MathKernels kernels = {
+        "sse2",
+        sse2_multiply_matrices,
+        sse2_multiply_matrices_batch,
+        sse2_transform_points,
+        sse2_transform_vectors,
+        sse2_invert_matrix,
+        sse2_multiply_quaternions,
+        sse2_slerp_quaternions
+    };
+    return cpu_has_sse2() ? &kernels : 0;
+}
+
+#else
+
+const MathKernels *SceneGraph::sse2_math_kernels()
+{
+    return 0;
+}
+
+#endif
@@ -3,6 +3,6 @@ CONFIG += staticlib
 TARGET = scenegraph
 DESTDIR = $$OUT_PWD/../lib
 DEFINES += QT_BUILD_SCENEGRAPH_LIB
-HEADERS += scenegraph.h rasterizer.h
-SOURCES += scenegraph.cpp rasterizer.cpp
+HEADERS += scenegraph.h rasterizer.h renderlist.h renderqueue.h meshoptimizer.h staticbatch.h simd.h threadpool.h parallelupdate.h transformsystem.h scenearena.h texturestreamer.h textureatlas.h ktxloader.h meshfile.h programcache.h shaderpermutations.h resourcemanager.h
+SOURCES += scenegraph.cpp rasterizer.cpp renderlist.cpp renderqueue.cpp meshoptimizer.cpp staticbatch.cpp simd.cpp simd_sse2.cpp simd_avx.cpp simd_neon.cpp threadpool.cpp parallelupdate.cpp transformsystem.cpp scenearena.cpp texturestreamer.cpp textureatlas.cpp ktxloader.cpp meshfile.cpp programcache.cpp shaderpermutations.cpp resourcemanager.cpp
 QT += opengl
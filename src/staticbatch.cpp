@@ -0,0 +1,402 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "staticbatch.h"
+#include "renderqueue.h"
+#include "resourcemanager.h"
+#include "mathematics.h"
+#include "simd.h"
+#include <typeinfo>
+
+using namespace SceneGraph;
+
+static const float identity_matrix[16] = {
+    1, 0, 0, 0,
+    0, 1, 0, 0,
+    0, 0, 1, 0,
+    0, 0, 0, 1 };
+
+StaticBatch::StaticBatch(Node *parent)
+    : Node(parent),
+      m_baked(0),
+      m_uploaded(false)
+{
+}
+
+StaticBatch::~StaticBatch()
+{
+    clear();
+}
+
+void StaticBatch::execute(State *state)
+{
+    if (!m_uploaded) {
+        if (!isBaked())
+            return;
+        upload();
+    }
+
+    float mvp_matrix[16];
+    math_kernels().multiply_matrices(state->projectionMatrix(), state->currentMatrix(), mvp_matrix);
+
+    if (RenderQueue *queue = state->renderQueue()) {
+        for (size_t b = 0; b < m_batches.size(); ++b) {
+            const Batch &batch = m_batches[b];
+            if (!batch.mesh)
+                continue;
+            queue->pushShader(batch.shader, mvp_matrix);
+            for (GLuint unit = 0; unit < MaxTextureUnits; ++unit)
+                queue->pushTexture(unit, batch.textures.ids[unit]);
+            drawSources(batch, state, batch.shader, queue);
+            for (GLuint unit = 0; unit < MaxTextureUnits; ++unit)
+                queue->popTexture();
+            queue->popShader();
+        }
+        return;
+    }
+
+    // remember the state the batches are going to overwrite
+    Shader *old_shader = state->currentShader();
+    GLint old_program = 0;
+    GLint old_unit = 0;
+    GLint old_textures[MaxTextureUnits];
+    unsigned int used_units = 0;
+    for (size_t b = 0; b < m_batches.size(); ++b) {
+        for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+            if (m_batches[b].textures.ids[unit])
+                used_units |= 1u << unit;
+        }
+    }
+    glGetIntegerv(GL_CURRENT_PROGRAM, &old_program);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &old_unit);
+    for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+        if (used_units & (1u << unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &old_textures[unit]);
+        }
+    }
+
+    for (size_t b = 0; b < m_batches.size(); ++b) {
+        const Batch &batch = m_batches[b];
+        if (!batch.mesh)
+            continue;
+        Shader *shader = batch.shader;
+        shader->poll();
+        glUseProgram(shader->m_program);
+        state->setCurrentShader(shader);
+        if (shader->m_uniforms & Shader::TextureSamplerUniform)
+            shader->setUniform1i(shader->m_texture_sampler_handle, /*GL_TEXTURE*/0);
+        shader->setProjectionModelViewMatrix(mvp_matrix);
+        for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+            if (batch.textures.ids[unit]) {
+                glActiveTexture(GL_TEXTURE0 + unit);
+                glBindTexture(GL_TEXTURE_2D, batch.textures.ids[unit]);
+            }
+        }
+
+        drawSources(batch, state, shader, 0);
+    }
+
+    for (GLuint unit = 0; unit < MaxTextureUnits; ++unit) {
+        if (used_units & (1u << unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_2D, old_textures[unit]);
+        }
+    }
+    glActiveTexture(old_unit);
+    glUseProgram(old_program);
+    state->setCurrentShader(old_shader);
+}
+
+void StaticBatch::drawSources(const Batch &batch, State *state, Shader *shader, RenderQueue *queue)
+{
+    // the visible sources, joining neighbouring ranges
+    unsigned int first = 0;
+    unsigned int count = 0;
+    for (size_t s = 0; s <= batch.sources.size(); ++s) {
+        if (s < batch.sources.size()) {
+            const Source &source = m_sources[batch.sources[s]];
+            if (state->frustumCulling() && state->classify(source.bounds) == State::Outside)
+                continue;
+            if (count && source.first == first + count) {
+                count += source.count;
+                continue;
+            }
+        }
+        if (count) {
+            if (queue)
+                queue->addMeshRange(batch.mesh, first, count);
+            else
+                batch.mesh->drawRange(shader, first, count);
+        }
+        if (s < batch.sources.size()) {
+            first = m_sources[batch.sources[s]].first;
+            count = m_sources[batch.sources[s]].count;
+        }
+    }
+}
+
+bool StaticBatch::visible(State *)
+{
+    // the subtree is drawn as usual until the batches replace it
+    return !m_uploaded;
+}
+
+void StaticBatch::collect(State *state)
+{
+    clear();
+    Textures textures;
+    memset(&textures, 0, sizeof(textures));
+    for (Node *child = firstChild(); child; child = child->nextSibling()) {
+        if (child->enabled(state))
+            collectNode(child, state, identity_matrix, 0, textures);
+    }
+}
+
+void StaticBatch::bake()
+{
+    for (size_t b = 0; b < m_batches.size(); ++b) {
+        Batch &batch = m_batches[b];
+        batch.vertices.reserve(batch.vertex_count * batch.format.stride());
+        for (size_t s = 0; s < batch.sources.size(); ++s)
+            bakeSource(&m_sources[batch.sources[s]], &batch);
+    }
+    m_baked.storeRelease(1);
+}
+
+void StaticBatch::upload()
+{
+    if (m_uploaded || !isBaked())
+        return;
+    for (size_t b = 0; b < m_batches.size(); ++b) {
+        Batch &batch = m_batches[b];
+        if (batch.indices.empty())
+            continue;
+        batch.mesh = new Mesh(GL_TRIANGLES, batch.format,
+                              &batch.vertices[0], batch.vertices.size(),
+                              &batch.indices[0], batch.indices.size() * sizeof(unsigned int),
+                              GL_UNSIGNED_INT, Mesh::CompactIndices);
+        std::vector<char>().swap(batch.vertices);
+        std::vector<unsigned int>().swap(batch.indices);
+    }
+    m_uploaded = true;
+    invalidate();
+}
+
+bool StaticBatch::isBaked() const
+{
+    return m_baked.loadAcquire() != 0;
+}
+
+bool StaticBatch::isUploaded() const
+{
+    return m_uploaded;
+}
+
+unsigned int StaticBatch::batchCount() const
+{
+    return m_batches.size();
+}
+
+unsigned int StaticBatch::sourceCount() const
+{
+    return m_sources.size();
+}
+
+void StaticBatch::calculateBounds(Bounds *bounds)
+{
+    if (!m_uploaded) {
+        mergeChildBounds(bounds);
+        return;
+    }
+    for (size_t s = 0; s < m_sources.size(); ++s)
+        bounds->merge(m_sources[s].bounds);
+}
+
+void StaticBatch::clear()
+{
+    ResourceManager *resources = ResourceManager::instance();
+    for (size_t b = 0; b < m_batches.size(); ++b) {
+        Batch &batch = m_batches[b];
+        delete batch.mesh;
+        delete batch.shader;
+        for (GLuint unit = 0; unit < MaxTextureUnits; ++unit)
+            resources->release(ResourceManager::Texture, batch.textures.ids[unit]);
+    }
+    m_batches.clear();
+    m_sources.clear();
+    m_baked.storeRelease(0);
+    if (m_uploaded) {
+        m_uploaded = false;
+        invalidate();
+    }
+}
+
+void StaticBatch::collectNode(Node *node, State *state, const float *matrix, Shader *shader, const Textures &textures)
+{
+    float local_matrix[16];
+    Textures local_textures = textures;
+    memcpy(local_matrix, matrix, sizeof(local_matrix));
+
+    if (Transformation *transformation = dynamic_cast<Transformation*>(node)) {
+        math_kernels().multiply_matrices(matrix, transformation->matrix(), local_matrix);
+    } else if (Shader *node_shader = dynamic_cast<Shader*>(node)) {
+        shader = node_shader;
+    } else if (Texture2D *texture = dynamic_cast<Texture2D*>(node)) {
+        if (texture->m_unit < MaxTextureUnits)
+            local_textures.ids[texture->m_unit] = texture->m_id;
+        else
+            fprintf(stderr, "StaticBatch: texture unit %u is not supported\n", texture->m_unit);
+    } else if (Mesh *mesh = dynamic_cast<Mesh*>(node)) {
+        if (typeid(*node) == typeid(Mesh) && mesh->m_retained && mesh->m_mode == GL_TRIANGLES && shader)
+            addSource(mesh, local_matrix, shader, local_textures);
+        else
+            fprintf(stderr, "StaticBatch: skipping a mesh that can not be baked\n");
+    } else if (typeid(*node) != typeid(Node)) {
+        fprintf(stderr, "StaticBatch: skipping a %s subtree\n", typeid(*node).name());
+        return;
+    }
+
+    for (Node *child = node->firstChild(); child; child = child->nextSibling()) {
+        if (child->enabled(state))
+            collectNode(child, state, local_matrix, shader, local_textures);
+    }
+}
+
+void StaticBatch::addSource(const Mesh *mesh, const float *matrix, Shader *shader, const Textures &textures)
+{
+    const Mesh::RetainedData *data = mesh->m_retained;
+    const VertexFormat &format = data->format;
+    if (format.type(VertexFormat::Position) != GL_FLOAT || format.size(VertexFormat::Position) < 3) {
+        fprintf(stderr, "StaticBatch: skipping a mesh without float positions\n");
+        return;
+    }
+    const unsigned int vertex_count = format.stride() ? data->vertices.size() / format.stride() : 0;
+    if (vertex_count == 0)
+        return;
+    if (vertex_count > MaxBatchVertices) {
+        fprintf(stderr, "StaticBatch: skipping a mesh with more than %d vertices\n", int(MaxBatchVertices));
+        return;
+    }
+
+    // the last batch with the same state that still fits 16 bit indices
+    size_t b = m_batches.size();
+    while (b > 0) {
+        const Batch &batch = m_batches[b - 1];
+        if (batch.source_shader == shader && !memcmp(&batch.textures, &textures, sizeof(textures))
+                && sameFormat(batch.format, format))
+            break;
+        --b;
+    }
+    if (b == 0 || m_batches[b - 1].vertex_count + vertex_count > MaxBatchVertices) {
+        Batch batch;
+        batch.source_shader = shader;
+        batch.shader = new Shader(shader);
+        batch.textures = textures;
+        for (GLuint unit = 0; unit < MaxTextureUnits; ++unit)
+            ResourceManager::instance()->retain(ResourceManager::Texture, textures.ids[unit]);
+        batch.format = format;
+        batch.vertex_count = 0;
+        batch.mesh = 0;
+        m_batches.push_back(batch);
+        b = m_batches.size();
+    }
+    Batch &batch = m_batches[b - 1];
+    batch.vertex_count += vertex_count;
+    batch.sources.push_back(m_sources.size());
+
+    Source source;
+    source.mesh = mesh;
+    memcpy(source.matrix, matrix, sizeof(source.matrix));
+    source.first = 0;
+    source.count = 0;
+    m_sources.push_back(source);
+}
+
+void StaticBatch::bakeSource(Source *source, Batch *batch)
+{
+    const Mesh::RetainedData *data = source->mesh->m_retained;
+    const VertexFormat &format = batch->format;
+    const unsigned int stride = format.stride();
+    const unsigned int vertex_count = data->vertices.size() / stride;
+    const unsigned int base_vertex = batch->vertices.size() / stride;
+    const float *m = source->matrix;
+
+    // normals go through the cofactor matrix, which handles non-uniform scale
+    float normal_matrix[9];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            const int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+            const int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            normal_matrix[j * 3 + i] = m[j1 * 4 + i1] * m[j2 * 4 + i2] - m[j2 * 4 + i1] * m[j1 * 4 + i2];
+        }
+    }
+    // keep the normals pointing outwards when the matrix mirrors
+    const float determinant = m[0] * normal_matrix[0] + m[4] * normal_matrix[3] + m[8] * normal_matrix[6];
+    if (determinant < 0) {
+        for (int i = 0; i < 9; ++i)
+            normal_matrix[i] = -normal_matrix[i];
+    }
+    const bool float_normals = format.type(VertexFormat::Normal) == GL_FLOAT && format.size(VertexFormat::Normal) >= 3;
+
+    batch->vertices.insert(batch->vertices.end(), data->vertices.begin(), data->vertices.end());
+    source->bounds = Bounds();
+    for (unsigned int v = 0; v < vertex_count; ++v) {
+        char *vertex = &batch->vertices[(base_vertex + v) * stride];
+        float *position = reinterpret_cast<float*>(vertex + format.offset(VertexFormat::Position));
+        const float p[3] = { position[0], position[1], position[2] };
+        for (int i = 0; i < 3; ++i)
+            position[i] = m[i] * p[0] + m[4 + i] * p[1] + m[8 + i] * p[2] + m[12 + i];
+        source->bounds.extend(position);
+        if (float_normals) {
+            float *normal = reinterpret_cast<float*>(vertex + format.offset(VertexFormat::Normal));
+            const float n[3] = { normal[0], normal[1], normal[2] };
+            for (int i = 0; i < 3; ++i)
+                normal[i] = normal_matrix[i] * n[0] + normal_matrix[3 + i] * n[1] + normal_matrix[6 + i] * n[2];
+            const float length = magnitude_vector(normal);
+            if (length > 0) {
+                for (int i = 0; i < 3; ++i)
+                    normal[i] /= length;
+            }
+        }
+    }
+    if (format.has(VertexFormat::Normal) && !float_normals)
+        fprintf(stderr, "StaticBatch: normals that are not floats are not transformed\n");
+
+    // tighten the sphere around the center of the box
+    if (source->bounds.type == Bounds::Finite) {
+        float radius = 0;
+        for (int j = 0; j < 3; ++j)
+            source->bounds.center[j] = (source->bounds.minimum[j] + source->bounds.maximum[j]) / 2;
+        for (unsigned int v = 0; v < vertex_count; ++v) {
+            const char *vertex = &batch->vertices[(base_vertex + v) * stride];
+            float distance = distance_point_to_point(source->bounds.center,
+                                                     reinterpret_cast<const float*>(vertex + format.offset(VertexFormat::Position)));
+            if (distance > radius)
+                radius = distance;
+        }
+        source->bounds.radius = radius;
+    }
+
+    source->first = batch->indices.size();
+    source->count = data->indices.size() / 3 * 3;
+    for (unsigned int i = 0; i < source->count; ++i)
+        batch->indices.push_back(data->indices[i] + base_vertex);
+}
+
+bool StaticBatch::sameFormat(const VertexFormat &a, const VertexFormat &b)
+{
+    if (a.stride() != b.stride())
+        return false;
+    for (int semantic = 0; semantic < VertexFormat::SemanticCount; ++semantic) {
+        VertexFormat::Semantic s = VertexFormat::Semantic(semantic);
+        if (a.size(s) != b.size(s) || (a.has(s) && (a.type(s) != b.type(s) || a.normalized(s) != b.normalized(s)
+                                                     || a.offset(s) != b.offset(s))))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef STATICBATCH_H
+#define STATICBATCH_H
+
+#include <vector>
+
+#include "scenegraph.h"
+
+namespace SceneGraph {
+
+    // Bakes a subtree of static geometry into a few large meshes, one per
+    // shader, texture and vertex format combination. The vertices of every
+    // mesh are transformed by the Transformation nodes above it, so a batch
+    // is drawn without walking the subtree or touching the matrix stack.
+    //
+    // Baking takes three steps. collect() walks the subtree. bake() does the
+    // CPU work; it touches neither GL nor the tree, so it can run on a worker
+    // thread. upload() creates the buffers on the GL thread. The subtree is
+    // drawn as usual until the batch has been uploaded, and must stay alive
+    // until then; the batches hold on to their shaders and textures, so the
+    // subtree may be deleted afterwards.
+    //
+    // Every source mesh keeps its own index range and bounds, so frustum
+    // culling still skips parts of a batch. Only GL_TRIANGLES meshes created
+    // with Mesh::RetainVertexData and float positions can be baked; any other
+    // node that changes state is skipped with a warning.
+    class StaticBatch : public Node
+    {
+    public:
+        StaticBatch(Node *parent = 0);
+        ~StaticBatch();
+
+        void execute(State *state);
+        bool visible(State *state);
+
+        void collect(State *state);
+        void bake();
+        void upload();
+        bool isBaked() const;
+        bool isUploaded() const;
+
+        unsigned int batchCount() const;
+        unsigned int sourceCount() const;
+
+    protected:
+        void calculateBounds(Bounds *bounds);
+
+    private:
+        enum { MaxTextureUnits = 32, MaxBatchVertices = 0x10000 };
+
+        struct Textures {
+            GLuint ids[MaxTextureUnits];
+        };
+
+        struct Source {
+            const Mesh *mesh;
+            float matrix[16];
+            unsigned int first; // index range in the batch
+            unsigned int count;
+            Bounds bounds;      // in the space of the batch
+        };
+
+        struct Batch {
+            const Shader *source_shader; // only compared, it may be gone after upload()
+            Shader *shader;              // a copy that shares the program
+            Textures textures;
+            VertexFormat format;
+            unsigned int vertex_count;
+            std::vector<unsigned int> sources;
+            std::vector<char> vertices;
+            std::vector<unsigned int> indices;
+            Mesh *mesh;
+        };
+
+        void clear();
+        void drawSources(const Batch &batch, State *state, Shader *shader, RenderQueue *queue);
+        void collectNode(Node *node, State *state, const float *matrix, Shader *shader, const Textures &textures);
+        void addSource(const Mesh *mesh, const float *matrix, Shader *shader, const Textures &textures);
+        void bakeSource(Source *source, Batch *batch);
+        static bool sameFormat(const VertexFormat &a, const VertexFormat &b);
+
+        std::vector<Source> m_sources;
+        std::vector<Batch> m_batches;
+        QAtomicInt m_baked;
+        bool m_uploaded;
+    };
+
+}; // SceneGraph
+
+#endif//STATICBATCH_H
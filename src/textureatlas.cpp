@@ -0,0 +1,255 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "textureatlas.h"
+#include "resourcemanager.h"
+
+#include <algorithm>
+
+using namespace SceneGraph;
+
+TextureAtlas::TextureAtlas(GLuint page_size, GLuint padding)
+    : m_page_size(page_size),
+      m_padding(padding),
+      m_images(0),
+      m_image_area(0)
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+    for (size_t i = 0; i < m_pages.size(); ++i)
+        ResourceManager::instance()->release(ResourceManager::Texture, m_pages[i].id);
+}
+
+TextureAtlas::Image TextureAtlas::add(GLuint width, GLuint height, const GLvoid *bits)
+{
+    Image image;
+    const GLuint padded_width = width + 2 * m_padding;
+    const GLuint padded_height = height + 2 * m_padding;
+    if (width == 0 || height == 0 || padded_width > m_page_size || padded_height > m_page_size) {
+        fprintf(stderr, "TextureAtlas: a %ux%u image does not fit on a page\n", width, height);
+        return image;
+    }
+
+    Rect rect;
+    size_t page = 0;
+    while (page < m_pages.size() && !place(&m_pages[page], padded_width, padded_height, &rect))
+        ++page;
+    if (page == m_pages.size()) {
+        Page empty;
+        empty.id = Texture2D::createTexture(m_page_size, m_page_size, GL_RGBA, 0);
+        reset(&empty);
+        m_pages.push_back(empty);
+        place(&m_pages.back(), padded_width, padded_height, &rect);
+    }
+    upload(m_pages[page], rect, width, height, bits);
+    ++m_pages[page].images;
+    ++m_images;
+    m_image_area += width * height;
+
+    image.page = page;
+    image.x = rect.x + m_padding;
+    image.y = rect.y + m_padding;
+    image.width = width;
+    image.height = height;
+    image.texuv_rect[0] = float(image.x) / m_page_size;
+    image.texuv_rect[1] = float(image.y) / m_page_size;
+    image.texuv_rect[2] = float(image.x + width) / m_page_size;
+    image.texuv_rect[3] = float(image.y + height) / m_page_size;
+    return image;
+}
+
+void TextureAtlas::remove(const Image &image)
+{
+    if (image.isNull() || image.page >= m_pages.size())
+        return;
+    Page &page = m_pages[image.page];
+    --m_images;
+    m_image_area -= image.width * image.height;
+    if (--page.images == 0) {
+        reset(&page);
+        return;
+    }
+    Rect rect;
+    rect.x = image.x - m_padding;
+    rect.y = image.y - m_padding;
+    rect.width = image.width + 2 * m_padding;
+    rect.height = image.height + 2 * m_padding;
+    page.free.push_back(rect);
+}
+
+void TextureAtlas::mapTexuvs(const Image &image, float *texuvs, unsigned int count)
+{
+    const float *rect = image.texuv_rect;
+    for (unsigned int i = 0; i < count; ++i) {
+        texuvs[i * 2] = rect[0] + texuvs[i * 2] * (rect[2] - rect[0]);
+        texuvs[i * 2 + 1] = rect[1] + texuvs[i * 2 + 1] * (rect[3] - rect[1]);
+    }
+}
+
+Texture2D *TextureAtlas::createTexture(unsigned int page, GLuint unit, Node *parent) const
+{
+    if (page >= m_pages.size())
+        return 0;
+    Texture2D *texture = new Texture2D(static_cast<Texture2D*>(0), parent);
+    texture->m_unit = unit;
+    // the page outlives the atlas while a texture uses it
+    ResourceManager::instance()->retain(ResourceManager::Texture, m_pages[page].id);
+    texture->setTexture(m_pages[page].id, true, m_page_size, m_page_size, size_t(m_page_size) * m_page_size * 4);
+    return texture;
+}
+
+unsigned int TextureAtlas::pageCount() const
+{
+    return m_pages.size();
+}
+
+GLuint TextureAtlas::pageSize() const
+{
+    return m_page_size;
+}
+
+GLuint TextureAtlas::pageTexture(unsigned int page) const
+{
+    return page < m_pages.size() ? m_pages[page].id : 0;
+}
+
+unsigned int TextureAtlas::imageCount() const
+{
+    return m_images;
+}
+
+float TextureAtlas::efficiency() const
+{
+    if (m_pages.empty())
+        return 0;
+    return float(m_image_area) / (float(m_page_size) * m_page_size * m_pages.size());
+}
+
+bool TextureAtlas::place(Page *page, GLuint width, GLuint height, Rect *rect)
+{
+    return placeFree(page, width, height, rect) || placeSkyline(page, width, height, rect);
+}
+
+bool TextureAtlas::placeFree(Page *page, GLuint width, GLuint height, Rect *rect)
+{
+    // the smallest hole that fits, split in two along its longer leftover
+    int best = -1;
+    for (size_t i = 0; i < page->free.size(); ++i) {
+        const Rect &hole = page->free[i];
+        if (hole.width >= width && hole.height >= height
+                && (best < 0 || hole.width * hole.height < page->free[best].width * page->free[best].height))
+            best = i;
+    }
+    if (best < 0)
+        return false;
+
+    const Rect hole = page->free[best];
+    page->free.erase(page->free.begin() + best);
+    rect->x = hole.x;
+    rect->y = hole.y;
+    rect->width = width;
+    rect->height = height;
+    Rect right = { hole.x + width, hole.y, hole.width - width, 0 };
+    Rect below = { hole.x, hole.y + height, 0, hole.height - height };
+    if (hole.width - width > hole.height - height) {
+        right.height = hole.height;
+        below.width = width;
+    } else {
+        right.height = height;
+        below.width = hole.width;
+    }
+    if (right.width > 0 && right.height > 0)
+        page->free.push_back(right);
+    if (below.width > 0 && below.height > 0)
+        page->free.push_back(below);
+    return true;
+}
+
+bool TextureAtlas::placeSkyline(Page *page, GLuint width, GLuint height, Rect *rect)
+{
+    std::vector<Segment> &skyline = page->skyline;
+    size_t best = skyline.size();
+    GLuint best_y = m_page_size;
+    for (size_t i = 0; i < skyline.size(); ++i) {
+        const GLuint x = skyline[i].x;
+        if (x + width > m_page_size)
+            break;
+        // the image rests on the highest segment below it
+        GLuint y = 0;
+        GLuint covered = 0;
+        for (size_t j = i; covered < width; ++j) {
+            y = std::max(y, skyline[j].y);
+            covered += skyline[j].width;
+        }
+        if (y + height <= m_page_size && y < best_y) {
+            best = i;
+            best_y = y;
+        }
+    }
+    if (best == skyline.size())
+        return false;
+
+    rect->x = skyline[best].x;
+    rect->y = best_y;
+    rect->width = width;
+    rect->height = height;
+
+    // raise the skyline under the image, cutting into the segments it covers
+    Segment segment = { rect->x, best_y + height, width };
+    skyline.insert(skyline.begin() + best, segment);
+    const GLuint right = rect->x + width;
+    size_t next = best + 1;
+    while (next < skyline.size() && skyline[next].x < right) {
+        const GLuint end = skyline[next].x + skyline[next].width;
+        if (end <= right) {
+            skyline.erase(skyline.begin() + next);
+        } else {
+            skyline[next].width = end - right;
+            skyline[next].x = right;
+            break;
+        }
+    }
+    // neighbours at the same height become one segment
+    for (size_t i = 0; i + 1 < skyline.size(); ) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        } else {
+            ++i;
+        }
+    }
+    return true;
+}
+
+void TextureAtlas::upload(const Page &page, const Rect &rect, GLuint width, GLuint height, const GLvoid *bits)
+{
+    // the padding repeats the edge pixels, all of it goes up in one call
+    const unsigned char *source = static_cast<const unsigned char*>(bits);
+    m_staging.resize(rect.width * rect.height * 4);
+    for (GLuint y = 0; y < rect.height; ++y) {
+        const GLuint source_y = std::min(y > m_padding ? y - m_padding : 0, height - 1);
+        const unsigned char *row = source + source_y * width * 4;
+        unsigned char *destination = &m_staging[y * rect.width * 4];
+        for (GLuint x = 0; x < rect.width; ++x) {
+            const GLuint source_x = std::min(x > m_padding ? x - m_padding : 0, width - 1);
+            memcpy(destination + x * 4, row + source_x * 4, 4);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, page.id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, GL_RGBA, GL_UNSIGNED_BYTE, &m_staging[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void TextureAtlas::reset(Page *page)
+{
+    Segment segment = { 0, 0, m_page_size };
+    page->skyline.assign(1, segment);
+    page->free.clear();
+    page->images = 0;
+}
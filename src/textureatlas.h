@@ -0,0 +1,94 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+
+#include <vector>
+
+#include "scenegraph.h"
+
+namespace SceneGraph {
+
+    // Packs many small RGBA images into a few large textures, the pages. An
+    // image is placed with the skyline bottom-left heuristic and surrounded
+    // by padding, filled with its edge pixels so linear filtering does not
+    // bleed in from the neighbours. The space of removed images is reused
+    // for new ones, and a page that runs empty starts over.
+    //
+    // add() returns a small handle with the page and the texuv rect of the
+    // image. mapTexuvs() moves texuvs in [0, 1] into that rect, before they
+    // are handed to a Mesh; the rect is then part of the vertices, so the
+    // default shader, RenderQueue, RenderList and StaticBatch need nothing
+    // extra. Putting every mesh of a page below the one Texture2D from
+    // createTexture() leaves a single bind per page.
+    //
+    // The atlas owns the pages and must outlive the textures it creates.
+    class TextureAtlas : protected Rasterizer
+    {
+    public:
+        struct Image {
+            Image() : page(~0u), x(0), y(0), width(0), height(0) { texuv_rect[0] = texuv_rect[1] = texuv_rect[2] = texuv_rect[3] = 0; }
+            bool isNull() const { return page == ~0u; }
+
+            unsigned int page;
+            GLuint x, y, width, height; // in pixels, without the padding
+            float texuv_rect[4];        // left, top, right, bottom
+        };
+
+        TextureAtlas(GLuint page_size = 1024, GLuint padding = 1);
+        ~TextureAtlas();
+
+        // bits are RGBA, tightly packed; a null image if it does not fit on a page
+        Image add(GLuint width, GLuint height, const GLvoid *bits);
+        void remove(const Image &image);
+
+        // in place, count pairs of texuvs
+        static void mapTexuvs(const Image &image, float *texuvs, unsigned int count);
+
+        // a node sharing the texture of the page
+        Texture2D *createTexture(unsigned int page, GLuint unit = 0, Node *parent = 0) const;
+
+        unsigned int pageCount() const;
+        GLuint pageSize() const;
+        GLuint pageTexture(unsigned int page) const;
+        unsigned int imageCount() const;
+        float efficiency() const; // area of the images over the area of the pages
+
+    private:
+        struct Segment {
+            GLuint x, y, width;
+        };
+
+        struct Rect {
+            GLuint x, y, width, height;
+        };
+
+        struct Page {
+            GLuint id;
+            std::vector<Segment> skyline;
+            std::vector<Rect> free; // left behind by removed images
+            unsigned int images;
+        };
+
+        bool place(Page *page, GLuint width, GLuint height, Rect *rect);
+        bool placeFree(Page *page, GLuint width, GLuint height, Rect *rect);
+        bool placeSkyline(Page *page, GLuint width, GLuint height, Rect *rect);
+        void upload(const Page &page, const Rect &rect, GLuint width, GLuint height, const GLvoid *bits);
+        void reset(Page *page);
+
+        GLuint m_page_size;
+        GLuint m_padding;
+        std::vector<Page> m_pages;
+        std::vector<unsigned char> m_staging;
+        unsigned int m_images;
+        unsigned long m_image_area;
+    };
+
+}; // SceneGraph
+
+#endif//TEXTUREATLAS_H
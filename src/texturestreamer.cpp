@@ -0,0 +1,325 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "texturestreamer.h"
+#include "resourcemanager.h"
+
+#include <algorithm>
+
+using namespace SceneGraph;
+
+class TextureStreamer::Worker : public QThread
+{
+public:
+    Worker(TextureStreamer *streamer)
+        : m_streamer(streamer) {}
+
+protected:
+    void run()
+    {
+        for (;;) {
+            Request *request = 0;
+            {
+                QMutexLocker locker(&m_streamer->m_mutex);
+                while (!m_streamer->m_quit && m_streamer->m_decode.empty())
+                    m_streamer->m_wake.wait(&m_streamer->m_mutex);
+                if (m_streamer->m_quit)
+                    return;
+                request = m_streamer->m_decode.front();
+                m_streamer->m_decode.pop_front();
+                m_streamer->m_decoding.push_back(request);
+            }
+            m_streamer->decode(request);
+            QMutexLocker locker(&m_streamer->m_mutex);
+            std::vector<Request*> &decoding = m_streamer->m_decoding;
+            decoding.erase(std::find(decoding.begin(), decoding.end(), request));
+            m_streamer->m_decoded.push_back(request);
+        }
+    }
+
+private:
+    TextureStreamer *m_streamer;
+};
+
+TextureStreamer::TextureStreamer(unsigned int threads)
+    : m_quit(false),
+      m_pending(0),
+      m_placeholder(0),
+      m_pixel_buffer(0),
+      m_budget_bytes(1024 * 1024),
+      m_budget_microseconds(2000),
+      m_last_upload_time(0),
+      m_max_upload_time(0),
+      m_max_frame_time(0),
+      m_uploaded_bytes(0)
+{
+    for (unsigned int i = 0; i < qMax(threads, 1u); ++i) {
+        m_workers.push_back(new Worker(this));
+        m_workers.back()->start();
+    }
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_quit = true;
+        m_wake.wakeAll();
+    }
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->wait();
+        delete m_workers[i];
+    }
+
+    // the textures that are still loading keep their preview, if any
+    ResourceManager *resources = ResourceManager::instance();
+    std::vector<Request*> requests(m_decode.begin(), m_decode.end());
+    requests.insert(requests.end(), m_decoded.begin(), m_decoded.end());
+    requests.insert(requests.end(), m_uploads.begin(), m_uploads.end());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        Request *request = requests[i];
+        if (Texture2D *texture = request->texture) {
+            texture->m_streamer = 0;
+            if (texture->m_id == m_placeholder)
+                texture->setTexture(0, false, 0, 0, 0);
+        }
+        resources->release(ResourceManager::Texture, request->id);
+        delete request;
+    }
+    resources->release(ResourceManager::Texture, m_placeholder);
+    resources->release(ResourceManager::Buffer, m_pixel_buffer);
+}
+
+Texture2D *TextureStreamer::load(const QString &file, GLuint unit, Node *parent, Callback callback, void *user)
+{
+    Request *request = new Request;
+    request->file = file;
+    request->callback = callback;
+    request->user = user;
+    return enqueue(request, unit, parent);
+}
+
+Texture2D *TextureStreamer::load(const QImage &image, GLuint unit, Node *parent, Callback callback, void *user)
+{
+    Request *request = new Request;
+    request->image = image; // shared, the conversion happens on the worker
+    request->callback = callback;
+    request->user = user;
+    return enqueue(request, unit, parent);
+}
+
+Texture2D *TextureStreamer::enqueue(Request *request, GLuint unit, Node *parent)
+{
+    if (!m_placeholder) {
+        const unsigned char grey[4] = { 128, 128, 128, 255 };
+        m_placeholder = Texture2D::createTexture(1, 1, GL_RGBA, grey);
+    }
+    Texture2D *texture = new Texture2D(static_cast<Texture2D*>(0), parent);
+    texture->m_unit = unit;
+    // every texture holds a reference, failed ones keep the placeholder after the streamer is gone
+    ResourceManager::instance()->retain(ResourceManager::Texture, m_placeholder);
+    texture->setTexture(m_placeholder, true, 1, 1, 4);
+    texture->m_streamer = this;
+
+    request->texture = texture;
+    request->id = 0;
+    request->row = 0;
+    request->failed = false;
+    ++m_pending;
+    QMutexLocker locker(&m_mutex);
+    m_decode.push_back(request);
+    m_wake.wakeOne();
+    return texture;
+}
+
+void TextureStreamer::cancel(Texture2D *texture)
+{
+    --m_pending;
+    QMutexLocker locker(&m_mutex);
+    for (size_t i = 0; i < m_decode.size(); ++i) {
+        if (m_decode[i]->texture == texture) {
+            delete m_decode[i];
+            m_decode.erase(m_decode.begin() + i);
+            return;
+        }
+    }
+    // the rest is dropped by update()
+    for (size_t i = 0; i < m_decoding.size(); ++i) {
+        if (m_decoding[i]->texture == texture)
+            m_decoding[i]->texture = 0;
+    }
+    for (size_t i = 0; i < m_decoded.size(); ++i) {
+        if (m_decoded[i]->texture == texture)
+            m_decoded[i]->texture = 0;
+    }
+    for (size_t i = 0; i < m_uploads.size(); ++i) {
+        if (m_uploads[i]->texture == texture)
+            m_uploads[i]->texture = 0;
+    }
+}
+
+void TextureStreamer::decode(Request *request)
+{
+    // worker thread; only the image fields are ours
+    QImage image = request->file.isEmpty() ? request->image : QImage(request->file);
+    if (image.isNull()) {
+        request->failed = true;
+        return;
+    }
+    request->image = image.convertToFormat(QImage::Format_RGBA8888);
+    if (image.width() > PreviewSize || image.height() > PreviewSize)
+        request->preview = request->image.scaled(PreviewSize, PreviewSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+void TextureStreamer::update()
+{
+    if (m_frame_timer.isValid() && m_pending > 0)
+        m_max_frame_time = qMax(m_max_frame_time, m_frame_timer.nsecsElapsed() / 1000000.0f);
+    m_frame_timer.start();
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<Request*> decoded;
+    {
+        QMutexLocker locker(&m_mutex);
+        decoded.swap(m_decoded);
+    }
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        Request *request = decoded[i];
+        if (!request->texture) {
+            delete request;
+        } else if (request->failed) {
+            fprintf(stderr, "TextureStreamer: could not load an image\n");
+            finish(request, false);
+        } else {
+            // small enough to go up in one piece
+            const QImage &preview = request->preview;
+            if (!preview.isNull()) {
+                const GLuint id = Texture2D::createTexture(preview.width(), preview.height(), GL_RGBA, preview.constBits());
+                request->texture->setTexture(id, true, preview.width(), preview.height(), size_t(preview.width()) * preview.height() * 4);
+            }
+            request->preview = QImage();
+            request->id = Texture2D::createTexture(request->image.width(), request->image.height(), GL_RGBA, 0);
+            m_uploads.push_back(request);
+        }
+    }
+
+    unsigned int bytes = 0;
+    while (!m_uploads.empty()) {
+        Request *request = m_uploads.front();
+        if (request->texture && !upload(request, &bytes, timer))
+            break;
+        m_uploads.pop_front();
+        if (request->texture) {
+            finish(request, true);
+        } else {
+            ResourceManager::instance()->release(ResourceManager::Texture, request->id);
+            delete request;
+        }
+    }
+
+    if (bytes > 0 || !decoded.empty()) {
+        m_last_upload_time = timer.nsecsElapsed() / 1000000.0f;
+        m_max_upload_time = qMax(m_max_upload_time, m_last_upload_time);
+    } else {
+        m_last_upload_time = 0;
+    }
+    m_uploaded_bytes += bytes;
+}
+
+bool TextureStreamer::upload(Request *request, unsigned int *bytes, const QElapsedTimer &timer)
+{
+    const QImage &image = request->image;
+    const unsigned int stride = image.width() * 4;
+    while (request->row < image.height()) {
+        if (*bytes > 0 && (*bytes >= m_budget_bytes || timer.nsecsElapsed() >= qint64(m_budget_microseconds) * 1000))
+            return false;
+        const unsigned int left = m_budget_bytes > *bytes ? m_budget_bytes - *bytes : 0;
+        const int rows = std::min(qMax(int(left / stride), 1), image.height() - request->row);
+        const GLsizeiptr size = GLsizeiptr(rows) * stride;
+        const GLvoid *bits = image.constScanLine(request->row);
+
+        glBindTexture(GL_TEXTURE_2D, request->id);
+        if (hasPixelBufferObjects()) {
+            if (!m_pixel_buffer)
+                m_pixel_buffer = ResourceManager::instance()->createBuffer(0, GL_STREAM_DRAW);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixel_buffer);
+            // orphaned every time, so the driver never waits for the last stripe
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW);
+            if (void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT)) {
+                memcpy(mapped, bits, size);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                bits = 0; // an offset into the buffer
+            } else {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, request->row, image.width(), rows, GL_RGBA, GL_UNSIGNED_BYTE, bits);
+        if (hasPixelBufferObjects())
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        request->row += rows;
+        *bytes += size;
+    }
+    return true;
+}
+
+void TextureStreamer::finish(Request *request, bool loaded)
+{
+    Texture2D *texture = request->texture;
+    if (loaded)
+        texture->setTexture(request->id, true, request->image.width(), request->image.height(),
+                            size_t(request->image.width()) * request->image.height() * 4);
+    else
+        ResourceManager::instance()->release(ResourceManager::Texture, request->id);
+    texture->m_streamer = 0;
+    --m_pending;
+    // may delete the texture or load another one
+    if (request->callback)
+        request->callback(texture, loaded, request->user);
+    delete request;
+}
+
+void TextureStreamer::setFrameBudget(unsigned int bytes, unsigned int microseconds)
+{
+    m_budget_bytes = bytes;
+    m_budget_microseconds = microseconds;
+}
+
+unsigned int TextureStreamer::pendingCount() const
+{
+    return m_pending;
+}
+
+float TextureStreamer::lastUploadTime() const
+{
+    return m_last_upload_time;
+}
+
+float TextureStreamer::maxUploadTime() const
+{
+    return m_max_upload_time;
+}
+
+float TextureStreamer::maxFrameTime() const
+{
+    return m_max_frame_time;
+}
+
+unsigned int TextureStreamer::uploadedBytes() const
+{
+    return m_uploaded_bytes;
+}
+
+void TextureStreamer::resetMetrics()
+{
+    m_last_upload_time = 0;
+    m_max_upload_time = 0;
+    m_max_frame_time = 0;
+    m_uploaded_bytes = 0;
+}
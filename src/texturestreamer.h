@@ -0,0 +1,106 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include <deque>
+#include <vector>
+
+#include <QtCore>
+#include <QImage>
+
+#include "scenegraph.h"
+
+namespace SceneGraph {
+
+    // Loads textures without stalling the frame. load() returns a Texture2D
+    // right away, bound to a grey placeholder. The image is decoded on a
+    // worker thread, then update() uploads it a few rows at a time within a
+    // per frame budget, through a pixel buffer object where the context has
+    // them. A small preview goes up in one piece first and stands in until
+    // the whole image is resident, when the node switches to the full
+    // texture and the callback is called.
+    //
+    // load(), update() and deleting the textures happen on the thread that
+    // owns the GL context; update() is meant to be called once per frame,
+    // before State::execute(). A texture deleted while it is loading is
+    // dropped from the queue.
+    class TextureStreamer : protected Rasterizer
+    {
+    public:
+        // called from update() once the texture is resident, or failed to load
+        typedef void (*Callback)(Texture2D *texture, bool loaded, void *user);
+
+        TextureStreamer(unsigned int threads = 1);
+        ~TextureStreamer();
+
+        Texture2D *load(const QString &file, GLuint unit = 0, Node *parent = 0, Callback callback = 0, void *user = 0);
+        Texture2D *load(const QImage &image, GLuint unit = 0, Node *parent = 0, Callback callback = 0, void *user = 0);
+
+        void update();
+
+        // uploads stop for the frame once either budget is spent, after at least one stripe
+        void setFrameBudget(unsigned int bytes, unsigned int microseconds);
+        unsigned int pendingCount() const;
+
+        // hitch metrics, in milliseconds, over the frames that had work to do
+        float lastUploadTime() const;
+        float maxUploadTime() const;
+        float maxFrameTime() const; // between two calls to update()
+        unsigned int uploadedBytes() const; // since resetMetrics()
+        void resetMetrics();
+
+    private:
+        friend class Texture2D;
+        class Worker;
+        friend class Worker;
+
+        enum { PreviewSize = 64 }; // larger images get a preview that fits in this
+
+        struct Request {
+            Texture2D *texture; // 0 once cancelled
+            QString file;
+            QImage image;
+            QImage preview;
+            Callback callback;
+            void *user;
+            GLuint id;
+            int row;
+            bool failed;
+        };
+
+        Texture2D *enqueue(Request *request, GLuint unit, Node *parent);
+        void cancel(Texture2D *texture);
+        void decode(Request *request);
+        bool upload(Request *request, unsigned int *bytes, const QElapsedTimer &timer);
+        void finish(Request *request, bool loaded);
+
+        std::vector<Worker*> m_workers;
+        mutable QMutex m_mutex;
+        QWaitCondition m_wake;
+        std::deque<Request*> m_decode; // guarded by m_mutex, as is the rest of the decoder side
+        std::vector<Request*> m_decoded;
+        std::vector<Request*> m_decoding;
+        bool m_quit;
+
+        std::deque<Request*> m_uploads; // render thread only
+        unsigned int m_pending;
+        GLuint m_placeholder;
+        GLuint m_pixel_buffer;
+        unsigned int m_budget_bytes;
+        unsigned int m_budget_microseconds;
+        QElapsedTimer m_frame_timer;
+        float m_last_upload_time;
+        float m_max_upload_time;
+        float m_max_frame_time;
+        unsigned int m_uploaded_bytes;
+    };
+
+}; // SceneGraph
+
+#endif//TEXTURESTREAMER_H
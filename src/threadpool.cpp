@@ -0,0 +1,154 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "threadpool.h"
+
+using namespace SceneGraph;
+
+class ThreadPool::Worker : public QThread
+{
+public:
+    Worker(ThreadPool *pool, unsigned int index)
+        : m_pool(pool), m_index(index) {}
+
+protected:
+    void run()
+    {
+        unsigned int generation = 0;
+        for (;;) {
+            {
+                QMutexLocker locker(&m_pool->m_mutex);
+                while (!m_pool->m_quit && m_pool->m_generation == generation)
+                    m_pool->m_started.wait(&m_pool->m_mutex);
+                if (m_pool->m_quit)
+                    return;
+                generation = m_pool->m_generation;
+            }
+            m_pool->work(m_index);
+            QMutexLocker locker(&m_pool->m_mutex);
+            if (--m_pool->m_busy == 0)
+                m_pool->m_finished.wakeAll();
+        }
+    }
+
+private:
+    ThreadPool *m_pool;
+    unsigned int m_index;
+};
+
+ThreadPool::ThreadPool(unsigned int workers)
+    : m_pending(0),
+      m_generation(0),
+      m_busy(0),
+      m_caller(0),
+      m_quit(false)
+{
+    if (workers == 0)
+        workers = qMax(QThread::idealThreadCount(), 1);
+    for (unsigned int i = 0; i < workers; ++i)
+        m_queues.push_back(new Queue);
+    // worker 0 is whoever calls run()
+    for (unsigned int i = 1; i < workers; ++i) {
+        m_workers.push_back(new Worker(this, i));
+        m_workers.back()->start();
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_quit = true;
+        m_started.wakeAll();
+    }
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->wait();
+        delete m_workers[i];
+    }
+    for (size_t i = 0; i < m_queues.size(); ++i)
+        delete m_queues[i];
+}
+
+unsigned int ThreadPool::workerCount() const
+{
+    return m_queues.size();
+}
+
+int ThreadPool::currentWorker() const
+{
+    QThread *thread = QThread::currentThread();
+    if (thread == m_caller)
+        return 0;
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        if (m_workers[i] == thread)
+            return i + 1;
+    }
+    return -1;
+}
+
+void ThreadPool::push(Job *job, unsigned int worker)
+{
+    // counted before it can be taken, so the count never drops to zero early
+    m_pending.ref();
+    Queue *queue = m_queues[worker < m_queues.size() ? worker : 0];
+    QMutexLocker locker(&queue->mutex);
+    queue->jobs.push_back(job);
+}
+
+void ThreadPool::run()
+{
+    if (m_pending.loadAcquire() == 0)
+        return;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_caller = QThread::currentThread();
+        m_busy = m_workers.size();
+        ++m_generation;
+        m_started.wakeAll();
+    }
+    work(0);
+    // the workers may still be looking for jobs
+    QMutexLocker locker(&m_mutex);
+    while (m_busy > 0)
+        m_finished.wait(&m_mutex);
+    m_caller = 0;
+}
+
+ThreadPool::Job *ThreadPool::take(unsigned int worker)
+{
+    {
+        Queue *queue = m_queues[worker];
+        QMutexLocker locker(&queue->mutex);
+        if (!queue->jobs.empty()) {
+            Job *job = queue->jobs.back();
+            queue->jobs.pop_back();
+            return job;
+        }
+    }
+    for (size_t i = 1; i < m_queues.size(); ++i) {
+        Queue *queue = m_queues[(worker + i) % m_queues.size()];
+        QMutexLocker locker(&queue->mutex);
+        if (!queue->jobs.empty()) {
+            Job *job = queue->jobs.front();
+            queue->jobs.pop_front();
+            return job;
+        }
+    }
+    return 0;
+}
+
+void ThreadPool::work(unsigned int worker)
+{
+    while (m_pending.loadAcquire() > 0) {
+        if (Job *job = take(worker)) {
+            job->run(this, worker);
+            m_pending.deref();
+        } else {
+            QThread::yieldCurrentThread();
+        }
+    }
+}
@@ -0,0 +1,73 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <deque>
+#include <vector>
+
+#include <QtCore>
+
+namespace SceneGraph {
+
+    // A fixed set of worker threads with a job deque each. A worker takes the
+    // newest job from its own deque and, when that runs dry, steals the
+    // oldest one from another worker. Jobs that push more jobs keep working
+    // on the data they just touched, while idle workers pick up the bigger,
+    // older pieces.
+    //
+    // run() lends the calling thread to the pool as worker 0 and returns once
+    // every job has finished, including the ones pushed by other jobs. The
+    // pool does not own the jobs.
+    class ThreadPool
+    {
+    public:
+        class Job
+        {
+        public:
+            virtual ~Job() {}
+            virtual void run(ThreadPool *pool, unsigned int worker) = 0;
+        };
+
+        ThreadPool(unsigned int workers = 0); // 0 picks QThread::idealThreadCount()
+        ~ThreadPool();
+
+        unsigned int workerCount() const;
+        int currentWorker() const; // -1 if not called from a job
+
+        // from a job, push to its own worker; from outside, to worker 0
+        void push(Job *job, unsigned int worker = 0);
+        void run();
+
+    private:
+        class Worker;
+        friend class Worker;
+
+        struct Queue {
+            QMutex mutex;
+            std::deque<Job*> jobs;
+        };
+
+        Job *take(unsigned int worker);
+        void work(unsigned int worker);
+
+        std::vector<Queue*> m_queues;
+        std::vector<Worker*> m_workers;
+        QAtomicInt m_pending;
+        QMutex m_mutex;
+        QWaitCondition m_started;
+        QWaitCondition m_finished;
+        unsigned int m_generation;
+        unsigned int m_busy;
+        QThread *m_caller;
+        bool m_quit;
+    };
+
+}; // SceneGraph
+
+#endif//THREADPOOL_H
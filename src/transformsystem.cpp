@@ -0,0 +1,241 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include "transformsystem.h"
+#include "scenegraph.h"
+#include "simd.h"
+
+using namespace SceneGraph;
+
+TransformSystem *TransformSystem::instance()
+{
+    static TransformSystem system;
+    return &system;
+}
+
+TransformSystem::TransformSystem()
+    : m_locals(0),
+      m_worlds(0),
+      m_count(0),
+      m_capacity(0),
+      m_free(0),
+      m_updated(0),
+      m_unordered(false)
+{
+}
+
+TransformSystem::~TransformSystem()
+{
+    qFreeAligned(m_locals);
+    qFreeAligned(m_worlds);
+}
+
+void TransformSystem::reserve(unsigned int capacity)
+{
+    const size_t size = capacity * 16 * sizeof(float);
+    const size_t old_size = m_capacity * 16 * sizeof(float);
+    m_locals = static_cast<float*>(qReallocAligned(m_locals, size, old_size, 16));
+    m_worlds = static_cast<float*>(qReallocAligned(m_worlds, size, old_size, 16));
+    m_parents.resize(capacity);
+    m_versions.resize(capacity);
+    m_parent_versions.resize(capacity);
+    m_flags.resize(capacity);
+    m_owners.resize(capacity);
+    m_capacity = capacity;
+}
+
+unsigned int TransformSystem::create(Transformation *owner, int parent, const float *matrix)
+{
+    if (m_count == m_capacity)
+        reserve(m_capacity ? m_capacity * 2 : 64);
+    // appending keeps every parent in front of its children
+    const unsigned int index = m_count++;
+    memcpy(m_locals + index * 16, matrix, sizeof(float) * 16);
+    m_parents[index] = parent;
+    m_versions[index] = 0;
+    m_parent_versions[index] = 0;
+    m_flags[index] = Used;
+    m_owners[index] = owner;
+    return index;
+}
+
+void TransformSystem::destroy(unsigned int index)
+{
+    // the slot stays until the next compaction, its children may still refer to it
+    m_flags[index] = 0;
+    m_owners[index] = 0;
+    ++m_free;
+}
+
+void TransformSystem::setParent(unsigned int index, int parent)
+{
+    m_parents[index] = parent;
+    m_flags[index] &= ~Valid;
+    // the linear pass needs the parent first
+    if (parent > int(index))
+        m_unordered = true;
+}
+
+void TransformSystem::update()
+{
+    if (m_unordered || (m_free > 0 && m_free * 4 >= m_count))
+        compact();
+    const MathKernels &kernels = math_kernels();
+    unsigned int version = 0;
+    unsigned int versions_left = 0;
+    m_updated = 0;
+    for (unsigned int i = 0; i < m_count; ++i) {
+        if (!(m_flags[i] & Used))
+            continue;
+        const int parent = m_parents[i];
+        const unsigned int parent_version = parent >= 0 ? m_versions[parent] : 0;
+        if ((m_flags[i] & Valid) && m_parent_versions[i] == parent_version)
+            continue;
+        if (parent >= 0)
+            kernels.multiply_matrices(m_worlds + parent * 16, m_locals + i * 16, m_worlds + i * 16);
+        else
+            memcpy(m_worlds + i * 16, m_locals + i * 16, sizeof(float) * 16);
+        if (versions_left == 0) {
+            // one atomic operation per block instead of per matrix
+            version = State::createMatrixVersions(VersionBlock);
+            versions_left = VersionBlock;
+        }
+        m_versions[i] = version++;
+        --versions_left;
+        m_parent_versions[i] = parent_version;
+        m_flags[i] |= Valid;
+        ++m_updated;
+    }
+}
+
+void TransformSystem::compact()
+{
+    // skip over removed parents
+    std::vector<int> parents(m_count, -1);
+    for (unsigned int i = 0; i < m_count; ++i) {
+        int parent = m_parents[i];
+        while (parent >= 0 && !(m_flags[parent] & Used))
+            parent = m_parents[parent];
+        parents[i] = parent;
+    }
+
+    // children of every transform, bucket 0 holds the roots
+    std::vector<unsigned int> first(m_count + 2, 0);
+    for (unsigned int i = 0; i < m_count; ++i) {
+        if (m_flags[i] & Used)
+            ++first[parents[i] + 2];
+    }
+    for (unsigned int b = 1; b < first.size(); ++b)
+        first[b] += first[b - 1];
+    std::vector<unsigned int> fill(first.begin(), first.end() - 1);
+    std::vector<unsigned int> children(m_count - m_free);
+    for (unsigned int i = 0; i < m_count; ++i) {
+        if (m_flags[i] & Used)
+            children[fill[parents[i] + 1]++] = i;
+    }
+
+    // depth first, keeping the siblings in their current order
+    std::vector<unsigned int> order;
+    order.reserve(children.size());
+    std::vector<unsigned int> stack;
+    for (unsigned int c = first[1]; c > first[0]; --c)
+        stack.push_back(children[c - 1]);
+    while (!stack.empty()) {
+        const unsigned int index = stack.back();
+        stack.pop_back();
+        order.push_back(index);
+        for (unsigned int c = first[index + 2]; c > first[index + 1]; --c)
+            stack.push_back(children[c - 1]);
+    }
+
+    std::vector<int> remap(m_count, -1);
+    for (unsigned int i = 0; i < order.size(); ++i)
+        remap[order[i]] = i;
+
+    float *locals = static_cast<float*>(qMallocAligned(m_capacity * 16 * sizeof(float), 16));
+    float *worlds = static_cast<float*>(qMallocAligned(m_capacity * 16 * sizeof(float), 16));
+    std::vector<int> new_parents(m_capacity);
+    std::vector<unsigned int> versions(m_capacity);
+    std::vector<unsigned int> parent_versions(m_capacity);
+    std::vector<unsigned char> flags(m_capacity, 0);
+    std::vector<Transformation*> owners(m_capacity, static_cast<Transformation*>(0));
+    for (unsigned int i = 0; i < order.size(); ++i) {
+        const unsigned int old = order[i];
+        memcpy(locals + i * 16, m_locals + old * 16, sizeof(float) * 16);
+        memcpy(worlds + i * 16, m_worlds + old * 16, sizeof(float) * 16);
+        new_parents[i] = parents[old] >= 0 ? remap[parents[old]] : -1;
+        versions[i] = m_versions[old];
+        parent_versions[i] = m_parent_versions[old];
+        flags[i] = m_flags[old];
+        owners[i] = m_owners[old];
+        owners[i]->m_transform = i;
+    }
+    qFreeAligned(m_locals);
+    qFreeAligned(m_worlds);
+    m_locals = locals;
+    m_worlds = worlds;
+    m_parents.swap(new_parents);
+    m_versions.swap(versions);
+    m_parent_versions.swap(parent_versions);
+    m_flags.swap(flags);
+    m_owners.swap(owners);
+    m_count = order.size();
+    m_free = 0;
+    m_unordered = false;
+}
+
+unsigned int TransformSystem::count() const
+{
+    return m_count;
+}
+
+unsigned int TransformSystem::freeCount() const
+{
+    return m_free;
+}
+
+unsigned int TransformSystem::updatedCount() const
+{
+    return m_updated;
+}
+
+float *TransformSystem::localMatrix(unsigned int index)
+{
+    return m_locals + index * 16;
+}
+
+void TransformSystem::setLocalMatrix(unsigned int index, const float *matrix)
+{
+    memcpy(m_locals + index * 16, matrix, sizeof(float) * 16);
+    m_flags[index] &= ~Valid;
+}
+
+const float *TransformSystem::cachedWorldMatrix(unsigned int index, unsigned int parent_version, unsigned int *version) const
+{
+    if (!(m_flags[index] & Valid) || m_parent_versions[index] != parent_version)
+        return 0;
+    *version = m_versions[index];
+    return m_worlds + index * 16;
+}
+
+void TransformSystem::setWorldMatrix(unsigned int index, const float *matrix, unsigned int version, unsigned int parent_version)
+{
+    memcpy(m_worlds + index * 16, matrix, sizeof(float) * 16);
+    m_versions[index] = version;
+    m_parent_versions[index] = parent_version;
+    m_flags[index] |= Valid;
+}
+
+const float *TransformSystem::worldMatrix(unsigned int index) const
+{
+    return m_worlds + index * 16;
+}
+
+unsigned int TransformSystem::worldVersion(unsigned int index) const
+{
+    return (m_flags[index] & Valid) ? m_versions[index] : 0;
+}
@@ -0,0 +1,87 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#ifndef TRANSFORMSYSTEM_H
+#define TRANSFORMSYSTEM_H
+
+#include <vector>
+
+namespace SceneGraph {
+
+    class Transformation;
+
+    // The storage behind every Transformation node. The parent indices, the
+    // local and world matrices, their versions and the dirty bits are kept
+    // in parallel arrays instead of in the nodes. A parent always comes
+    // before its children, so update() brings all world matrices up to date
+    // in a single pass from front to back. The traversal then only copies
+    // them onto the matrix stack.
+    //
+    // The world matrices of update() are relative to the identity, which is
+    // what State::reset() leaves on the stack. A Transformation that is
+    // drawn on top of some other matrix computes its own world matrix during
+    // the traversal, as before.
+    //
+    // Removed transforms leave holes. Once there are enough of them, or a
+    // moved transform ends up in front of its new parent, the next update()
+    // compacts the arrays and puts them into depth first order. Transforms
+    // are created and removed together with their nodes, on the thread that
+    // builds the tree.
+    class TransformSystem
+    {
+    public:
+        static TransformSystem *instance();
+
+        TransformSystem();
+        ~TransformSystem();
+
+        // parent is the index of the nearest Transformation above, or -1
+        unsigned int create(Transformation *owner, int parent, const float *matrix);
+        void destroy(unsigned int index);
+        void setParent(unsigned int index, int parent); // after the node was moved
+
+        void update();
+        void compact();
+
+        unsigned int count() const;      // including the holes
+        unsigned int freeCount() const;
+        unsigned int updatedCount() const; // world matrices recomputed by the last update()
+
+        float *localMatrix(unsigned int index);
+        void setLocalMatrix(unsigned int index, const float *matrix);
+
+        // the world matrix if it was computed on top of the given parent
+        // version, else 0
+        const float *cachedWorldMatrix(unsigned int index, unsigned int parent_version, unsigned int *version) const;
+        void setWorldMatrix(unsigned int index, const float *matrix, unsigned int version, unsigned int parent_version);
+        const float *worldMatrix(unsigned int index) const;
+        unsigned int worldVersion(unsigned int index) const;
+
+    private:
+        enum Flags { Used = 1, Valid = 2 };
+        enum { VersionBlock = 256 };
+
+        void reserve(unsigned int capacity);
+
+        // 16 byte aligned, 16 floats per transform
+        float *m_locals;
+        float *m_worlds;
+        std::vector<int> m_parents;
+        std::vector<unsigned int> m_versions;
+        std::vector<unsigned int> m_parent_versions;
+        std::vector<unsigned char> m_flags;
+        std::vector<Transformation*> m_owners;
+        unsigned int m_count;
+        unsigned int m_capacity;
+        unsigned int m_free;
+        unsigned int m_updated;
+        bool m_unordered;
+    };
+
+}; // SceneGraph
+
+#endif//TRANSFORMSYSTEM_H
@@ -0,0 +1,79 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include <QtTest>
+
+#include "scenegraph.h"
+
+using namespace SceneGraph;
+
+class tst_MatrixStack : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void noAllocationsAfterWarmUp();
+    void frame();
+
+private:
+    enum { Depth = 64 };
+    static void simulateFrame(State *state);
+};
+
+static const float translation[16] = {
+    1, 0, 0, 0,
+    0, 1, 0, 0,
+    0, 0, 1, 0,
+    1, 2, 3, 1 };
+
+// what a traversal does: one push and multiply per level, popped on the way back
+void tst_MatrixStack::simulateFrame(State *state)
+{
+    state->reset();
+    for (int level = 0; level < Depth; ++level) {
+        state->pushMatrix();
+        state->multiplyMatrix(translation);
+    }
+    for (int level = 0; level < Depth; ++level)
+        state->popMatrix();
+}
+
+void tst_MatrixStack::noAllocationsAfterWarmUp()
+{
+    State state;
+    simulateFrame(&state);
+    const unsigned int allocations = state.matrixAllocations();
+    QVERIFY(allocations > 0);
+
+    for (int frame = 0; frame < 1000; ++frame) {
+        simulateFrame(&state);
+        QCOMPARE(state.matrixAllocations(), allocations);
+    }
+
+    // the stack still holds the right values
+    for (int level = 0; level < Depth; ++level) {
+        state.pushMatrix();
+        state.multiplyMatrix(translation);
+    }
+    QCOMPARE(state.currentMatrix()[12], float(Depth));
+    QCOMPARE(state.currentMatrix()[13], float(Depth * 2));
+    QCOMPARE(state.currentMatrix()[14], float(Depth * 3));
+    QCOMPARE(state.matrixAllocations(), allocations);
+}
+
+void tst_MatrixStack::frame()
+{
+    State state;
+    simulateFrame(&state);
+    QBENCHMARK {
+        simulateFrame(&state);
+    }
+}
+
+QTEST_APPLESS_MAIN(tst_MatrixStack)
+
+#include "tst_matrixstack.moc"
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = tst_meshoptimizer
+CONFIG += console testcase
+CONFIG -= app_bundle
+QT += testlib opengl
+INCLUDEPATH += ../../src
+LIBS += -L$$OUT_PWD/../../lib -lscenegraph
+unix:PRE_TARGETDEPS += $$OUT_PWD/../../lib/libscenegraph.a
+SOURCES += tst_meshoptimizer.cpp
+
+test.commands = ./$$TARGET
+QMAKE_EXTRA_TARGETS += test
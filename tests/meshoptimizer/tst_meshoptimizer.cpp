@@ -0,0 +1,127 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include <QtTest>
+#include <algorithm>
+
+#include "meshoptimizer.h"
+
+using namespace SceneGraph;
+
+class tst_MeshOptimizer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void vertexCache();
+    void vertexFetch();
+
+private:
+    static std::vector<unsigned int> grid(unsigned int size);
+    static void shuffle(std::vector<unsigned int> *indices);
+};
+
+// size * size quads of two triangles, row by row
+std::vector<unsigned int> tst_MeshOptimizer::grid(unsigned int size)
+{
+    std::vector<unsigned int> indices;
+    for (unsigned int y = 0; y < size; ++y) {
+        for (unsigned int x = 0; x < size; ++x) {
+            const unsigned int corner = y * (size + 1) + x;
+            const unsigned int quad[6] = { corner, corner + size + 1, corner + 1,
+                                           corner + 1, corner + size + 1, corner + size + 2 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+    return indices;
+}
+
+// the triangles in a fixed pseudo random order
+void tst_MeshOptimizer::shuffle(std::vector<unsigned int> *indices)
+{
+    unsigned int seed = 12345;
+    for (unsigned int t = indices->size() / 3; t > 1; --t) {
+        seed = seed * 1103515245u + 12345u;
+        const unsigned int other = (seed >> 16) % t;
+        for (int k = 0; k < 3; ++k)
+            std::swap((*indices)[(t - 1) * 3 + k], (*indices)[other * 3 + k]);
+    }
+}
+
+void tst_MeshOptimizer::vertexCache()
+{
+    const unsigned int size = 32;
+    const unsigned int vertex_count = (size + 1) * (size + 1);
+    std::vector<unsigned int> indices = grid(size);
+    shuffle(&indices);
+    const unsigned int index_count = indices.size();
+
+    const float acmr_before = MeshOptimizer::acmr(&indices[0], index_count);
+    const float atvr_before = MeshOptimizer::atvr(&indices[0], index_count, vertex_count);
+    MeshOptimizer::optimizeVertexCache(&indices[0], index_count, vertex_count);
+    const float acmr_after = MeshOptimizer::acmr(&indices[0], index_count);
+    const float atvr_after = MeshOptimizer::atvr(&indices[0], index_count, vertex_count);
+
+    // a regular grid can not do better than half a vertex per triangle
+    QVERIFY(acmr_before > 1.5f);
+    QVERIFY(acmr_after < 1.0f);
+    QVERIFY(acmr_after >= 0.5f);
+    QVERIFY(atvr_after < atvr_before);
+    QVERIFY(atvr_after >= 1.0f);
+
+    // the same triangles, only in another order
+    std::vector<unsigned int> expected = grid(size);
+    std::vector<unsigned int> sorted_expected;
+    std::vector<unsigned int> sorted_result;
+    for (unsigned int t = 0; t < index_count / 3; ++t) {
+        unsigned int a[3] = { expected[t * 3], expected[t * 3 + 1], expected[t * 3 + 2] };
+        unsigned int b[3] = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+        std::rotate(a, std::min_element(a, a + 3), a + 3);
+        std::rotate(b, std::min_element(b, b + 3), b + 3);
+        sorted_expected.push_back((a[0] * vertex_count + a[1]) * vertex_count + a[2]);
+        sorted_result.push_back((b[0] * vertex_count + b[1]) * vertex_count + b[2]);
+    }
+    std::sort(sorted_expected.begin(), sorted_expected.end());
+    std::sort(sorted_result.begin(), sorted_result.end());
+    QVERIFY(sorted_expected == sorted_result);
+}
+
+void tst_MeshOptimizer::vertexFetch()
+{
+    const unsigned int size = 8;
+    const unsigned int vertex_count = (size + 1) * (size + 1) + 1; // the last one is not used
+    std::vector<unsigned int> indices = grid(size);
+    shuffle(&indices);
+    const unsigned int index_count = indices.size();
+
+    // every vertex carries its old index, twice to check the stride
+    std::vector<float> vertices(vertex_count * 2);
+    for (unsigned int v = 0; v < vertex_count; ++v) {
+        vertices[v * 2] = float(v);
+        vertices[v * 2 + 1] = -float(v);
+    }
+    const std::vector<unsigned int> old_indices = indices;
+
+    const unsigned int used = MeshOptimizer::optimizeVertexFetch(&vertices[0], vertex_count, sizeof(float) * 2,
+                                                                 &indices[0], index_count);
+    QCOMPARE(used, vertex_count - 1);
+
+    unsigned int next = 0;
+    for (unsigned int i = 0; i < index_count; ++i) {
+        QVERIFY(indices[i] < used);
+        QCOMPARE(vertices[indices[i] * 2], float(old_indices[i]));
+        QCOMPARE(vertices[indices[i] * 2 + 1], -float(old_indices[i]));
+        // numbered in the order of first use
+        QVERIFY(indices[i] <= next);
+        if (indices[i] == next)
+            ++next;
+    }
+}
+
+QTEST_APPLESS_MAIN(tst_MeshOptimizer)
+
+#include "tst_meshoptimizer.moc"
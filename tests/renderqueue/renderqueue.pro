@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = tst_renderqueue
+CONFIG += console testcase
+CONFIG -= app_bundle
+QT += testlib gui opengl
+INCLUDEPATH += ../../src
+LIBS += -L$$OUT_PWD/../../lib -lscenegraph
+unix:PRE_TARGETDEPS += $$OUT_PWD/../../lib/libscenegraph.a
+SOURCES += tst_renderqueue.cpp
+
+test.commands = ./$$TARGET
+QMAKE_EXTRA_TARGETS += test
@@ -0,0 +1,94 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include <QtTest>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+
+#include "renderqueue.h"
+#include "scenegraph.h"
+
+using namespace SceneGraph;
+
+// counts the draws that reach the override
+class CountingMesh : public InstancedMesh
+{
+public:
+    CountingMesh(const VertexFormat &format, const float *vertices, unsigned int vertices_size,
+                 const unsigned int *indices, unsigned int indices_size, Node *parent)
+        : InstancedMesh(GL_TRIANGLES, format, vertices, vertices_size, indices, indices_size,
+                        GL_UNSIGNED_INT, 3, Matrices, parent),
+          draws(0)
+    {
+    }
+
+    void draw(Shader *shader)
+    {
+        ++draws;
+        InstancedMesh::draw(shader);
+    }
+
+    int draws;
+};
+
+class tst_RenderQueue : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void instancedMesh();
+
+private:
+    QOffscreenSurface *m_surface;
+    QOpenGLContext *m_context;
+};
+
+void tst_RenderQueue::initTestCase()
+{
+    m_surface = new QOffscreenSurface;
+    m_surface->create();
+    m_context = new QOpenGLContext;
+    if (!m_context->create() || !m_context->makeCurrent(m_surface))
+        QSKIP("no OpenGL context");
+    Rasterizer::makeCurrent(m_context->functions());
+}
+
+void tst_RenderQueue::cleanupTestCase()
+{
+    delete m_context;
+    delete m_surface;
+}
+
+void tst_RenderQueue::instancedMesh()
+{
+    const float vertices[] = { 0, 0, 0, 1, 0, 0, 0, 1, 0 };
+    const unsigned int indices[] = { 0, 1, 2 };
+    VertexFormat format;
+    format.add(VertexFormat::Position, 3);
+
+    Node root;
+    Shader *shader = InstancedMesh::createDefaultShader(&root);
+    CountingMesh *mesh = new CountingMesh(format, vertices, sizeof(vertices), indices, sizeof(indices), shader);
+
+    // the queue has to replay the draw of the subclass, not a plain range of the mesh
+    RenderQueue queue;
+    State state;
+    state.setRenderQueue(&queue);
+    state.execute(&root);
+    QCOMPARE(queue.size(), 1u);
+    QCOMPARE(mesh->draws, 1);
+
+    state.setRenderQueue(0);
+    state.execute(&root);
+    QCOMPARE(mesh->draws, 2);
+}
+
+QTEST_MAIN(tst_RenderQueue)
+
+#include "tst_renderqueue.moc"
@@ -0,0 +1,139 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include <QtTest>
+#include <stdexcept>
+
+#include "scenegraph.h"
+#include "scenearena.h"
+
+using namespace SceneGraph;
+
+class tst_SceneArena : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void allocations();
+    void throwingConstructor();
+    void buildAndTeardown_data();
+    void buildAndTeardown();
+
+private:
+    enum { NodeCount = 4096, BlockSize = 64 * 1024 };
+    static Node *build(SceneArena *arena, unsigned int count);
+};
+
+// a level: groups of plain nodes with a transform each, every tenth node
+// starting a new group; with no arena the nodes come from the heap
+Node *tst_SceneArena::build(SceneArena *arena, unsigned int count)
+{
+    Node *root = new (arena) Node;
+    Node *group = root;
+    for (unsigned int i = 1; i < count; ++i) {
+        if (i % 10 == 0)
+            group = new (arena) Transformation(0, root);
+        else
+            new (arena) Node(group);
+    }
+    return root;
+}
+
+void tst_SceneArena::allocations()
+{
+    SceneArena arena(BlockSize);
+    build(&arena, NodeCount);
+    QCOMPARE(arena.nodeCount(), unsigned(NodeCount));
+    // one allocation per block, not per node; only the tail of each block
+    // may be left over, which adds up to less than another block
+    const unsigned int blocks = arena.blockCount();
+    const unsigned int full_blocks = unsigned((arena.bytesUsed() + BlockSize - 1) / BlockSize);
+    QVERIFY(blocks >= full_blocks);
+    QVERIFY(blocks <= full_blocks + 1);
+    QVERIFY(blocks * 100 < unsigned(NodeCount));
+
+    // deleting a node on its own keeps its memory in the arena
+    Node *extra = new (&arena) Node;
+    QCOMPARE(arena.nodeCount(), unsigned(NodeCount + 1));
+    delete extra;
+    QCOMPARE(arena.nodeCount(), unsigned(NodeCount));
+    QCOMPARE(arena.blockCount(), blocks);
+
+    // nodes from the heap stay out of it
+    Node *outside = new Node;
+    QVERIFY(!outside->arena());
+    QCOMPARE(arena.nodeCount(), unsigned(NodeCount));
+    delete outside;
+
+    arena.clear();
+    QCOMPARE(arena.nodeCount(), 0u);
+    QCOMPARE(arena.blockCount(), 0u);
+    QCOMPARE(arena.bytesUsed(), size_t(0));
+
+    // the arena can be filled again, with the same number of blocks
+    build(&arena, NodeCount);
+    QCOMPARE(arena.nodeCount(), unsigned(NodeCount));
+    QCOMPARE(arena.blockCount(), blocks);
+}
+
+static int fail()
+{
+    throw std::runtime_error("constructor argument");
+}
+
+class ThrowingNode : public Node
+{
+public:
+    ThrowingNode(int) {}
+};
+
+void tst_SceneArena::throwingConstructor()
+{
+    SceneArena arena(BlockSize);
+    bool thrown = false;
+    try {
+        new (&arena) ThrowingNode(fail());
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    QVERIFY(thrown);
+    QCOMPARE(arena.nodeCount(), 0u);
+
+    // neither the next heap node nor the next arena node is confused by the one that failed
+    Node *outside = new Node;
+    QVERIFY(!outside->arena());
+    QCOMPARE(arena.nodeCount(), 0u);
+    delete outside;
+    Node *inside = new (&arena) Node;
+    QCOMPARE(inside->arena(), &arena);
+    QCOMPARE(arena.nodeCount(), 1u);
+}
+
+void tst_SceneArena::buildAndTeardown_data()
+{
+    QTest::addColumn<bool>("useArena");
+    QTest::newRow("heap") << false;
+    QTest::newRow("arena") << true;
+}
+
+void tst_SceneArena::buildAndTeardown()
+{
+    QFETCH(bool, useArena);
+    SceneArena arena(BlockSize);
+    QBENCHMARK {
+        Node *root = build(useArena ? &arena : 0, NodeCount);
+        if (useArena)
+            arena.clear();
+        else
+            delete root;
+    }
+    QCOMPARE(arena.nodeCount(), 0u);
+}
+
+QTEST_APPLESS_MAIN(tst_SceneArena)
+
+#include "tst_scenearena.moc"
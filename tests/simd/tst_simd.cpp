@@ -0,0 +1,319 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include <QtTest>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "simd.h"
+
+using namespace SceneGraph;
+
+class tst_Simd : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void multiplyMatrices();
+    void multiplyMatricesBatch();
+    void transformPoints();
+    void transformVectors();
+    void invertMatrix();
+    void multiplyQuaternions();
+    void slerpQuaternions();
+
+    void benchmarkMultiplyMatricesBatch_data();
+    void benchmarkMultiplyMatricesBatch();
+    void benchmarkTransformPoints_data();
+    void benchmarkTransformPoints();
+    void benchmarkInvertMatrix_data();
+    void benchmarkInvertMatrix();
+
+private:
+    enum { Samples = 1000, BatchCount = 1024 };
+
+    // the built versions other than the scalar reference
+    std::vector<const MathKernels*> m_kernels;
+    unsigned int m_seed;
+
+    void fill(float *values, unsigned int count, float range);
+    void randomQuaternion(float *q);
+    void benchmarkData();
+    const MathKernels *benchmarkKernels();
+};
+
+// the largest difference relative to the largest magnitude in reference
+static float relative_difference(const float *values, const float *reference, unsigned int count)
+{
+    float difference = 0;
+    float magnitude = 0;
+    for (unsigned int i = 0; i < count; ++i) {
+        difference = qMax(difference, float(fabs(values[i] - reference[i])));
+        magnitude = qMax(magnitude, float(fabs(reference[i])));
+    }
+    return magnitude > 0 ? difference / magnitude : difference;
+}
+
+void tst_Simd::initTestCase()
+{
+    const MathKernels *kernels[3] = { sse2_math_kernels(), avx_math_kernels(), neon_math_kernels() };
+    for (int i = 0; i < 3; ++i) {
+        if (kernels[i])
+            m_kernels.push_back(kernels[i]);
+    }
+    qDebug("testing %d versions against the scalar one, picked: %s", int(m_kernels.size()), math_kernels().name);
+}
+
+// a fixed pseudo random sequence, the same on every run
+void tst_Simd::fill(float *values, unsigned int count, float range)
+{
+    for (unsigned int i = 0; i < count; ++i) {
+        m_seed = m_seed * 1103515245u + 12345u;
+        values[i] = (float((m_seed >> 8) & 0xffff) / 0xffff * 2 - 1) * range;
+    }
+}
+
+void tst_Simd::randomQuaternion(float *q)
+{
+    fill(q, 4, 1);
+    const float length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (int i = 0; i < 4; ++i)
+        q[i] /= length;
+}
+
+void tst_Simd::multiplyMatrices()
+{
+    const MathKernels *scalar = scalar_math_kernels();
+    for (size_t k = 0; k < m_kernels.size(); ++k) {
+        m_seed = 1;
+        for (int sample = 0; sample < Samples; ++sample) {
+            float a[16], b[16], expected[16], result[16];
+            fill(a, 16, 2);
+            fill(b, 16, 2);
+            scalar->multiply_matrices(a, b, expected);
+            m_kernels[k]->multiply_matrices(a, b, result);
+            QVERIFY2(memcmp(expected, result, sizeof(result)) == 0, m_kernels[k]->name);
+        }
+    }
+}
+
+void tst_Simd::multiplyMatricesBatch()
+{
+    const MathKernels *scalar = scalar_math_kernels();
+    // odd counts reach the tails of the vector loops
+    const unsigned int counts[4] = { 1, 3, 8, 17 };
+    for (size_t k = 0; k < m_kernels.size(); ++k) {
+        m_seed = 2;
+        for (int c = 0; c < 4; ++c) {
+            const unsigned int count = counts[c];
+            float a[16];
+            std::vector<float> b(count * 16), expected(count * 16), result(count * 16);
+            fill(a, 16, 2);
+            fill(&b[0], count * 16, 2);
+            scalar->multiply_matrices_batch(a, &b[0], &expected[0], count);
+            m_kernels[k]->multiply_matrices_batch(a, &b[0], &result[0], count);
+            QVERIFY2(memcmp(&expected[0], &result[0], count * 16 * sizeof(float)) == 0, m_kernels[k]->name);
+        }
+    }
+}
+
+void tst_Simd::transformPoints()
+{
+    const MathKernels *scalar = scalar_math_kernels();
+    const unsigned int counts[4] = { 1, 3, 8, 17 };
+    for (size_t k = 0; k < m_kernels.size(); ++k) {
+        m_seed = 3;
+        for (int c = 0; c < 4; ++c) {
+            const unsigned int count = counts[c];
+            float m[16];
+            std::vector<float> points(count * 3), expected(count * 3), result(count * 3);
+            fill(m, 16, 2);
+            fill(&points[0], count * 3, 100);
+            scalar->transform_points(m, &points[0], &expected[0], count);
+            m_kernels[k]->transform_points(m, &points[0], &result[0], count);
+            QVERIFY2(memcmp(&expected[0], &result[0], count * 3 * sizeof(float)) == 0, m_kernels[k]->name);
+        }
+    }
+}
+
+void tst_Simd::transformVectors()
+{
+    const MathKernels *scalar = scalar_math_kernels();
+    const unsigned int counts[4] = { 1, 3, 8, 17 };
+    for (size_t k = 0; k < m_kernels.size(); ++k) {
+        m_seed = 4;
+        for (int c = 0; c < 4; ++c) {
+            const unsigned int count = counts[c];
+            float m[16];
+            std::vector<float> vectors(count * 3), expected(count * 3), result(count * 3);
+            fill(m, 16, 2);
+            fill(&vectors[0], count * 3, 100);
+            scalar->transform_vectors(m, &vectors[0], &expected[0], count);
+            m_kernels[k]->transform_vectors(m, &vectors[0], &result[0], count);
+            QVERIFY2(memcmp(&expected[0], &result[0], count * 3 * sizeof(float)) == 0, m_kernels[k]->name);
+        }
+    }
+}
+
+void tst_Simd::invertMatrix()
+{
+    // the cofactors are summed in another order and the error grows with
+    // the condition of the matrix; relative to the largest element of the
+    // inverse, these matrices stay within 4.2e-4 on SSE2 and AVX
+    const float tolerance = 1e-3f;
+    const MathKernels *scalar = scalar_math_kernels();
+    for (size_t k = 0; k < m_kernels.size(); ++k) {
+        m_seed = 5;
+        float worst = 0;
+        for (int sample = 0; sample < Samples; ++sample) {
+            float m[16], expected[16], result[16];
+            fill(m, 16, 2);
+            const bool expected_ok = scalar->invert_matrix(m, expected);
+            const bool result_ok = m_kernels[k]->invert_matrix(m, result);
+            QCOMPARE(result_ok, expected_ok);
+            if (expected_ok)
+                worst = qMax(worst, relative_difference(result, expected, 16));
+        }
+        qDebug("%s: inverse within %g", m_kernels[k]->name, worst);
+        QVERIFY2(worst <= tolerance, m_kernels[k]->name);
+    }
+
+    // singular matrices are reported and leave the result alone
+    const float singular[16] = { 1, 2, 3, 4, 2, 4, 6, 8, 0, 0, 1, 0, 0, 0, 0, 1 };
+    for (size_t k = 0; k < m_kernels.size(); ++k) {
+        float result[16];
+        for (int i = 0; i < 16; ++i)
+            result[i] = 42;
+        QVERIFY2(!m_kernels[k]->invert_matrix(singular, result), m_kernels[k]->name);
+        QCOMPARE(result[0], 42.0f);
+    }
+}
+
+void tst_Simd::multiplyQuaternions()
+{
+    const float tolerance = 1e-6f;
+    const MathKernels *scalar = scalar_math_kernels();
+    for (size_t k = 0; k < m_kernels.size(); ++k) {
+        m_seed = 6;
+        float worst = 0;
+        for (int sample = 0; sample < Samples; ++sample) {
+            float a[4], b[4], expected[4], result[4];
+            randomQuaternion(a);
+            randomQuaternion(b);
+            scalar->multiply_quaternions(a, b, expected);
+            m_kernels[k]->multiply_quaternions(a, b, result);
+            for (int i = 0; i < 4; ++i)
+                worst = qMax(worst, float(fabs(result[i] - expected[i])));
+        }
+        QVERIFY2(worst <= tolerance, m_kernels[k]->name);
+    }
+}
+
+void tst_Simd::slerpQuaternions()
+{
+    // absolute, on unit quaternions; SSE2 and AVX stay within 2.4e-7
+    const float tolerance = 1e-6f;
+    const MathKernels *scalar = scalar_math_kernels();
+    const float steps[5] = { 0, 0.25f, 0.5f, 0.75f, 1 };
+    for (size_t k = 0; k < m_kernels.size(); ++k) {
+        m_seed = 7;
+        float worst = 0;
+        for (int sample = 0; sample < Samples; ++sample) {
+            float a[4], b[4];
+            randomQuaternion(a);
+            randomQuaternion(b);
+            // nearly the same rotation, where the sine gets small
+            if (sample % 10 == 0) {
+                for (int i = 0; i < 4; ++i)
+                    b[i] = a[i] + 1e-4f * b[i];
+            }
+            for (int s = 0; s < 5; ++s) {
+                float expected[4], result[4];
+                scalar->slerp_quaternions(a, b, steps[s], expected);
+                m_kernels[k]->slerp_quaternions(a, b, steps[s], result);
+                for (int i = 0; i < 4; ++i)
+                    worst = qMax(worst, float(fabs(result[i] - expected[i])));
+            }
+        }
+        qDebug("%s: slerp within %g", m_kernels[k]->name, worst);
+        QVERIFY2(worst <= tolerance, m_kernels[k]->name);
+    }
+}
+
+void tst_Simd::benchmarkData()
+{
+    QTest::addColumn<int>("version");
+    QTest::newRow("scalar") << 0;
+    for (size_t k = 0; k < m_kernels.size(); ++k)
+        QTest::newRow(m_kernels[k]->name) << int(k + 1);
+}
+
+const MathKernels *tst_Simd::benchmarkKernels()
+{
+    QFETCH(int, version);
+    return version == 0 ? scalar_math_kernels() : m_kernels[version - 1];
+}
+
+void tst_Simd::benchmarkMultiplyMatricesBatch_data()
+{
+    benchmarkData();
+}
+
+void tst_Simd::benchmarkMultiplyMatricesBatch()
+{
+    const MathKernels *kernels = benchmarkKernels();
+    float a[16];
+    std::vector<float> b(BatchCount * 16), result(BatchCount * 16);
+    m_seed = 8;
+    fill(a, 16, 2);
+    fill(&b[0], b.size(), 2);
+    QBENCHMARK {
+        kernels->multiply_matrices_batch(a, &b[0], &result[0], BatchCount);
+    }
+}
+
+void tst_Simd::benchmarkTransformPoints_data()
+{
+    benchmarkData();
+}
+
+void tst_Simd::benchmarkTransformPoints()
+{
+    const MathKernels *kernels = benchmarkKernels();
+    float m[16];
+    std::vector<float> points(BatchCount * 3), result(BatchCount * 3);
+    m_seed = 9;
+    fill(m, 16, 2);
+    fill(&points[0], points.size(), 100);
+    QBENCHMARK {
+        kernels->transform_points(m, &points[0], &result[0], BatchCount);
+    }
+}
+
+void tst_Simd::benchmarkInvertMatrix_data()
+{
+    benchmarkData();
+}
+
+void tst_Simd::benchmarkInvertMatrix()
+{
+    const MathKernels *kernels = benchmarkKernels();
+    std::vector<float> matrices(BatchCount * 16);
+    float result[16];
+    m_seed = 10;
+    fill(&matrices[0], matrices.size(), 2);
+    QBENCHMARK {
+        for (unsigned int i = 0; i < BatchCount; ++i)
+            kernels->invert_matrix(&matrices[i * 16], result);
+    }
+}
+
+QTEST_APPLESS_MAIN(tst_Simd)
+
+#include "tst_simd.moc"
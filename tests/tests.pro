@@ -1,5 +1,5 @@
 TEMPLATE = subdirs
-SUBDIRS =
+SUBDIRS = meshoptimizer renderqueue matrixstack simd transformsystem scenearena
 
 test.CONFIG = recursive
 test.recurse = $$SUBDIRS
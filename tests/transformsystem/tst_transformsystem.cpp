@@ -0,0 +1,274 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+#include <QtTest>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "scenegraph.h"
+#include "transformsystem.h"
+#include "simd.h"
+
+using namespace SceneGraph;
+
+// the layout the transforms had before: every node on its own in the
+// heap, with its matrices and the links to its children
+struct PointerNode
+{
+    float local[16];
+    float world[16];
+    PointerNode *first_child;
+    PointerNode *next_sibling;
+};
+
+class tst_TransformSystem : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void compaction();
+    void traversal_data();
+    void traversal();
+    void pointerTraversal_data();
+    void pointerTraversal();
+
+private:
+    unsigned int random(unsigned int range);
+    void randomMatrix(float *matrix);
+    Node *buildTree(Node *root, unsigned int count, std::vector<Transformation*> *transforms);
+    void verify(Node *root);
+    static void collect(Node *node, std::vector<Transformation*> *transforms);
+    static void updatePointerTree(PointerNode *node, const float *parent);
+
+    unsigned int m_seed;
+    std::map<const Transformation*, std::vector<float> > m_locals;
+};
+
+unsigned int tst_TransformSystem::random(unsigned int range)
+{
+    m_seed = m_seed * 1103515245u + 12345u;
+    return ((m_seed >> 8) & 0xffff) % range;
+}
+
+// a rotation about z and a translation, so the products stay well scaled
+void tst_TransformSystem::randomMatrix(float *matrix)
+{
+    const float angle = random(628) / 100.0f;
+    const float c = cosf(angle);
+    const float s = sinf(angle);
+    const float m[16] = {
+        c, s, 0, 0,
+        -s, c, 0, 0,
+        0, 0, 1, 0,
+        random(200) / 10.0f - 10, random(200) / 10.0f - 10, random(200) / 10.0f - 10, 1 };
+    memcpy(matrix, m, sizeof(m));
+}
+
+// transforms hang off random earlier nodes, with a plain Node in between now and then
+Node *tst_TransformSystem::buildTree(Node *root, unsigned int count, std::vector<Transformation*> *transforms)
+{
+    std::vector<Node*> nodes(1, root);
+    for (unsigned int i = 0; i < count; ++i) {
+        Node *parent = nodes[random(nodes.size())];
+        if (i % 7 == 0) {
+            nodes.push_back(new Node(parent));
+            parent = nodes.back();
+        }
+        float matrix[16];
+        randomMatrix(matrix);
+        Transformation *transform = new Transformation(matrix, parent);
+        m_locals[transform].assign(matrix, matrix + 16);
+        transforms->push_back(transform);
+        nodes.push_back(transform);
+    }
+    return root;
+}
+
+void tst_TransformSystem::collect(Node *node, std::vector<Transformation*> *transforms)
+{
+    if (Transformation *transform = dynamic_cast<Transformation*>(node))
+        transforms->push_back(transform);
+    for (Node *child = node->firstChild(); child; child = child->nextSibling())
+        collect(child, transforms);
+}
+
+// every world matrix against the product of the local matrices, found by walking up the parents
+void tst_TransformSystem::verify(Node *root)
+{
+    const MathKernels &kernels = math_kernels();
+    std::vector<Transformation*> transforms;
+    collect(root, &transforms);
+    for (size_t t = 0; t < transforms.size(); ++t) {
+        std::vector<const Transformation*> chain;
+        for (Node *node = transforms[t]; node; node = node->parent()) {
+            if (const Transformation *transform = dynamic_cast<const Transformation*>(node))
+                chain.push_back(transform);
+        }
+        float expected[16];
+        memcpy(expected, &m_locals[chain.back()][0], sizeof(expected));
+        for (size_t c = chain.size() - 1; c > 0; --c) {
+            float product[16];
+            kernels.multiply_matrices(expected, &m_locals[chain[c - 1]][0], product);
+            memcpy(expected, product, sizeof(expected));
+        }
+        QVERIFY(memcmp(transforms[t]->worldMatrix(), expected, sizeof(expected)) == 0);
+    }
+}
+
+void tst_TransformSystem::compaction()
+{
+    TransformSystem *system = TransformSystem::instance();
+    system->compact();
+    const unsigned int before = system->count();
+    m_seed = 1;
+    m_locals.clear();
+
+    std::vector<Transformation*> transforms;
+    Node *root = buildTree(new Node, 1000, &transforms);
+    system->update();
+    QCOMPARE(system->count(), before + 1000);
+    QCOMPARE(system->updatedCount(), 1000u);
+    verify(root);
+
+    // removing subtrees leaves holes, removing enough of them compacts
+    unsigned int removed = 0;
+    while (removed * 4 < 1000) {
+        Transformation *victim = transforms[random(transforms.size())];
+        std::vector<Transformation*> subtree;
+        collect(victim, &subtree);
+        for (size_t i = 0; i < subtree.size(); ++i) {
+            transforms.erase(std::find(transforms.begin(), transforms.end(), subtree[i]));
+            m_locals.erase(subtree[i]);
+        }
+        removed += subtree.size();
+        delete victim;
+    }
+    QCOMPARE(system->freeCount(), removed);
+
+    // moving a transform below one that was created after it puts the parent behind the child
+    Transformation *moved = transforms.front();
+    Transformation *target = transforms.back();
+    std::vector<Transformation*> below;
+    collect(moved, &below);
+    if (std::find(below.begin(), below.end(), target) == below.end())
+        moved->setParent(target);
+
+    system->update();
+    QCOMPARE(system->freeCount(), 0u);
+    QCOMPARE(system->count(), before + 1000 - removed);
+    verify(root);
+
+    // only the changed transform and the ones below it are recomputed
+    float matrix[16];
+    randomMatrix(matrix);
+    Transformation *changed = transforms[random(transforms.size())];
+    changed->translate(matrix[12], matrix[13], matrix[14]);
+    const float translation[16] = {
+        1, 0, 0, 0,
+        0, 1, 0, 0,
+        0, 0, 1, 0,
+        matrix[12], matrix[13], matrix[14], 1 };
+    float local[16];
+    math_kernels().multiply_matrices(&m_locals[changed][0], translation, local);
+    m_locals[changed].assign(local, local + 16);
+    std::vector<Transformation*> subtree;
+    collect(changed, &subtree);
+    system->update();
+    QCOMPARE(system->updatedCount(), unsigned(subtree.size()));
+    verify(root);
+
+    delete root;
+    m_locals.clear();
+}
+
+void tst_TransformSystem::traversal_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::newRow("1024 nodes") << 1024;
+    QTest::newRow("16384 nodes") << 16384;
+}
+
+// every world matrix recomputed, as after moving the root
+void tst_TransformSystem::traversal()
+{
+    QFETCH(int, count);
+    TransformSystem *system = TransformSystem::instance();
+    system->compact();
+    m_seed = 2;
+    std::vector<Transformation*> transforms;
+    Transformation *root = new Transformation(0);
+    buildTree(root, count, &transforms);
+    system->update();
+    QBENCHMARK {
+        root->translate(0, 0, 0);
+        system->update();
+    }
+    QCOMPARE(system->updatedCount(), unsigned(count + 1));
+    delete root;
+    m_locals.clear();
+}
+
+void tst_TransformSystem::pointerTraversal_data()
+{
+    traversal_data();
+}
+
+void tst_TransformSystem::updatePointerTree(PointerNode *node, const float *parent)
+{
+    const MathKernels &kernels = math_kernels();
+    for (; node; node = node->next_sibling) {
+        kernels.multiply_matrices(parent, node->local, node->world);
+        updatePointerTree(node->first_child, node->world);
+    }
+}
+
+// the same tree as traversal(), walked through the pointers
+void tst_TransformSystem::pointerTraversal()
+{
+    QFETCH(int, count);
+    m_seed = 2;
+    std::vector<Transformation*> transforms;
+    Transformation *root = new Transformation(0);
+    buildTree(root, count, &transforms);
+
+    std::map<Node*, PointerNode*> mirror;
+    PointerNode *pointer_root = new PointerNode;
+    memset(pointer_root, 0, sizeof(PointerNode));
+    for (int i = 0; i < 16; ++i)
+        pointer_root->local[i] = i % 5 == 0 ? 1 : 0;
+    mirror[root] = pointer_root;
+    std::vector<PointerNode*> nodes(1, pointer_root);
+    for (size_t t = 0; t < transforms.size(); ++t) {
+        PointerNode *node = new PointerNode;
+        memcpy(node->local, &m_locals[transforms[t]][0], sizeof(node->local));
+        node->first_child = 0;
+        Node *above = transforms[t]->parent();
+        while (!dynamic_cast<Transformation*>(above))
+            above = above->parent();
+        PointerNode *parent = mirror[above];
+        node->next_sibling = parent->first_child;
+        parent->first_child = node;
+        mirror[transforms[t]] = node;
+        nodes.push_back(node);
+    }
+    delete root;
+    m_locals.clear();
+
+    QBENCHMARK {
+        memcpy(pointer_root->world, pointer_root->local, sizeof(pointer_root->world));
+        updatePointerTree(pointer_root->first_child, pointer_root->world);
+    }
+    for (size_t n = 0; n < nodes.size(); ++n)
+        delete nodes[n];
+}
+
+QTEST_APPLESS_MAIN(tst_TransformSystem)
+
+#include "tst_transformsystem.moc"
@@ -0,0 +1,234 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Cutehacks AS.
+** Contact: http://www.cutehacks.com/contact
+**
+****************************************************************************/
+
+// Converts a Wavefront OBJ file into the binary container read by
+// MeshFile. Faces are triangulated as fans and every distinct
+// position/texuv/normal combination becomes one vertex. With -optimize the
+// triangles and vertices are reordered for the vertex cache, and with
+// -benchmark parsing the OBJ file is timed against reading the container.
+
+#include <map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <QtCore>
+
+#include "meshfile.h"
+#include "meshoptimizer.h"
+
+using namespace SceneGraph;
+
+struct ObjMesh {
+    VertexFormat format;
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+};
+
+struct ObjCorner {
+    int position, texuv, normal;
+
+    bool operator<(const ObjCorner &other) const
+    {
+        if (position != other.position)
+            return position < other.position;
+        if (texuv != other.texuv)
+            return texuv < other.texuv;
+        return normal < other.normal;
+    }
+};
+
+// OBJ indices start at 1, negative ones count back from the end
+static int resolve_index(long index, size_t count)
+{
+    if (index > 0 && size_t(index) <= count)
+        return int(index - 1);
+    if (index < 0 && size_t(-index) <= count)
+        return int(count + index);
+    return -1;
+}
+
+static void read_floats(const char *p, int count, std::vector<float> *values)
+{
+    char *end;
+    for (int i = 0; i < count; ++i, p = end)
+        values->push_back(strtof(p, &end));
+}
+
+static bool parse_obj(const char *file_name, ObjMesh *mesh)
+{
+    FILE *file = fopen(file_name, "rb");
+    if (!file) {
+        fprintf(stderr, "meshconverter: could not open %s\n", file_name);
+        return false;
+    }
+    std::vector<float> positions, texuvs, normals;
+    std::vector<ObjCorner> face, triangles;
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) {
+            read_floats(line + 1, 3, &positions);
+        } else if (line[0] == 'v' && line[1] == 't') {
+            read_floats(line + 2, 2, &texuvs);
+        } else if (line[0] == 'v' && line[1] == 'n') {
+            read_floats(line + 2, 3, &normals);
+        } else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t')) {
+            // v, v/vt, v//vn or v/vt/vn
+            face.clear();
+            char *p = line + 1;
+            for (;;) {
+                char *end;
+                const long position = strtol(p, &end, 10);
+                if (end == p)
+                    break;
+                p = end;
+                ObjCorner corner = { resolve_index(position, positions.size() / 3), -1, -1 };
+                if (*p == '/') {
+                    ++p;
+                    if (*p != '/')
+                        corner.texuv = resolve_index(strtol(p, &p, 10), texuvs.size() / 2);
+                    if (*p == '/')
+                        corner.normal = resolve_index(strtol(p + 1, &p, 10), normals.size() / 3);
+                }
+                if (corner.position < 0) {
+                    fprintf(stderr, "meshconverter: a face refers to a missing vertex\n");
+                    fclose(file);
+                    return false;
+                }
+                face.push_back(corner);
+            }
+            for (size_t i = 2; i < face.size(); ++i) {
+                triangles.push_back(face[0]);
+                triangles.push_back(face[i - 1]);
+                triangles.push_back(face[i]);
+            }
+        }
+    }
+    fclose(file);
+
+    // only attributes every corner has make it into the format
+    bool has_texuvs = !triangles.empty();
+    bool has_normals = !triangles.empty();
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        has_texuvs = has_texuvs && triangles[i].texuv >= 0;
+        has_normals = has_normals && triangles[i].normal >= 0;
+    }
+    mesh->format.add(VertexFormat::Position, 3);
+    if (has_normals)
+        mesh->format.add(VertexFormat::Normal, 3);
+    if (has_texuvs)
+        mesh->format.add(VertexFormat::Texuv, 2);
+
+    std::map<ObjCorner, unsigned int> vertices;
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        ObjCorner corner = triangles[i];
+        if (!has_texuvs)
+            corner.texuv = -1;
+        if (!has_normals)
+            corner.normal = -1;
+        std::map<ObjCorner, unsigned int>::iterator found = vertices.find(corner);
+        if (found == vertices.end()) {
+            found = vertices.insert(std::make_pair(corner, unsigned(vertices.size()))).first;
+            mesh->vertices.insert(mesh->vertices.end(), &positions[corner.position * 3], &positions[corner.position * 3] + 3);
+            if (has_normals)
+                mesh->vertices.insert(mesh->vertices.end(), &normals[corner.normal * 3], &normals[corner.normal * 3] + 3);
+            if (has_texuvs)
+                mesh->vertices.insert(mesh->vertices.end(), &texuvs[corner.texuv * 2], &texuvs[corner.texuv * 2] + 2);
+        }
+        mesh->indices.push_back(found->second);
+    }
+    return true;
+}
+
+static bool write_mesh(const char *file_name, ObjMesh *mesh, bool optimize)
+{
+    const unsigned int stride = mesh->format.stride();
+    unsigned int vertex_count = mesh->vertices.size() * sizeof(float) / stride;
+    const unsigned int index_count = mesh->indices.size();
+    if (optimize && index_count >= 3) {
+        MeshOptimizer::optimizeVertexCache(&mesh->indices[0], index_count, vertex_count);
+        vertex_count = MeshOptimizer::optimizeVertexFetch(&mesh->vertices[0], vertex_count, stride,
+                                                          &mesh->indices[0], index_count);
+        mesh->vertices.resize(vertex_count * stride / sizeof(float));
+    }
+
+    // the smallest index type that can address every vertex, as Mesh::CompactIndices picks it
+    GLenum index_type = GL_UNSIGNED_INT;
+    if (vertex_count <= 0x100)
+        index_type = GL_UNSIGNED_BYTE;
+    else if (vertex_count <= 0x10000)
+        index_type = GL_UNSIGNED_SHORT;
+    std::vector<char> indices(index_count * VertexFormat::typeSize(index_type));
+    for (unsigned int i = 0; i < index_count; ++i) {
+        const unsigned int index = mesh->indices[i];
+        switch (index_type) {
+        case GL_UNSIGNED_BYTE: reinterpret_cast<unsigned char*>(&indices[0])[i] = index; break;
+        case GL_UNSIGNED_SHORT: reinterpret_cast<unsigned short*>(&indices[0])[i] = index; break;
+        default: reinterpret_cast<unsigned int*>(&indices[0])[i] = index; break;
+        }
+    }
+
+    printf("%u vertices, %u triangles, %s indices\n", vertex_count, index_count / 3,
+           index_type == GL_UNSIGNED_BYTE ? "8 bit" : index_type == GL_UNSIGNED_SHORT ? "16 bit" : "32 bit");
+    return MeshFile::save(QString::fromLocal8Bit(file_name), GL_TRIANGLES, mesh->format,
+                          mesh->vertices.empty() ? 0 : &mesh->vertices[0], vertex_count * stride,
+                          indices.empty() ? 0 : &indices[0], indices.size(), index_type);
+}
+
+static void benchmark(const char *obj_file, const char *mesh_file)
+{
+    enum { Runs = 10 };
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < Runs; ++i) {
+        ObjMesh mesh;
+        parse_obj(obj_file, &mesh);
+    }
+    const double obj_time = timer.nsecsElapsed() / 1000000.0 / Runs;
+
+    // what MeshFile::load does before the upload
+    timer.start();
+    for (int i = 0; i < Runs; ++i) {
+        QFile file(QString::fromLocal8Bit(mesh_file));
+        if (!file.open(QIODevice::ReadOnly))
+            return;
+        uchar *data = file.map(0, file.size());
+        MeshFile::Contents contents;
+        if (!data || !MeshFile::read(data, file.size(), &contents))
+            return;
+        file.unmap(data);
+    }
+    const double mesh_time = timer.nsecsElapsed() / 1000000.0 / Runs;
+    printf("parsing OBJ: %.3f ms, reading the container: %.3f ms\n", obj_time, mesh_time);
+}
+
+int main(int argc, char *argv[])
+{
+    bool optimize = false;
+    bool measure = false;
+    const char *files[2] = { 0, 0 };
+    int file_count = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-optimize") == 0)
+            optimize = true;
+        else if (strcmp(argv[i], "-benchmark") == 0)
+            measure = true;
+        else if (file_count < 2)
+            files[file_count++] = argv[i];
+    }
+    if (file_count != 2) {
+        fprintf(stderr, "usage: meshconverter [-optimize] [-benchmark] input.obj output.mesh\n");
+        return 1;
+    }
+
+    ObjMesh mesh;
+    if (!parse_obj(files[0], &mesh) || !write_mesh(files[1], &mesh, optimize))
+        return 1;
+    if (measure)
+        benchmark(files[0], files[1]);
+    return 0;
+}
@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = meshconverter
+CONFIG += console
+CONFIG -= app_bundle
+QT += opengl
+INCLUDEPATH += ../../src
+LIBS += -L$$OUT_PWD/../../lib -lscenegraph
+unix:PRE_TARGETDEPS += $$OUT_PWD/../../lib/libscenegraph.a
+SOURCES += main.cpp